@@ -0,0 +1,95 @@
+/*
+ * Measures the overhead of a single call into the addon, through the
+ * generic worktype callers (SyncCaller/AsyncCaller, every call converts
+ * all five arguments) vs. the typed per-operation natives.
+ *
+ * Uses getErrorString, which telldus-core answers without telldusd.
+ *
+ *   node bench/calls.js [calls] [rounds]
+ */
+var native = require('../build/Release/telldus');
+require('..'); // Initializes the library
+
+var calls = parseInt(process.argv[2], 10) || 100000;
+var rounds = parseInt(process.argv[3], 10) || 5;
+var asyncWindow = 64; // Calls kept in flight by the async runs
+
+
+function median(values) {
+  values.sort(function (a, b) { return a - b; });
+  return values[Math.floor(values.length / 2)];
+}
+
+
+function pad(str, len) {
+  str = String(str);
+  while (str.length < len) {
+    str = ' ' + str;
+  }
+  return str;
+}
+
+
+function timeSync(call) {
+  var times = [];
+  for (var r = 0; r < rounds; r++) {
+    var start = process.hrtime();
+    for (var i = 0; i < calls; i++) {
+      call(-1);
+    }
+    var diff = process.hrtime(start);
+    times.push((diff[0] * 1e9 + diff[1]) / calls);
+  }
+  return median(times);
+}
+
+
+function timeAsync(call, done) {
+  var times = [];
+  var round = function () {
+    var started = 0, finished = 0;
+    var start = process.hrtime();
+    var next = function () {
+      if (++finished === calls) {
+        var diff = process.hrtime(start);
+        times.push((diff[0] * 1e9 + diff[1]) / calls);
+        return times.length < rounds ? round() : done(median(times));
+      }
+      if (started < calls) {
+        started++;
+        call(-1, next);
+      }
+    };
+    for (; started < Math.min(asyncWindow, calls); started++) {
+      call(-1, next);
+    }
+  };
+  round();
+}
+
+
+var runs = [
+  ['sync, generic', function (done) {
+    done(timeSync(function (id) { return native.SyncCaller(14, id, 0, '', ''); }));
+  }],
+  ['sync, typed', function (done) {
+    done(timeSync(function (id) { return native.getErrorStringSync(id); }));
+  }],
+  ['async, generic', function (done) {
+    timeAsync(function (id, cb) { native.AsyncCaller(14, id, 0, '', '', cb); }, done);
+  }],
+  ['async, typed', function (done) {
+    timeAsync(function (id, cb) { native.getErrorString(id, cb); }, done);
+  }]
+];
+
+console.log(pad('caller', 16) + pad('ns/call', 12));
+(function run(i) {
+  if (i === runs.length) {
+    return;
+  }
+  runs[i][1](function (ns) {
+    console.log(pad(runs[i][0], 16) + pad(ns.toFixed(0), 12));
+    run(i + 1);
+  });
+})(0);
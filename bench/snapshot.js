@@ -0,0 +1,83 @@
+/*
+ * Measures how long a device snapshot (getDevicesSync) takes as the
+ * number of configured devices grows, single threaded vs. threaded.
+ *
+ * Needs a running telldusd. Devices added by the benchmark are
+ * removed again when it is done.
+ *
+ *   node bench/snapshot.js [maxDevices] [rounds]
+ */
+var telldus = require('..');
+
+var maxDevices = parseInt(process.argv[2], 10) || 500;
+var rounds = parseInt(process.argv[3], 10) || 5;
+var steps = [10, 50, 100, 250, 500, 1000].filter(function (n) { return n <= maxDevices; });
+var threadCounts = [1, 2, 4, 8];
+
+var added = [];
+
+
+function median(values) {
+  values.sort(function (a, b) { return a - b; });
+  return values[Math.floor(values.length / 2)];
+}
+
+
+function timeSnapshot(threads) {
+  var times = [];
+  telldus.setSnapshotThreads(threads);
+  for (var i = 0; i < rounds; i++) {
+    var start = process.hrtime();
+    telldus.getDevicesSync();
+    var diff = process.hrtime(start);
+    times.push(diff[0] * 1e3 + diff[1] / 1e6);
+  }
+  return median(times);
+}
+
+
+function growTo(count) {
+  while (telldus.getNumberOfDevicesSync() < count) {
+    var id = telldus.addDeviceSync();
+    if (id < 0) {
+      throw new Error('Could not add device: ' + telldus.getErrorStringSync(id));
+    }
+    telldus.setNameSync(id, 'bench ' + id);
+    telldus.setProtocolSync(id, 'arctech');
+    telldus.setModelSync(id, 'selflearning-switch');
+    added.push(id);
+  }
+}
+
+
+function pad(str, len) {
+  str = String(str);
+  while (str.length < len) {
+    str = ' ' + str;
+  }
+  return str;
+}
+
+
+var defaultThreads = telldus.setSnapshotThreads(4);
+
+try {
+  console.log(pad('devices', 8) + threadCounts.map(function (t) {
+    return pad(t + ' thr (ms)', 14);
+  }).join(''));
+
+  steps.forEach(function (count) {
+    growTo(count);
+    var row = pad(telldus.getNumberOfDevicesSync(), 8);
+    threadCounts.forEach(function (threads) {
+      row += pad(timeSnapshot(threads).toFixed(2), 14);
+    });
+    console.log(row);
+  });
+}
+finally {
+  telldus.setSnapshotThreads(defaultThreads);
+  added.forEach(function (id) {
+    telldus.removeDeviceSync(id);
+  });
+}
@@ -2,9 +2,33 @@
   "targets": [
     {
     "target_name": "telldus",
-    "sources": [ "telldus.cc" ],
+    "sources": [
+      "telldus.cc",
+      "src/airtime.cc",
+      "src/breaker.cc",
+      "src/command_queue.cc",
+      "src/dedup.cc",
+      "src/device_versions.cc",
+      "src/devices.cc",
+      "src/event_filter.cc",
+      "src/event_hub.cc",
+      "src/executor.cc",
+      "src/journal.cc",
+      "src/listeners.cc",
+      "src/metadata_cache.cc",
+      "src/pool.cc",
+      "src/provision.cc",
+      "src/raw_event.cc",
+      "src/scene.cc",
+      "src/sensor_history.cc",
+      "src/sensor_store.cc"
+    ],
+    "cflags_cc": [ "-std=c++11" ],
     "conditions": [
         ['OS=="mac"', {
+            'xcode_settings': {
+            	'OTHER_CPLUSPLUSFLAGS': [ '-std=c++11', '-stdlib=libc++' ]
+            },
             'include_dirs': [
             	'/Library/Frameworks/TelldusCore.framework/Headers'
             ],
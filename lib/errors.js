@@ -13,4 +13,14 @@ errors.TelldusError = function (options) {
 	Error.captureStackTrace(this, errors.TelldusError);
 };
 
-util.inherits(errors.TelldusError, Error);
\ No newline at end of file
+util.inherits(errors.TelldusError, Error);
+
+
+// Messages for the error codes raised by the addon itself,
+// telldus-core doesn't know about these.
+errors.messages = {
+	'-100': 'Queue is full',
+	'-101': 'Cancelled',
+	'-102': 'Timed out',
+	'-103': 'Circuit open'
+};
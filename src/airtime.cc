@@ -0,0 +1,223 @@
+#include <deque>
+#include <map>
+#include <vector>
+#include <uv.h>
+
+#include "airtime.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	const double AIRTIME_HISTOGRAM_BOUNDS[AIRTIME_HISTOGRAM_BUCKETS] = {
+		1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, -1
+	};
+
+	struct controllerState {
+		int id;
+		uv_cond_t cond;
+		bool busy;
+		double rate;
+		double burst;
+		double tokens;
+		uint64_t refilledAt;
+		uint64_t nextTicket;
+		uint64_t sent;
+		deque<uint64_t> waiting[PRIORITY_COUNT];
+	};
+
+	static uv_mutex_t airtimeMutex;
+	static vector<controllerState *> controllers;
+	static map<int, int> deviceControllers;
+	static AirtimeLaneStats laneStats[PRIORITY_COUNT];
+
+	// Must be called with airtimeMutex held
+	static controllerState *controllerById(int controllerId) {
+		for (size_t i = 0; i < controllers.size(); i++) {
+			if (controllers[i]->id == controllerId) {
+				return controllers[i];
+			}
+		}
+		controllerState *state = new controllerState();
+		state->id = controllerId;
+		uv_cond_init(&state->cond);
+		state->busy = false;
+		state->rate = 0;
+		state->burst = 1;
+		state->tokens = 1;
+		state->refilledAt = uv_hrtime();
+		state->nextTicket = 0;
+		state->sent = 0;
+		controllers.push_back(state);
+		return state;
+	}
+
+	static void refill(controllerState *state, uint64_t now) {
+		if (state->rate > 0) {
+			state->tokens += (now - state->refilledAt) / 1e9 * state->rate;
+			if (state->tokens > state->burst) {
+				state->tokens = state->burst;
+			}
+		}
+		state->refilledAt = now;
+	}
+
+	static int headPriority(controllerState *state) {
+		for (int i = 0; i < PRIORITY_COUNT; i++) {
+			if (!state->waiting[i].empty()) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	static void record(int priority, uint64_t wait) {
+		AirtimeLaneStats &stats = laneStats[priority];
+		stats.count++;
+		stats.waitTotal += wait;
+		if (wait > stats.waitMax) {
+			stats.waitMax = wait;
+		}
+		double ms = wait / 1e6;
+		int bucket = 0;
+		while (bucket < AIRTIME_HISTOGRAM_BUCKETS - 1 && ms >= AIRTIME_HISTOGRAM_BOUNDS[bucket]) {
+			bucket++;
+		}
+		stats.histogram[bucket]++;
+	}
+
+	void airtimeInit() {
+		uv_mutex_init(&airtimeMutex);
+		for (int i = 0; i < PRIORITY_COUNT; i++) {
+			laneStats[i] = AirtimeLaneStats();
+		}
+	}
+
+	bool airtimeAcquire(int deviceId, int priority, uint64_t deadline, int &controllerId) {
+		if (priority < 0 || priority >= PRIORITY_COUNT) {
+			priority = PRIORITY_INTERACTIVE;
+		}
+		uint64_t start = uv_hrtime();
+
+		uv_mutex_lock(&airtimeMutex);
+		map<int, int>::const_iterator mapped = deviceControllers.find(deviceId);
+		controllerState *state = controllerById(mapped == deviceControllers.end() ? 0 : mapped->second);
+
+		uint64_t ticket = state->nextTicket++;
+		state->waiting[priority].push_back(ticket);
+		// Someone waiting for tokens may have to make way for us
+		uv_cond_broadcast(&state->cond);
+
+		for (;;) {
+			uint64_t now = uv_hrtime();
+			refill(state, now);
+			bool first = !state->busy && headPriority(state) == priority && state->waiting[priority].front() == ticket;
+			if (first && (state->rate <= 0 || state->tokens >= 1)) {
+				break;
+			}
+			if (deadline && now >= deadline) {
+				// Out of the line, whoever is behind us may be next now
+				deque<uint64_t> &waiting = state->waiting[priority];
+				for (deque<uint64_t>::iterator it = waiting.begin(); it != waiting.end(); ++it) {
+					if (*it == ticket) {
+						waiting.erase(it);
+						break;
+					}
+				}
+				uv_cond_broadcast(&state->cond);
+				uv_mutex_unlock(&airtimeMutex);
+				return false;
+			}
+			uint64_t wait = 0; // Until someone lets us know
+			if (first) {
+				wait = (uint64_t)((1 - state->tokens) / state->rate * 1e9) + 1;
+			}
+			if (deadline && (wait == 0 || deadline - now < wait)) {
+				wait = deadline - now;
+			}
+			if (wait) {
+				uv_cond_timedwait(&state->cond, &airtimeMutex, wait);
+			} else {
+				uv_cond_wait(&state->cond, &airtimeMutex);
+			}
+		}
+
+		state->waiting[priority].pop_front();
+		state->busy = true;
+		if (state->rate > 0) {
+			state->tokens -= 1;
+		}
+		record(priority, uv_hrtime() - start);
+		controllerId = state->id;
+		uv_mutex_unlock(&airtimeMutex);
+
+		return true;
+	}
+
+	bool airtimeLimited(int deviceId) {
+		uv_mutex_lock(&airtimeMutex);
+		map<int, int>::const_iterator mapped = deviceControllers.find(deviceId);
+		controllerState *state = controllerById(mapped == deviceControllers.end() ? 0 : mapped->second);
+		bool limited = state->rate > 0;
+		uv_mutex_unlock(&airtimeMutex);
+		return limited;
+	}
+
+	void airtimeRelease(int controllerId) {
+		uv_mutex_lock(&airtimeMutex);
+		controllerState *state = controllerById(controllerId);
+		state->busy = false;
+		state->sent++;
+		uv_cond_broadcast(&state->cond);
+		uv_mutex_unlock(&airtimeMutex);
+	}
+
+	void airtimeConfigure(int controllerId, double rate, double burst) {
+		uv_mutex_lock(&airtimeMutex);
+		controllerState *state = controllerById(controllerId);
+		refill(state, uv_hrtime());
+		state->rate = rate > 0 ? rate : 0;
+		state->burst = burst >= 1 ? burst : 1;
+		if (state->tokens > state->burst) {
+			state->tokens = state->burst;
+		}
+		uv_cond_broadcast(&state->cond);
+		uv_mutex_unlock(&airtimeMutex);
+	}
+
+	void airtimeSetDeviceController(int deviceId, int controllerId) {
+		uv_mutex_lock(&airtimeMutex);
+		deviceControllers[deviceId] = controllerId;
+		uv_mutex_unlock(&airtimeMutex);
+	}
+
+	void airtimeLaneStats(int priority, AirtimeLaneStats &stats) {
+		uv_mutex_lock(&airtimeMutex);
+		stats = laneStats[priority];
+		uv_mutex_unlock(&airtimeMutex);
+	}
+
+	int airtimeControllerCount() {
+		uv_mutex_lock(&airtimeMutex);
+		int count = (int)controllers.size();
+		uv_mutex_unlock(&airtimeMutex);
+		return count;
+	}
+
+	void airtimeControllerStats(int index, AirtimeControllerStats &stats) {
+		uv_mutex_lock(&airtimeMutex);
+		controllerState *state = controllers[index];
+		refill(state, uv_hrtime());
+		stats.controllerId = state->id;
+		stats.rate = state->rate;
+		stats.burst = state->burst;
+		stats.tokens = state->tokens;
+		stats.sent = state->sent;
+		stats.waiting = 0;
+		for (int i = 0; i < PRIORITY_COUNT; i++) {
+			stats.waiting += (int)state->waiting[i].size();
+		}
+		uv_mutex_unlock(&airtimeMutex);
+	}
+
+}
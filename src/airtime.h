@@ -0,0 +1,88 @@
+#ifndef TELLDUS_V8_AIRTIME_H
+#define TELLDUS_V8_AIRTIME_H
+
+#include <stdint.h>
+
+namespace telldus_v8 {
+
+	// A 433 MHz transmitter sends one packet at a time. Every command that
+	// goes out over the air first takes the airtime slot of its controller:
+	// one command per controller at a time, optionally rate limited by a
+	// token bucket, and handed out strictly by priority so human triggered
+	// commands don't wait behind automation runs.
+
+	enum AirtimePriority {
+		PRIORITY_INTERACTIVE,
+		PRIORITY_AUTOMATION,
+		PRIORITY_BACKGROUND,
+		PRIORITY_COUNT
+	};
+
+	// Queue latency histogram buckets, upper bounds in milliseconds (last is open ended)
+	const int AIRTIME_HISTOGRAM_BUCKETS = 14;
+	extern const double AIRTIME_HISTOGRAM_BOUNDS[AIRTIME_HISTOGRAM_BUCKETS];
+
+	struct AirtimeLaneStats {
+		uint64_t count;
+		uint64_t waitTotal; // Nanoseconds
+		uint64_t waitMax;
+		uint64_t histogram[AIRTIME_HISTOGRAM_BUCKETS];
+	};
+
+	struct AirtimeControllerStats {
+		int controllerId;
+		double rate; // Packets per second, 0 means unlimited
+		double burst;
+		double tokens;
+		uint64_t sent;
+		int waiting;
+	};
+
+	void airtimeInit();
+
+	// Blocks until the device's controller is free and sets its id. With a
+	// deadline (uv_hrtime based, 0 for none) it gives up and returns false
+	// once the deadline has passed.
+	bool airtimeAcquire(int deviceId, int priority, uint64_t deadline, int &controllerId);
+	void airtimeRelease(int controllerId);
+
+	// The device's controller has a rate limit configured
+	bool airtimeLimited(int deviceId);
+
+	void airtimeConfigure(int controllerId, double rate, double burst);
+
+	// Devices not mapped explicitly use controller 0
+	void airtimeSetDeviceController(int deviceId, int controllerId);
+
+	void airtimeLaneStats(int priority, AirtimeLaneStats &stats);
+	int airtimeControllerCount();
+	void airtimeControllerStats(int index, AirtimeControllerStats &stats);
+
+	// Holds the airtime slot for the lifetime of the object. With a
+	// deadline the slot may not be taken in time, see acquired().
+	class AirtimeSlot {
+	public:
+		AirtimeSlot(int deviceId, int priority, uint64_t deadline = 0) : controllerId(0) {
+			held = airtimeAcquire(deviceId, priority, deadline, controllerId);
+		}
+		~AirtimeSlot() {
+			if (held) {
+				airtimeRelease(controllerId);
+			}
+		}
+
+		bool acquired() const {
+			return held;
+		}
+
+	private:
+		int controllerId;
+		bool held;
+
+		AirtimeSlot(const AirtimeSlot &);
+		AirtimeSlot &operator=(const AirtimeSlot &);
+	};
+
+}
+
+#endif // TELLDUS_V8_AIRTIME_H
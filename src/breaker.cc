@@ -0,0 +1,84 @@
+#include <uv.h>
+
+#include "breaker.h"
+
+namespace telldus_v8 {
+
+	static const int DEFAULT_THRESHOLD = 5;
+	static const uint64_t DEFAULT_COOLDOWN = 5000;
+	static const uint64_t NS_PER_MS = 1000000;
+
+	static uv_mutex_t breakerMutex;
+	static BreakerStats breaker;
+	static uint64_t openedAt = 0;
+	static uint64_t probeAt = 0; // When the last probe was let through
+
+	void breakerInit() {
+		uv_mutex_init(&breakerMutex);
+		BreakerStats empty = BreakerStats();
+		breaker = empty;
+		breaker.state = BREAKER_CLOSED;
+		breaker.threshold = DEFAULT_THRESHOLD;
+		breaker.cooldown = DEFAULT_COOLDOWN;
+	}
+
+	void breakerConfigure(int threshold, int cooldown) {
+		uv_mutex_lock(&breakerMutex);
+		if (threshold > 0) {
+			breaker.threshold = threshold;
+		}
+		if (cooldown > 0) {
+			breaker.cooldown = cooldown;
+		}
+		uv_mutex_unlock(&breakerMutex);
+	}
+
+	bool breakerAllow() {
+		uv_mutex_lock(&breakerMutex);
+		bool allow = true;
+		if (breaker.state != BREAKER_CLOSED) {
+			uint64_t now = uv_hrtime();
+			uint64_t cooldown = breaker.cooldown * NS_PER_MS;
+			// A probe that never reported back doesn't block the next one forever
+			uint64_t since = breaker.state == BREAKER_OPEN ? openedAt : probeAt;
+			if (now - since >= cooldown) {
+				breaker.state = BREAKER_HALF_OPEN;
+				breaker.probes++;
+				probeAt = now;
+			} else {
+				breaker.rejected++;
+				allow = false;
+			}
+		}
+		uv_mutex_unlock(&breakerMutex);
+		return allow;
+	}
+
+	void breakerSuccess() {
+		uv_mutex_lock(&breakerMutex);
+		breaker.successes++;
+		breaker.consecutiveTimeouts = 0;
+		breaker.state = BREAKER_CLOSED;
+		uv_mutex_unlock(&breakerMutex);
+	}
+
+	void breakerTimeout() {
+		uv_mutex_lock(&breakerMutex);
+		breaker.timeouts++;
+		breaker.consecutiveTimeouts++;
+		if (breaker.state == BREAKER_HALF_OPEN || (breaker.state == BREAKER_CLOSED && breaker.consecutiveTimeouts >= breaker.threshold)) {
+			breaker.state = BREAKER_OPEN;
+			breaker.trips++;
+			openedAt = uv_hrtime();
+		}
+		uv_mutex_unlock(&breakerMutex);
+	}
+
+	void breakerStats(BreakerStats &stats) {
+		uv_mutex_lock(&breakerMutex);
+		stats = breaker;
+		stats.openFor = breaker.state == BREAKER_CLOSED ? 0 : (uv_hrtime() - openedAt) / NS_PER_MS;
+		uv_mutex_unlock(&breakerMutex);
+	}
+
+}
@@ -0,0 +1,50 @@
+#ifndef TELLDUS_V8_BREAKER_H
+#define TELLDUS_V8_BREAKER_H
+
+#include <stdint.h>
+
+namespace telldus_v8 {
+
+	// Circuit breaker in front of telldusd. After a number of timeouts in
+	// a row the circuit opens and calls fail right away instead of piling
+	// up behind a daemon that isn't answering. Once the cooldown is over a
+	// single call is let through as a probe (half open): if it succeeds
+	// the circuit closes again, if it times out it stays open for another
+	// cooldown.
+
+	enum BreakerState {
+		BREAKER_CLOSED,
+		BREAKER_OPEN,
+		BREAKER_HALF_OPEN
+	};
+
+	struct BreakerStats {
+		BreakerState state;
+		int threshold;
+		uint64_t cooldown; // Milliseconds
+		int consecutiveTimeouts;
+		uint64_t timeouts;
+		uint64_t successes;
+		uint64_t rejected; // Failed fast while open
+		uint64_t trips; // Times the circuit opened
+		uint64_t probes;
+		uint64_t openFor; // Milliseconds since the circuit last opened, 0 when closed
+	};
+
+	void breakerInit();
+
+	// threshold/cooldown of 0 or less leave the current value alone
+	void breakerConfigure(int threshold, int cooldown);
+
+	// Whether a call may go to telldusd now
+	bool breakerAllow();
+
+	// Outcome of a call that was allowed
+	void breakerSuccess();
+	void breakerTimeout();
+
+	void breakerStats(BreakerStats &stats);
+
+}
+
+#endif // TELLDUS_V8_BREAKER_H
@@ -0,0 +1,181 @@
+#include <map>
+#include <vector>
+
+#include <telldus-core.h>
+
+#include "airtime.h"
+#include "breaker.h"
+#include "command_queue.h"
+#include "device_versions.h"
+#include "errors.h"
+#include "executor.h"
+#include "pool.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	struct queuedCommand {
+		int method;
+		int level;
+		vector<void *> waiters;
+	};
+
+	struct deviceSlot {
+		bool inFlight; // A job for this device is queued or running
+		bool hasPending;
+		queuedCommand pending;
+	};
+
+	struct commandJob {
+		uv_work_t req;
+		int deviceId;
+		bool sent;
+		int result;
+		queuedCommand command;
+	};
+
+	static ObjectPool<commandJob> jobs("job"); // Loop thread only
+
+	static uv_mutex_t queueMutex;
+	static map<int, deviceSlot> slots;
+	static CommandQueueStats stats;
+	static CommandWaiterCallback resolveWaiter;
+
+	static void scheduleJob(int deviceId);
+
+	static void runJob(uv_work_t *req) {
+		commandJob *job = static_cast<commandJob *>(req->data);
+
+		// Pick up whatever is latest by now
+		uv_mutex_lock(&queueMutex);
+		deviceSlot &slot = slots[job->deviceId];
+		job->sent = slot.hasPending;
+		if (slot.hasPending) {
+			job->command.method = slot.pending.method;
+			job->command.level = slot.pending.level;
+			job->command.waiters.swap(slot.pending.waiters);
+			slot.hasPending = false;
+			stats.pendingDevices--;
+		}
+		uv_mutex_unlock(&queueMutex);
+
+		if (!job->sent) {
+			return;
+		}
+		if (!breakerAllow()) {
+			// Taken off the slot all the same, the waiters hear about it
+			job->sent = false;
+			job->result = ERROR_CIRCUIT_OPEN;
+			return;
+		}
+
+		// Queued commands come from people moving sliders and flipping switches
+		AirtimeSlot airtime(job->deviceId, PRIORITY_INTERACTIVE);
+		switch (job->command.method) {
+		case TELLSTICK_TURNON:
+			job->result = tdTurnOn(job->deviceId);
+			break;
+		case TELLSTICK_TURNOFF:
+			job->result = tdTurnOff(job->deviceId);
+			break;
+		default:
+			job->result = tdDim(job->deviceId, (unsigned char)job->command.level);
+			break;
+		}
+		breakerSuccess();
+		if (job->result == TELLSTICK_SUCCESS) {
+			// Like RunCommand, don't wait for telldusd to report it back
+			deviceVersionTouch(job->deviceId);
+		}
+	}
+
+	static void afterJob(uv_work_t *req, int status) {
+		commandJob *job = static_cast<commandJob *>(req->data);
+
+		bool again = false;
+		uv_mutex_lock(&queueMutex);
+		if (status != 0) {
+			// Never ran, the pending command has to be failed as well
+			deviceSlot &slot = slots[job->deviceId];
+			if (slot.hasPending) {
+				job->command.waiters.swap(slot.pending.waiters);
+				slot.hasPending = false;
+				stats.pendingDevices--;
+			}
+			stats.dropped += job->command.waiters.size();
+			job->result = ErrorForStatus(status);
+		}
+		if (job->sent) {
+			stats.sent++;
+		}
+		map<int, deviceSlot>::iterator it = slots.find(job->deviceId);
+		if (it->second.hasPending) {
+			again = true;
+		} else {
+			slots.erase(it);
+		}
+		uv_mutex_unlock(&queueMutex);
+
+		for (size_t i = 0; i < job->command.waiters.size(); i++) {
+			resolveWaiter(job->command.waiters[i], job->result);
+		}
+
+		if (again) {
+			scheduleJob(job->deviceId);
+		}
+		jobs.destroy(job);
+	}
+
+	static void scheduleJob(int deviceId) {
+		commandJob *job = jobs.create();
+		job->req.data = job;
+		job->deviceId = deviceId;
+		job->sent = false;
+		job->result = TELLSTICK_SUCCESS;
+		executorQueueWork(LANE_COMMAND, &job->req, runJob, afterJob);
+	}
+
+	void commandQueueInit(CommandWaiterCallback resolve) {
+		uv_mutex_init(&queueMutex);
+		stats = CommandQueueStats();
+		resolveWaiter = resolve;
+	}
+
+	void commandQueueSubmit(int deviceId, int method, int level, void *waiter) {
+		bool schedule = false;
+
+		uv_mutex_lock(&queueMutex);
+		stats.submitted++;
+		deviceSlot &slot = slots[deviceId]; // Value initialized, so both flags start out false
+
+		// The latest intent always wins, even an off after an on. Dropping
+		// both would leave the device in whatever state it was in before.
+		if (slot.hasPending) {
+			stats.coalesced++;
+		} else {
+			slot.hasPending = true;
+			stats.pendingDevices++;
+		}
+		slot.pending.method = method;
+		slot.pending.level = level;
+		slot.pending.waiters.push_back(waiter);
+
+		if (!slot.inFlight) {
+			slot.inFlight = true;
+			schedule = true;
+		}
+		uv_mutex_unlock(&queueMutex);
+
+		if (schedule) {
+			scheduleJob(deviceId);
+		}
+	}
+
+	void commandQueueStats(CommandQueueStats &out) {
+		uv_mutex_lock(&queueMutex);
+		out = stats;
+		uv_mutex_unlock(&queueMutex);
+	}
+
+}
@@ -0,0 +1,35 @@
+#ifndef TELLDUS_V8_COMMAND_QUEUE_H
+#define TELLDUS_V8_COMMAND_QUEUE_H
+
+#include <stdint.h>
+
+namespace telldus_v8 {
+
+	// Per device queue of on/off/dim intents where only the latest one is
+	// sent. While a command for a device waits for the executor or is on
+	// its way out, newer commands for the same device replace the pending
+	// one. Waiters of replaced commands get the result of the command that
+	// was sent in their place.
+	//
+	// Waiters are opaque to the queue and always resolved on the loop thread.
+
+	typedef void (*CommandWaiterCallback)(void *waiter, int result);
+
+	struct CommandQueueStats {
+		uint64_t submitted;
+		uint64_t sent;
+		uint64_t coalesced; // Replaced by a newer command before being sent
+		uint64_t dropped; // Waiters failed because the executor rejected the job
+		int pendingDevices;
+	};
+
+	void commandQueueInit(CommandWaiterCallback resolve);
+
+	// method is TELLSTICK_TURNON, TELLSTICK_TURNOFF or TELLSTICK_DIM. Loop thread only.
+	void commandQueueSubmit(int deviceId, int method, int level, void *waiter);
+
+	void commandQueueStats(CommandQueueStats &stats);
+
+}
+
+#endif // TELLDUS_V8_COMMAND_QUEUE_H
@@ -0,0 +1,77 @@
+#include <uv.h>
+
+#include "dedup.h"
+
+namespace telldus_v8 {
+
+	static const size_t TABLE_SIZE = 1024; // Power of two
+
+	struct dedupEntry {
+		uint64_t hash;
+		uint64_t seenAt; // uv_hrtime of the first copy
+	};
+
+	struct dedupTable {
+		uv_mutex_t mutex;
+		uint64_t window; // Nanoseconds, 0 is off
+		dedupEntry entries[TABLE_SIZE];
+	};
+
+	static dedupTable tables[EVENT_STREAM_COUNT];
+
+	void dedupInit() {
+		for (int i = 0; i < EVENT_STREAM_COUNT; i++) {
+			uv_mutex_init(&tables[i].mutex);
+			tables[i].window = 0;
+		}
+	}
+
+	void dedupConfigure(EventStream stream, unsigned int window) {
+		dedupTable &table = tables[stream];
+		uv_mutex_lock(&table.mutex);
+		table.window = (uint64_t)window * 1000 * 1000;
+		for (size_t i = 0; i < TABLE_SIZE; i++) {
+			table.entries[i].hash = 0;
+			table.entries[i].seenAt = 0;
+		}
+		uv_mutex_unlock(&table.mutex);
+	}
+
+	unsigned int dedupWindow(EventStream stream) {
+		dedupTable &table = tables[stream];
+		uv_mutex_lock(&table.mutex);
+		unsigned int window = (unsigned int)(table.window / 1000 / 1000);
+		uv_mutex_unlock(&table.mutex);
+		return window;
+	}
+
+	uint64_t dedupHash(uint64_t hash, const void *data, size_t length) {
+		const unsigned char *bytes = static_cast<const unsigned char *>(data);
+		for (size_t i = 0; i < length; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	bool dedupRepeat(EventStream stream, uint64_t hash) {
+		dedupTable &table = tables[stream];
+
+		uv_mutex_lock(&table.mutex);
+		if (table.window == 0) {
+			uv_mutex_unlock(&table.mutex);
+			return false;
+		}
+		uint64_t now = uv_hrtime();
+		dedupEntry &entry = table.entries[hash & (TABLE_SIZE - 1)];
+		// Measured from the first copy, so a held button still comes through once per window
+		bool repeat = entry.hash == hash && now - entry.seenAt < table.window;
+		if (!repeat) {
+			entry.hash = hash;
+			entry.seenAt = now;
+		}
+		uv_mutex_unlock(&table.mutex);
+		return repeat;
+	}
+
+}
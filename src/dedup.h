@@ -0,0 +1,35 @@
+#ifndef TELLDUS_V8_DEDUP_H
+#define TELLDUS_V8_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "event_hub.h"
+
+namespace telldus_v8 {
+
+	// 433 MHz transmitters send every packet several times, telldusd hands
+	// each copy over as a separate event. With a window set for a stream,
+	// an event whose payload hash was already seen within the window is
+	// suppressed before it is fanned out to listeners.
+	//
+	// Hashes live in a small direct mapped table per stream, a collision
+	// simply evicts the older entry (at worst letting a repeat through).
+
+	const uint64_t DEDUP_HASH_SEED = 14695981039346656037ULL;
+
+	void dedupInit();
+
+	// Window in milliseconds, 0 (the default) turns de-duplication off
+	void dedupConfigure(EventStream stream, unsigned int window);
+	unsigned int dedupWindow(EventStream stream);
+
+	// FNV-1a, chain calls to hash several fields
+	uint64_t dedupHash(uint64_t hash, const void *data, size_t length);
+
+	// True if the event is a repeat and should be dropped
+	bool dedupRepeat(EventStream stream, uint64_t hash);
+
+}
+
+#endif // TELLDUS_V8_DEDUP_H
@@ -0,0 +1,76 @@
+#include <map>
+#include <uv.h>
+
+#include <telldus-core.h>
+
+#include "device_versions.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	struct deviceVersion {
+		uint64_t version;
+		bool removed;
+	};
+
+	static uv_mutex_t versionMutex;
+	static map<int, deviceVersion> devices;
+	static uint64_t version = 0;
+	static uint64_t resetVersion = 0; // Versions up to this one can't be answered incrementally
+
+	static void setVersion(int deviceId, bool removed) {
+		uv_mutex_lock(&versionMutex);
+		deviceVersion &entry = devices[deviceId];
+		entry.version = ++version;
+		entry.removed = removed;
+		uv_mutex_unlock(&versionMutex);
+	}
+
+	void deviceVersionsInit() {
+		uv_mutex_init(&versionMutex);
+	}
+
+	void deviceVersionsAttach() {
+		// We don't know what changed while we weren't listening
+		uv_mutex_lock(&versionMutex);
+		devices.clear();
+		resetVersion = ++version;
+		uv_mutex_unlock(&versionMutex);
+	}
+
+	uint64_t deviceVersionCurrent() {
+		uv_mutex_lock(&versionMutex);
+		uint64_t current = version;
+		uv_mutex_unlock(&versionMutex);
+		return current;
+	}
+
+	void deviceVersionTouch(int deviceId) {
+		setVersion(deviceId, false);
+	}
+
+	void deviceVersionRemove(int deviceId) {
+		setVersion(deviceId, true);
+	}
+
+	void deviceVersionChanged(int deviceId, int changeEvent) {
+		setVersion(deviceId, changeEvent == TELLSTICK_DEVICE_REMOVED);
+	}
+
+	uint64_t deviceVersionsSince(uint64_t since, vector<int> &changed, vector<int> &removed, bool &full) {
+		uv_mutex_lock(&versionMutex);
+		uint64_t current = version;
+		full = since < resetVersion || since > current;
+		if (!full) {
+			for (map<int, deviceVersion>::const_iterator it = devices.begin(); it != devices.end(); ++it) {
+				if (it->second.version > since) {
+					(it->second.removed ? removed : changed).push_back(it->first);
+				}
+			}
+		}
+		uv_mutex_unlock(&versionMutex);
+		return current;
+	}
+
+}
@@ -0,0 +1,41 @@
+#ifndef TELLDUS_V8_DEVICE_VERSIONS_H
+#define TELLDUS_V8_DEVICE_VERSIONS_H
+
+#include <stdint.h>
+#include <vector>
+
+namespace telldus_v8 {
+
+	// A version number for the state of all devices, bumped whenever a
+	// device changes: commands we sent, device events (something else
+	// switched it) and device change events (added, removed, renamed,
+	// reconfigured). Each device remembers the version it last changed at,
+	// so a client holding version v can be told exactly what happened
+	// since.
+	//
+	// Versions only mean something within one process and while we are
+	// attached. Anything older than the last attach, or newer than the
+	// current version, asks for a full snapshot instead.
+
+	void deviceVersionsInit();
+
+	// Call once device events are coming in (after tdInit), anything
+	// older can't be answered incrementally from then on
+	void deviceVersionsAttach();
+
+	uint64_t deviceVersionCurrent();
+
+	// Device events and our own commands touch, any thread
+	void deviceVersionTouch(int deviceId);
+	void deviceVersionRemove(int deviceId);
+	// Device change event, removes the device for TELLSTICK_DEVICE_REMOVED
+	void deviceVersionChanged(int deviceId, int changeEvent);
+
+	// Ids of the devices changed and removed after since, returns the
+	// current version. full is set instead if since is not one we can
+	// answer, the caller then needs all devices.
+	uint64_t deviceVersionsSince(uint64_t since, std::vector<int> &changed, std::vector<int> &removed, bool &full);
+
+}
+
+#endif // TELLDUS_V8_DEVICE_VERSIONS_H
@@ -0,0 +1,160 @@
+#include <cstdlib>
+#include <uv.h>
+
+#include "devices.h"
+#include "metadata_cache.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	// Don't bother starting a thread for less than this many devices
+	static const int MIN_DEVICES_PER_THREAD = 8;
+	static const int MAX_SNAPSHOT_THREADS = 32;
+
+	static int snapshotThreads = 4;
+
+	struct snapshotChunk {
+		uv_thread_t thread;
+		vector<telldusDeviceInternals> *devices;
+		int first;
+		int last;
+	};
+
+	static string takeString(char *str) {
+		string copy(str ? str : "");
+		tdReleaseString(str);
+		return copy;
+	}
+
+	void getDeviceRaw(int idx, telldusDeviceInternals &deviceInternals) {
+
+		deviceInternals.id = tdGetDeviceId(idx);
+		deviceInternals.level = 0;
+
+		if (deviceInternals.id < 0) {
+			return;
+		}
+
+		getDeviceById(deviceInternals.id, deviceInternals);
+	}
+
+	void getDeviceById(int id, telldusDeviceInternals &deviceInternals) {
+
+		deviceInternals.id = id;
+		deviceInternals.level = 0;
+
+		// Metadata rarely changes, take what we can from the cache
+		unsigned int generation = metadataGeneration();
+		if (!metadataLookup(deviceInternals.id, METADATA_NAME, deviceInternals.name)) {
+			deviceInternals.name = takeString(tdGetName(deviceInternals.id));
+			metadataStore(deviceInternals.id, METADATA_NAME, deviceInternals.name.c_str(), generation);
+		}
+		if (!metadataLookup(deviceInternals.id, METADATA_MODEL, deviceInternals.model)) {
+			deviceInternals.model = takeString(tdGetModel(deviceInternals.id));
+			metadataStore(deviceInternals.id, METADATA_MODEL, deviceInternals.model.c_str(), generation);
+		}
+		if (!metadataLookup(deviceInternals.id, METADATA_PROTOCOL, deviceInternals.protocol)) {
+			deviceInternals.protocol = takeString(tdGetProtocol(deviceInternals.id));
+			metadataStore(deviceInternals.id, METADATA_PROTOCOL, deviceInternals.protocol.c_str(), generation);
+		}
+		if (!metadataLookupType(deviceInternals.id, deviceInternals.deviceType)) {
+			deviceInternals.deviceType = tdGetDeviceType(deviceInternals.id);
+			metadataStoreType(deviceInternals.id, deviceInternals.deviceType, generation);
+		}
+
+		deviceInternals.supportedMethods = tdMethods(deviceInternals.id, SUPPORTED_METHODS);
+		deviceInternals.lastSentCommand = tdLastSentCommand(deviceInternals.id, SUPPORTED_METHODS);
+
+		if (deviceInternals.lastSentCommand == TELLSTICK_DIM) {
+
+			char * levelStr = tdLastSentValue(deviceInternals.id);
+
+			// Convert to number and add to object
+			deviceInternals.level = atoi(levelStr);
+
+			// Clean up the mess
+			tdReleaseString(levelStr);
+
+		}
+
+	}
+
+	static void runSnapshotChunk(void *arg) {
+		snapshotChunk *chunk = static_cast<snapshotChunk *>(arg);
+		for (int i = chunk->first; i < chunk->last; i++) {
+			getDeviceRaw(i, (*chunk->devices)[i]);
+		}
+	}
+
+	void getDevicesRaw(vector<telldusDeviceInternals> &devices) {
+
+		int intNumberOfDevices = tdGetNumberOfDevices();
+		if (intNumberOfDevices <= 0) {
+			devices.clear();
+			return;
+		}
+
+		// Every worker writes to its own slice, so no locking is needed
+		devices.resize(intNumberOfDevices);
+
+		int threads = (intNumberOfDevices + MIN_DEVICES_PER_THREAD - 1) / MIN_DEVICES_PER_THREAD;
+		if (threads > snapshotThreads) {
+			threads = snapshotThreads;
+		}
+
+		vector<snapshotChunk> chunks(threads);
+		for (int t = 0; t < threads; t++) {
+			chunks[t].devices = &devices;
+			chunks[t].first = (int)((long)intNumberOfDevices * t / threads);
+			chunks[t].last = (int)((long)intNumberOfDevices * (t + 1) / threads);
+		}
+
+		// The calling thread takes the first chunk itself
+		int started = 1;
+		for (; started < threads; started++) {
+			if (uv_thread_create(&chunks[started].thread, runSnapshotChunk, &chunks[started]) != 0) {
+				break;
+			}
+		}
+
+		runSnapshotChunk(&chunks[0]);
+
+		// Anything we failed to hand off is run here as well
+		for (int t = started; t < threads; t++) {
+			runSnapshotChunk(&chunks[t]);
+		}
+		for (int t = 1; t < started; t++) {
+			uv_thread_join(&chunks[t].thread);
+		}
+
+		// Drop devices that were removed while we were reading
+		size_t kept = 0;
+		for (size_t i = 0; i < devices.size(); i++) {
+			if (devices[i].id < 0) {
+				continue;
+			}
+			if (kept != i) {
+				devices[kept] = devices[i];
+			}
+			kept++;
+		}
+		devices.resize(kept);
+
+	}
+
+	void setSnapshotThreads(int threads) {
+		if (threads < 1) {
+			threads = 1;
+		}
+		if (threads > MAX_SNAPSHOT_THREADS) {
+			threads = MAX_SNAPSHOT_THREADS;
+		}
+		snapshotThreads = threads;
+	}
+
+	int getSnapshotThreads() {
+		return snapshotThreads;
+	}
+
+}
@@ -0,0 +1,52 @@
+#ifndef TELLDUS_V8_DEVICES_H
+#define TELLDUS_V8_DEVICES_H
+
+#include <string>
+#include <vector>
+
+#include <telldus-core.h>
+
+namespace telldus_v8 {
+
+	const int SUPPORTED_METHODS =
+		TELLSTICK_TURNON
+		| TELLSTICK_TURNOFF
+		| TELLSTICK_BELL
+		| TELLSTICK_TOGGLE
+		| TELLSTICK_DIM
+		| TELLSTICK_LEARN
+		| TELLSTICK_EXECUTE
+		| TELLSTICK_UP
+		| TELLSTICK_DOWN
+		| TELLSTICK_STOP;
+
+	struct telldusDeviceInternals {
+		int supportedMethods;
+		int deviceType;
+		int lastSentCommand;
+		int level;
+		int id;
+		std::string name;
+		std::string model;
+		std::string protocol;
+	};
+
+	// Query everything we know about the device at index idx.
+	// id is set to -1 if the index is no longer valid.
+	void getDeviceRaw(int idx, telldusDeviceInternals &deviceInternals);
+
+	// The same for the device with the given id
+	void getDeviceById(int id, telldusDeviceInternals &deviceInternals);
+
+	// Take a snapshot of all configured devices. The per device queries
+	// are split over a number of worker threads, results end up in
+	// index order in devices.
+	void getDevicesRaw(std::vector<telldusDeviceInternals> &devices);
+
+	// Upper bound of threads used by getDevicesRaw, 1 disables the threading.
+	void setSnapshotThreads(int threads);
+	int getSnapshotThreads();
+
+}
+
+#endif // TELLDUS_V8_DEVICES_H
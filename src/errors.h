@@ -0,0 +1,34 @@
+#ifndef TELLDUS_V8_ERRORS_H
+#define TELLDUS_V8_ERRORS_H
+
+#include <uv.h>
+
+namespace telldus_v8 {
+
+	// Errors raised by the addon itself, kept clear of telldus-core's
+	// TELLSTICK_ERROR_* range. Mirrored in telldus.js (enums.status).
+	const int ERROR_QUEUE_FULL = -100;
+	const int ERROR_CANCELLED = -101;
+	const int ERROR_TIMEOUT = -102; // Deadline passed before telldusd answered
+	const int ERROR_CIRCUIT_OPEN = -103; // Failed fast, telldusd is not answering
+
+	// Executor status for calls the circuit breaker turned away
+	const int STATUS_CIRCUIT_OPEN = UV_ECONNREFUSED;
+
+	// Error code handed to JS for work the executor did not run
+	inline int ErrorForStatus(int status) {
+		switch (status) {
+		case UV_ETIMEDOUT:
+			return ERROR_TIMEOUT;
+		case UV_ECANCELED:
+			return ERROR_CANCELLED;
+		case STATUS_CIRCUIT_OPEN:
+			return ERROR_CIRCUIT_OPEN;
+		default:
+			return ERROR_QUEUE_FULL;
+		}
+	}
+
+}
+
+#endif // TELLDUS_V8_ERRORS_H
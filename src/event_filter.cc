@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <telldus-core.h>
+
+#include "event_filter.h"
+#include "raw_event.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	static bool contains(const vector<int> &sorted, int value) {
+		return sorted.empty() || binary_search(sorted.begin(), sorted.end(), value);
+	}
+
+	static bool matchesAny(const vector<string> &values, const char *value, size_t length) {
+		if (values.empty()) {
+			return true;
+		}
+		for (size_t i = 0; i < values.size(); i++) {
+			if (values[i].size() == length && memcmp(values[i].data(), value, length) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void eventFilterPrepare(EventFilter &filter) {
+		sort(filter.deviceIds.begin(), filter.deviceIds.end());
+		sort(filter.methods.begin(), filter.methods.end());
+		uv_mutex_init(&filter.mutex);
+	}
+
+	void eventFilterFree(EventFilter *filter) {
+		if (filter) {
+			uv_mutex_destroy(&filter->mutex);
+			delete filter;
+		}
+	}
+
+	bool eventFilterDevice(EventFilter &filter, int deviceId, int method, int level) {
+		if (!contains(filter.deviceIds, deviceId) || !contains(filter.methods, method)) {
+			return false;
+		}
+		if (filter.deadband <= 0) {
+			return true;
+		}
+
+		uv_mutex_lock(&filter.mutex);
+		map<int, pair<int, int> >::iterator it = filter.lastDevice.find(deviceId);
+		bool pass = it == filter.lastDevice.end() || it->second.first != method
+			|| (method == TELLSTICK_DIM && fabs((double)level - it->second.second) > filter.deadband);
+		if (pass) {
+			filter.lastDevice[deviceId] = make_pair(method, level);
+		}
+		uv_mutex_unlock(&filter.mutex);
+		return pass;
+	}
+
+	bool eventFilterSensor(EventFilter &filter, const char *protocol, const char *model, int sensorId, int dataType, const char *value) {
+		if (!filter.sensors.empty()) {
+			bool matched = false;
+			for (size_t i = 0; i < filter.sensors.size() && !matched; i++) {
+				const SensorMatch &match = filter.sensors[i];
+				matched = (match.sensorId < 0 || match.sensorId == sensorId)
+					&& (match.dataType == 0 || match.dataType == dataType)
+					&& (match.protocol.empty() || match.protocol == protocol)
+					&& (match.model.empty() || match.model == model);
+			}
+			if (!matched) {
+				return false;
+			}
+		}
+		if (filter.deadband <= 0) {
+			return true;
+		}
+
+		char *end;
+		double number = strtod(value, &end);
+		if (end == value) {
+			return true; // Not a number, no deadband to apply
+		}
+
+		string key(protocol);
+		key.push_back('\0');
+		key.append(model);
+		key.push_back('\0');
+		key.append(reinterpret_cast<const char *>(&sensorId), sizeof(sensorId));
+		key.append(reinterpret_cast<const char *>(&dataType), sizeof(dataType));
+
+		uv_mutex_lock(&filter.mutex);
+		map<string, double>::iterator it = filter.lastSensor.find(key);
+		bool pass = it == filter.lastSensor.end() || fabs(number - it->second) > filter.deadband;
+		if (pass) {
+			filter.lastSensor[key] = number;
+		}
+		uv_mutex_unlock(&filter.mutex);
+		return pass;
+	}
+
+	bool eventFilterRaw(EventFilter &filter, const char *data, const RawEventField *fields, int count) {
+		if (filter.rawClasses.empty() && filter.rawProtocols.empty() && filter.rawModels.empty()) {
+			return true;
+		}
+
+		// Criteria for keys missing from the event never match
+		bool classOk = filter.rawClasses.empty();
+		bool protocolOk = filter.rawProtocols.empty();
+		bool modelOk = filter.rawModels.empty();
+		for (int i = 0; i < count; i++) {
+			const RawEventField &field = fields[i];
+			const char *value = data + field.valueOffset;
+			switch (field.key) {
+			case RAW_KEY_CLASS:
+				classOk = matchesAny(filter.rawClasses, value, field.valueLength);
+				break;
+			case RAW_KEY_PROTOCOL:
+				protocolOk = matchesAny(filter.rawProtocols, value, field.valueLength);
+				break;
+			case RAW_KEY_MODEL:
+				modelOk = matchesAny(filter.rawModels, value, field.valueLength);
+				break;
+			}
+		}
+		return classOk && protocolOk && modelOk;
+	}
+
+}
@@ -0,0 +1,55 @@
+#ifndef TELLDUS_V8_EVENT_FILTER_H
+#define TELLDUS_V8_EVENT_FILTER_H
+
+#include <map>
+#include <string>
+#include <uv.h>
+#include <vector>
+
+#include "raw_event.h"
+
+namespace telldus_v8 {
+
+	// Per listener filter, evaluated on the telldus callback thread before
+	// an event is queued for the loop. Empty criteria match everything.
+	//
+	// With a deadband, an event only passes if its value moved more than
+	// the deadband away from the last value that passed for the same
+	// device or sensor reading (or, for devices, if the method changed).
+
+	struct SensorMatch {
+		std::string protocol; // Empty matches any
+		std::string model; // Empty matches any
+		int sensorId; // -1 matches any
+		int dataType; // 0 matches any
+	};
+
+	struct EventFilter {
+		std::vector<int> deviceIds; // Sorted
+		std::vector<int> methods; // Sorted
+		std::vector<SensorMatch> sensors;
+		std::vector<std::string> rawClasses;
+		std::vector<std::string> rawProtocols;
+		std::vector<std::string> rawModels;
+		double deadband; // 0 turns it off
+
+		// Last values that passed, for the deadband
+		uv_mutex_t mutex;
+		std::map<int, std::pair<int, int> > lastDevice; // Device id -> (method, level)
+		std::map<std::string, double> lastSensor;
+	};
+
+	// Call once the criteria are filled in (sorts them and sets up the deadband state)
+	void eventFilterPrepare(EventFilter &filter);
+
+	// Frees a prepared filter, null is fine
+	void eventFilterFree(EventFilter *filter);
+
+	bool eventFilterDevice(EventFilter &filter, int deviceId, int method, int level);
+	bool eventFilterSensor(EventFilter &filter, const char *protocol, const char *model, int sensorId, int dataType, const char *value);
+	// fields as parsed from data by parseRawEvent
+	bool eventFilterRaw(EventFilter &filter, const char *data, const RawEventField *fields, int count);
+
+}
+
+#endif // TELLDUS_V8_EVENT_FILTER_H
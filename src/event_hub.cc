@@ -0,0 +1,374 @@
+#include "dedup.h"
+#include "event_hub.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	// Upper bound of events handed to JS per stream and loop iteration,
+	// anything left is picked up on the next one.
+	static const size_t MAX_BATCH = 256;
+
+	// Open addressed key table of the OVERFLOW_LATEST side table, kept at
+	// most half full
+	static const size_t OVERFLOW_SLOTS = EVENT_QUEUE_CAPACITY * 2;
+
+	struct overflowSlot {
+		uint64_t key;
+		uint64_t generation; // Slot is in use if it matches the queue's
+		size_t index; // Position in overflow
+	};
+
+	struct streamCounters {
+		atomic<uint64_t> delivered;
+		atomic<uint64_t> dropped;
+		atomic<uint64_t> coalesced;
+		atomic<uint64_t> filtered;
+		atomic<uint64_t> suppressed;
+		atomic<uint64_t> batches;
+		atomic<size_t> highWater;
+	};
+
+	template <typename T>
+	struct streamQueue {
+		streamQueue() : ring(EVENT_QUEUE_CAPACITY) {}
+
+		EventRing<T> ring;
+		T *batch;
+		atomic<size_t> limit;
+		atomic<int> policy;
+
+		// OVERFLOW_LATEST: events that arrived while the ring was at its
+		// limit, one per key. Everything goes here until it is delivered, so
+		// events are never handed over out of order. Ring and side table
+		// together hold at most limit events. All of it is allocated up
+		// front, the callback thread only copies.
+		uv_mutex_t overflowMutex;
+		T *overflow;
+		T *overflowDrain; // Loop thread, what is being delivered
+		overflowSlot *overflowSlots;
+		uint64_t overflowGeneration; // Bumped to empty overflowSlots
+		atomic<bool> overflowing;
+		atomic<size_t> overflowSize;
+	};
+
+	static uv_async_t drainHandle;
+	static bool initialized = false;
+
+	static streamQueue<DeviceEventBaton> *deviceQueue;
+	static streamQueue<SensorEventBaton> *sensorQueue;
+	static streamQueue<RawDeviceEventBaton> *rawQueue;
+
+	static DeviceEventDispatcher deviceDispatcher;
+	static SensorEventDispatcher sensorDispatcher;
+	static RawDeviceEventDispatcher rawDispatcher;
+
+	static streamCounters counters[EVENT_STREAM_COUNT];
+
+	// Keys for OVERFLOW_LATEST, what makes two events "the same thing"
+	// The chunk of listeners is part of every key, so the batons of one event
+	// never replace each other
+	static uint64_t eventKey(const DeviceEventBaton &event) {
+		uint64_t hash = dedupHash(DEDUP_HASH_SEED, &event.listeners.part, sizeof(event.listeners.part));
+		return dedupHash(hash, &event.deviceId, sizeof(event.deviceId));
+	}
+
+	static uint64_t eventKey(const SensorEventBaton &event) {
+		uint64_t hash = dedupHash(DEDUP_HASH_SEED, &event.listeners.part, sizeof(event.listeners.part));
+		hash = dedupHash(hash, event.protocol, strlen(event.protocol) + 1);
+		hash = dedupHash(hash, event.model, strlen(event.model) + 1);
+		hash = dedupHash(hash, &event.sensorId, sizeof(event.sensorId));
+		return dedupHash(hash, &event.dataType, sizeof(event.dataType));
+	}
+
+	// The fields naming the transmitter, leaving out what it sent
+	static uint64_t eventKey(const RawDeviceEventBaton &event) {
+		uint64_t hash = dedupHash(DEDUP_HASH_SEED, &event.listeners.part, sizeof(event.listeners.part));
+		hash = dedupHash(hash, &event.controllerId, sizeof(event.controllerId));
+		bool named = false;
+		for (int i = 0; i < event.fieldCount; i++) {
+			const RawEventField &field = event.fields[i];
+			switch (field.key) {
+			case RAW_KEY_CLASS:
+			case RAW_KEY_PROTOCOL:
+			case RAW_KEY_MODEL:
+			case RAW_KEY_HOUSE:
+			case RAW_KEY_UNIT:
+			case RAW_KEY_GROUP:
+			case RAW_KEY_ID:
+				hash = dedupHash(hash, &field.key, sizeof(field.key));
+				hash = dedupHash(hash, event.data + field.valueOffset, field.valueLength);
+				named = true;
+				break;
+			}
+		}
+		if (!named) {
+			hash = dedupHash(hash, event.data, strlen(event.data));
+		}
+		return hash;
+	}
+
+	static void noteDepth(EventStream stream, size_t depth) {
+		size_t seen = counters[stream].highWater.load(memory_order_relaxed);
+		while (depth > seen && !counters[stream].highWater.compare_exchange_weak(seen, depth, memory_order_relaxed)) {
+		}
+	}
+
+	template <typename T, typename D>
+	static void dispatch(T *events, size_t count, D dispatcher, EventStream stream) {
+		counters[stream].delivered += count;
+		counters[stream].batches++;
+		dispatcher(events, count);
+	}
+
+	template <typename T, typename D>
+	static bool drainStream(streamQueue<T> *queue, D dispatcher, EventStream stream) {
+		size_t count = 0;
+		while (count < MAX_BATCH && queue->ring.pop(queue->batch[count])) {
+			count++;
+		}
+		if (count > 0) {
+			dispatch(queue->batch, count, dispatcher, stream);
+		}
+		if (count == MAX_BATCH) {
+			return true;
+		}
+
+		// The ring is empty, the side table holds the newest events
+		if (queue->overflowing.load(memory_order_acquire)) {
+			uv_mutex_lock(&queue->overflowMutex);
+			size_t latest = queue->overflowSize;
+			for (size_t i = 0; i < latest; i++) {
+				queue->overflowDrain[i] = queue->overflow[i];
+			}
+			queue->overflowGeneration++;
+			queue->overflowSize = 0;
+			queue->overflowing.store(false, memory_order_release);
+			uv_mutex_unlock(&queue->overflowMutex);
+			if (latest > 0) {
+				dispatch(queue->overflowDrain, latest, dispatcher, stream);
+			}
+		}
+		return false;
+	}
+
+	static void drain(uv_async_t *handle) {
+		bool more = false;
+		more |= drainStream(deviceQueue, deviceDispatcher, EVENT_STREAM_DEVICE);
+		more |= drainStream(sensorQueue, sensorDispatcher, EVENT_STREAM_SENSOR);
+		more |= drainStream(rawQueue, rawDispatcher, EVENT_STREAM_RAW);
+		if (more) {
+			// Let the rest of the loop run before we continue
+			uv_async_send(&drainHandle);
+		}
+	}
+
+	template <typename T>
+	static streamQueue<T> *newQueue() {
+		streamQueue<T> *queue = new streamQueue<T>();
+		queue->batch = new T[MAX_BATCH];
+		queue->limit = EVENT_QUEUE_CAPACITY;
+		queue->policy = OVERFLOW_DROP_NEWEST;
+		uv_mutex_init(&queue->overflowMutex);
+		queue->overflow = new T[EVENT_QUEUE_CAPACITY];
+		queue->overflowDrain = new T[EVENT_QUEUE_CAPACITY];
+		queue->overflowSlots = new overflowSlot[OVERFLOW_SLOTS];
+		for (size_t i = 0; i < OVERFLOW_SLOTS; i++) {
+			queue->overflowSlots[i].generation = 0;
+		}
+		queue->overflowGeneration = 1;
+		queue->overflowing = false;
+		queue->overflowSize = 0;
+		return queue;
+	}
+
+	void eventHubInit(uv_loop_t *loop, DeviceEventDispatcher device, SensorEventDispatcher sensor, RawDeviceEventDispatcher raw) {
+		if (initialized) {
+			return;
+		}
+		deviceQueue = newQueue<DeviceEventBaton>();
+		sensorQueue = newQueue<SensorEventBaton>();
+		rawQueue = newQueue<RawDeviceEventBaton>();
+		deviceDispatcher = device;
+		sensorDispatcher = sensor;
+		rawDispatcher = raw;
+		for (int i = 0; i < EVENT_STREAM_COUNT; i++) {
+			counters[i].delivered = 0;
+			counters[i].dropped = 0;
+			counters[i].coalesced = 0;
+			counters[i].filtered = 0;
+			counters[i].suppressed = 0;
+			counters[i].batches = 0;
+			counters[i].highWater = 0;
+		}
+
+		uv_async_init(loop, &drainHandle, (uv_async_cb)drain);
+		// Pending events alone should not keep the process alive
+		uv_unref((uv_handle_t *)&drainHandle);
+		initialized = true;
+	}
+
+	template <typename T>
+	static void configure(streamQueue<T> *queue, size_t limit, OverflowPolicy policy) {
+		if (limit < 1) {
+			limit = 1;
+		}
+		if (limit > EVENT_QUEUE_CAPACITY) {
+			limit = EVENT_QUEUE_CAPACITY;
+		}
+		queue->limit = limit;
+		queue->policy = policy;
+	}
+
+	void eventHubConfigure(EventStream stream, size_t limit, OverflowPolicy policy) {
+		switch (stream) {
+		case EVENT_STREAM_DEVICE:
+			configure(deviceQueue, limit, policy);
+			break;
+		case EVENT_STREAM_SENSOR:
+			configure(sensorQueue, limit, policy);
+			break;
+		default:
+			configure(rawQueue, limit, policy);
+			break;
+		}
+	}
+
+	template <typename T>
+	static bool pushLatest(streamQueue<T> *queue, const T &event, EventStream stream) {
+		uint64_t key = eventKey(event);
+		uv_mutex_lock(&queue->overflowMutex);
+		queue->overflowing.store(true, memory_order_release);
+
+		// Linear probing, the table is never more than half full so there
+		// always is a free slot to stop at
+		size_t slot = (size_t)key & (OVERFLOW_SLOTS - 1);
+		for (;;) {
+			overflowSlot &entry = queue->overflowSlots[slot];
+			if (entry.generation != queue->overflowGeneration) {
+				break;
+			}
+			if (entry.key == key) {
+				queue->overflow[entry.index] = event;
+				uv_mutex_unlock(&queue->overflowMutex);
+				counters[stream].coalesced++;
+				uv_async_send(&drainHandle);
+				return true;
+			}
+			slot = (slot + 1) & (OVERFLOW_SLOTS - 1);
+		}
+
+		size_t size = queue->overflowSize.load(memory_order_relaxed);
+		if (size >= EVENT_QUEUE_CAPACITY) {
+			uv_mutex_unlock(&queue->overflowMutex);
+			counters[stream].dropped++;
+			return false;
+		}
+		if (queue->ring.size() + size >= queue->limit) {
+			// A new key at the limit, it takes the place of the oldest event
+			T oldest;
+			if (!queue->ring.pop(oldest)) {
+				// Nothing but latest events left
+				uv_mutex_unlock(&queue->overflowMutex);
+				counters[stream].dropped++;
+				return false;
+			}
+			counters[stream].dropped++;
+		}
+		overflowSlot &entry = queue->overflowSlots[slot];
+		entry.key = key;
+		entry.generation = queue->overflowGeneration;
+		entry.index = size;
+		queue->overflow[size] = event;
+		queue->overflowSize = size + 1;
+		uv_mutex_unlock(&queue->overflowMutex);
+
+		noteDepth(stream, queue->ring.size() + queue->overflowSize);
+		uv_async_send(&drainHandle);
+		return true;
+	}
+
+	template <typename T>
+	static bool push(streamQueue<T> *queue, const T &event, EventStream stream) {
+		int policy = queue->policy.load(memory_order_relaxed);
+		if (policy == OVERFLOW_LATEST && queue->overflowing.load(memory_order_acquire)) {
+			return pushLatest(queue, event, stream);
+		}
+
+		if (queue->ring.size() >= queue->limit) {
+			switch (policy) {
+			case OVERFLOW_LATEST:
+				return pushLatest(queue, event, stream);
+			case OVERFLOW_DROP_OLDEST: {
+				// The ring takes several consumers, making room from here is safe
+				T oldest;
+				if (queue->ring.pop(oldest)) {
+					counters[stream].dropped++;
+				}
+				break;
+			}
+			default:
+				counters[stream].dropped++;
+				return false;
+			}
+		}
+
+		if (!queue->ring.push(event)) {
+			counters[stream].dropped++;
+			return false;
+		}
+		noteDepth(stream, queue->ring.size() + queue->overflowSize);
+		uv_async_send(&drainHandle);
+		return true;
+	}
+
+	bool eventHubPush(const DeviceEventBaton &event) {
+		return push(deviceQueue, event, EVENT_STREAM_DEVICE);
+	}
+
+	bool eventHubPush(const SensorEventBaton &event) {
+		return push(sensorQueue, event, EVENT_STREAM_SENSOR);
+	}
+
+	bool eventHubPush(const RawDeviceEventBaton &event) {
+		return push(rawQueue, event, EVENT_STREAM_RAW);
+	}
+
+	void eventHubFiltered(EventStream stream, uint64_t count) {
+		counters[stream].filtered += count;
+	}
+
+	void eventHubSuppressed(EventStream stream) {
+		counters[stream].suppressed++;
+	}
+
+	template <typename T>
+	static void queueStats(streamQueue<T> *queue, EventStreamStats &stats) {
+		stats.pending = queue->ring.size() + queue->overflowSize;
+		stats.limit = queue->limit;
+		stats.capacity = queue->ring.capacity();
+		stats.policy = (OverflowPolicy)queue->policy.load();
+	}
+
+	void eventHubStats(EventStream stream, EventStreamStats &stats) {
+		stats.delivered = counters[stream].delivered;
+		stats.dropped = counters[stream].dropped;
+		stats.coalesced = counters[stream].coalesced;
+		stats.filtered = counters[stream].filtered;
+		stats.suppressed = counters[stream].suppressed;
+		stats.batches = counters[stream].batches;
+		stats.highWater = counters[stream].highWater;
+		switch (stream) {
+		case EVENT_STREAM_DEVICE:
+			queueStats(deviceQueue, stats);
+			break;
+		case EVENT_STREAM_SENSOR:
+			queueStats(sensorQueue, stats);
+			break;
+		default:
+			queueStats(rawQueue, stats);
+			break;
+		}
+	}
+
+}
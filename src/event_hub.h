@@ -0,0 +1,230 @@
+#ifndef TELLDUS_V8_EVENT_HUB_H
+#define TELLDUS_V8_EVENT_HUB_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <uv.h>
+
+#include "raw_event.h"
+
+namespace telldus_v8 {
+
+	// Events coming from telldus-core are copied into fixed size batons on
+	// the callback thread, pushed into a bounded lock-free ring per stream
+	// and drained on the loop thread by a single uv_async_t. Nothing on the
+	// producer side allocates.
+	//
+	// Each stream has a limit on queued events and a policy for what
+	// happens beyond it: drop the new event, drop the oldest queued one, or
+	// keep only the latest event per device, sensor reading or raw source
+	// in a side table that is delivered once the queue has drained.
+
+	struct EventContext;
+
+	const size_t EVENT_STRING_SIZE = 32;
+	const size_t RAW_EVENT_DATA_SIZE = 256;
+
+	// Ring size of every stream, the highest limit that can be configured
+	const size_t EVENT_QUEUE_CAPACITY = 1024;
+
+	// Listener ids carried per baton. An event matching more listeners is
+	// queued as several batons, one per chunk of listeners.
+	const int EVENT_LISTENER_CHUNK = 64;
+
+	// Ids of the listeners an event matched on the callback thread
+	struct EventListenerSet {
+		int count;
+		int part; // Which chunk of the matched listeners, 0 for the first
+		int ids[EVENT_LISTENER_CHUNK];
+	};
+
+	struct DeviceEventBaton {
+		EventListenerSet listeners;
+		int deviceId;
+		int lastSentCommand;
+		int levelNum;
+		int ts;
+	};
+
+	struct SensorEventBaton {
+		EventListenerSet listeners;
+		int sensorId;
+		int ts;
+		int dataType;
+		char model[EVENT_STRING_SIZE];
+		char protocol[EVENT_STRING_SIZE];
+		char value[EVENT_STRING_SIZE];
+	};
+
+	struct RawDeviceEventBaton {
+		EventListenerSet listeners;
+		int controllerId;
+		char data[RAW_EVENT_DATA_SIZE];
+		int fieldCount; // Always parsed, de-duplication and filters use the fields
+		RawEventField fields[RAW_EVENT_MAX_FIELDS];
+	};
+
+	enum EventStream {
+		EVENT_STREAM_DEVICE,
+		EVENT_STREAM_SENSOR,
+		EVENT_STREAM_RAW,
+		EVENT_STREAM_COUNT
+	};
+
+	// Bounded multi-producer queue, after Dmitry Vyukov's MPMC design.
+	// Capacity must be a power of two.
+	template <typename T>
+	class EventRing {
+	public:
+		explicit EventRing(size_t capacity) : mask(capacity - 1) {
+			cells = new cell[capacity];
+			for (size_t i = 0; i < capacity; i++) {
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+			enqueuePos.store(0, std::memory_order_relaxed);
+			dequeuePos.store(0, std::memory_order_relaxed);
+		}
+
+		~EventRing() {
+			delete[] cells;
+		}
+
+		bool push(const T &item) {
+			cell *c;
+			size_t pos = enqueuePos.load(std::memory_order_relaxed);
+			for (;;) {
+				c = &cells[pos & mask];
+				size_t seq = c->sequence.load(std::memory_order_acquire);
+				intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+				if (dif == 0) {
+					if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if (dif < 0) {
+					return false; // Full
+				} else {
+					pos = enqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+			c->item = item;
+			c->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool pop(T &item) {
+			cell *c;
+			size_t pos = dequeuePos.load(std::memory_order_relaxed);
+			for (;;) {
+				c = &cells[pos & mask];
+				size_t seq = c->sequence.load(std::memory_order_acquire);
+				intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+				if (dif == 0) {
+					if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if (dif < 0) {
+					return false; // Empty
+				} else {
+					pos = dequeuePos.load(std::memory_order_relaxed);
+				}
+			}
+			item = c->item;
+			c->sequence.store(pos + mask + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Approximate, only meant for statistics
+		size_t size() const {
+			size_t head = dequeuePos.load(std::memory_order_relaxed);
+			size_t tail = enqueuePos.load(std::memory_order_relaxed);
+			return tail > head ? tail - head : 0;
+		}
+
+		size_t capacity() const {
+			return mask + 1;
+		}
+
+	private:
+		struct cell {
+			std::atomic<size_t> sequence;
+			T item;
+		};
+
+		// Keep producer and consumer positions on separate cache lines
+		char pad0[64];
+		cell *cells;
+		size_t mask;
+		char pad1[64];
+		std::atomic<size_t> enqueuePos;
+		char pad2[64];
+		std::atomic<size_t> dequeuePos;
+		char pad3[64];
+
+		EventRing(const EventRing &);
+		EventRing &operator=(const EventRing &);
+	};
+
+	enum OverflowPolicy {
+		OVERFLOW_DROP_NEWEST,
+		OVERFLOW_DROP_OLDEST,
+		OVERFLOW_LATEST
+	};
+
+	struct EventStreamStats {
+		uint64_t delivered;
+		uint64_t dropped; // Lost to the overflow policy
+		uint64_t coalesced; // Replaced by a newer event for the same key (OVERFLOW_LATEST)
+		uint64_t filtered; // Listener filter rejections, counted once per listener
+		uint64_t suppressed; // RF repeats dropped by de-duplication (see dedup.h)
+		uint64_t batches;
+		size_t pending;
+		size_t highWater; // Most events ever pending at once
+		size_t limit;
+		size_t capacity;
+		OverflowPolicy policy;
+	};
+
+	// Called on the loop thread with everything drained from a stream this tick
+	typedef void (*DeviceEventDispatcher)(DeviceEventBaton *events, size_t count);
+	typedef void (*SensorEventDispatcher)(SensorEventBaton *events, size_t count);
+	typedef void (*RawDeviceEventDispatcher)(RawDeviceEventBaton *events, size_t count);
+
+	void eventHubInit(uv_loop_t *loop, DeviceEventDispatcher device, SensorEventDispatcher sensor, RawDeviceEventDispatcher raw);
+
+	// limit is clamped to 1..EVENT_QUEUE_CAPACITY. Defaults are
+	// EVENT_QUEUE_CAPACITY and OVERFLOW_DROP_NEWEST.
+	void eventHubConfigure(EventStream stream, size_t limit, OverflowPolicy policy);
+
+	// Producer side, safe to call from any thread. Returns false if the
+	// event had to be dropped because the stream is full.
+	bool eventHubPush(const DeviceEventBaton &event);
+	bool eventHubPush(const SensorEventBaton &event);
+	bool eventHubPush(const RawDeviceEventBaton &event);
+
+	// Counts listener filters that rejected an event
+	void eventHubFiltered(EventStream stream, uint64_t count);
+
+	// Counts a repeated event that de-duplication kept out of the stream
+	void eventHubSuppressed(EventStream stream);
+
+	void eventHubStats(EventStream stream, EventStreamStats &stats);
+
+	// Bounded copy that always terminates dst
+	inline void copyEventString(char *dst, size_t size, const char *src) {
+		if (!src) {
+			dst[0] = '\0';
+			return;
+		}
+		size_t len = strlen(src);
+		if (len >= size) {
+			len = size - 1;
+		}
+		memcpy(dst, src, len);
+		dst[len] = '\0';
+	}
+
+}
+
+#endif // TELLDUS_V8_EVENT_HUB_H
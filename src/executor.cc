@@ -0,0 +1,313 @@
+#include <deque>
+#include <vector>
+
+#include "executor.h"
+#include "pool.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	static const int DEFAULT_THREADS = 2;
+	static const int DEFAULT_QUEUE_LIMIT = 256;
+	static const int MAX_THREADS = 32;
+	static const uint64_t SWEEP_INTERVAL = 10; // Milliseconds between deadline checks
+
+	struct executorTask {
+		uv_work_t *req;
+		uv_work_cb work;
+		uv_after_work_cb after;
+		uv_work_cb timeout;
+		int status;
+		uint64_t queuedAt;
+		uint64_t deadline;
+		bool overran; // timeout has been called
+	};
+
+	// Created and destroyed on the loop thread only
+	static ObjectPool<executorTask> tasks("task");
+
+	struct executorLane {
+		uv_mutex_t mutex;
+		uv_cond_t cond;
+		deque<executorTask *> queue[PRIORITY_COUNT];
+		vector<executorTask *> running; // Tasks with a deadline that are being run
+		int targetThreads; // Threads above this exit when they go idle
+		int liveThreads;
+		ExecutorLaneStats stats;
+	};
+
+	static executorLane lanes[LANE_COUNT];
+
+	// Finished tasks waiting to be handed back on the loop thread
+	static uv_mutex_t doneMutex;
+	static vector<executorTask *> done;
+	static uv_async_t doneHandle;
+	static int outstanding = 0; // Only touched on the loop thread
+	static int withDeadline = 0; // Outstanding tasks that have a deadline, loop thread only
+	static uv_timer_t sweepTimer;
+	static bool initialized = false;
+
+	static void complete(executorTask *task) {
+		uv_mutex_lock(&doneMutex);
+		done.push_back(task);
+		uv_mutex_unlock(&doneMutex);
+		uv_async_send(&doneHandle);
+	}
+
+	static void laneWorker(void *arg) {
+		executorLane *lane = static_cast<executorLane *>(arg);
+
+		uv_mutex_lock(&lane->mutex);
+		for (;;) {
+			while (lane->stats.depth == 0 && lane->liveThreads <= lane->targetThreads) {
+				uv_cond_wait(&lane->cond, &lane->mutex);
+			}
+			if (lane->liveThreads > lane->targetThreads) {
+				lane->liveThreads--;
+				break;
+			}
+
+			int priority = 0;
+			while (lane->queue[priority].empty()) {
+				priority++;
+			}
+			executorTask *task = lane->queue[priority].front();
+			lane->queue[priority].pop_front();
+			lane->stats.depth--;
+
+			uint64_t started = uv_hrtime();
+			if (task->deadline && started >= task->deadline) {
+				// Too late to bother, nobody is waiting for it anymore
+				lane->stats.expired++;
+				task->status = UV_ETIMEDOUT;
+				complete(task);
+				continue;
+			}
+			uint64_t wait = started - task->queuedAt;
+			lane->stats.started++;
+			lane->stats.waitTotal += wait;
+			if (wait > lane->stats.waitMax) {
+				lane->stats.waitMax = wait;
+			}
+			if (task->deadline) {
+				lane->running.push_back(task);
+			}
+			uv_mutex_unlock(&lane->mutex);
+
+			task->work(task->req);
+			uint64_t run = uv_hrtime() - started;
+
+			uv_mutex_lock(&lane->mutex);
+			if (task->deadline) {
+				for (size_t i = 0; i < lane->running.size(); i++) {
+					if (lane->running[i] == task) {
+						lane->running.erase(lane->running.begin() + i);
+						break;
+					}
+				}
+			}
+			complete(task);
+			lane->stats.completed++;
+			lane->stats.runTotal += run;
+			if (run > lane->stats.runMax) {
+				lane->stats.runMax = run;
+			}
+		}
+		uv_mutex_unlock(&lane->mutex);
+	}
+
+	// Must be called with the lane mutex held
+	static void startThreads(executorLane *lane) {
+		while (lane->liveThreads < lane->targetThreads) {
+			// Workers are never joined, they run until the lane shrinks or the process exits
+			uv_thread_t thread;
+			if (uv_thread_create(&thread, laneWorker, lane) != 0) {
+				break;
+			}
+			lane->liveThreads++;
+		}
+	}
+
+	static void afterDone(uv_async_t *handle) {
+		vector<executorTask *> finished;
+		uv_mutex_lock(&doneMutex);
+		finished.swap(done);
+		uv_mutex_unlock(&doneMutex);
+
+		for (size_t i = 0; i < finished.size(); i++) {
+			executorTask *task = finished[i];
+			task->after(task->req, task->status);
+			if (task->deadline) {
+				withDeadline--;
+			}
+			tasks.destroy(task);
+			outstanding--;
+		}
+		if (withDeadline == 0) {
+			uv_timer_stop(&sweepTimer);
+		}
+
+		// Like the libuv pool, only keep the loop alive while there is work in flight
+		if (outstanding == 0) {
+			uv_unref((uv_handle_t *)&doneHandle);
+		}
+	}
+
+	// Drops queued tasks whose deadline has passed and reports running
+	// ones, so callers hear about it even while every thread is stuck
+	static void sweep(uv_timer_t *handle) {
+		uint64_t now = uv_hrtime();
+		vector<executorTask *> late;
+
+		for (int i = 0; i < LANE_COUNT; i++) {
+			executorLane *lane = &lanes[i];
+			uv_mutex_lock(&lane->mutex);
+			for (int p = 0; p < PRIORITY_COUNT; p++) {
+				deque<executorTask *> &queue = lane->queue[p];
+				for (deque<executorTask *>::iterator it = queue.begin(); it != queue.end();) {
+					executorTask *task = *it;
+					if (task->deadline && now >= task->deadline) {
+						it = queue.erase(it);
+						lane->stats.depth--;
+						lane->stats.expired++;
+						task->status = UV_ETIMEDOUT;
+						complete(task);
+					} else {
+						++it;
+					}
+				}
+			}
+			for (size_t r = 0; r < lane->running.size(); r++) {
+				executorTask *task = lane->running[r];
+				if (!task->overran && now >= task->deadline) {
+					task->overran = true;
+					lane->stats.overran++;
+					if (task->timeout) {
+						late.push_back(task);
+					}
+				}
+			}
+			uv_mutex_unlock(&lane->mutex);
+		}
+
+		// after only runs on this thread, these are all still alive
+		for (size_t i = 0; i < late.size(); i++) {
+			late[i]->timeout(late[i]->req);
+		}
+	}
+
+	void executorInit(uv_loop_t *loop) {
+		if (initialized) {
+			return;
+		}
+		for (int i = 0; i < LANE_COUNT; i++) {
+			executorLane *lane = &lanes[i];
+			uv_mutex_init(&lane->mutex);
+			uv_cond_init(&lane->cond);
+			lane->targetThreads = DEFAULT_THREADS;
+			lane->liveThreads = 0;
+			ExecutorLaneStats empty = ExecutorLaneStats();
+			lane->stats = empty;
+			lane->stats.queueLimit = DEFAULT_QUEUE_LIMIT;
+		}
+		uv_mutex_init(&doneMutex);
+		uv_async_init(loop, &doneHandle, (uv_async_cb)afterDone);
+		uv_unref((uv_handle_t *)&doneHandle);
+		uv_timer_init(loop, &sweepTimer);
+		uv_unref((uv_handle_t *)&sweepTimer);
+		initialized = true;
+	}
+
+	int executorQueueWork(ExecutorLane lane, uv_work_t *req, uv_work_cb work, uv_after_work_cb after, int priority, uint64_t deadline, uv_work_cb timeout) {
+		executorLane *l = &lanes[lane];
+		if (priority < 0 || priority >= PRIORITY_COUNT) {
+			priority = PRIORITY_INTERACTIVE;
+		}
+
+		executorTask *task = tasks.create();
+		task->req = req;
+		task->work = work;
+		task->after = after;
+		task->timeout = timeout;
+		task->status = 0;
+		task->queuedAt = uv_hrtime();
+		task->deadline = deadline;
+		task->overran = false;
+
+		if (outstanding++ == 0) {
+			uv_ref((uv_handle_t *)&doneHandle);
+		}
+		if (deadline && withDeadline++ == 0) {
+			uv_timer_start(&sweepTimer, sweep, SWEEP_INTERVAL, SWEEP_INTERVAL);
+		}
+
+		uv_mutex_lock(&l->mutex);
+		if (l->stats.depth >= l->stats.queueLimit) {
+			l->stats.rejected++;
+			uv_mutex_unlock(&l->mutex);
+
+			// Still completed asynchronously, callers don't need a second error path
+			task->status = UV_EBUSY;
+			complete(task);
+			return UV_EBUSY;
+		}
+
+		startThreads(l);
+		l->queue[priority].push_back(task);
+		l->stats.queued++;
+		l->stats.depth++;
+		if (l->stats.depth > l->stats.maxDepth) {
+			l->stats.maxDepth = l->stats.depth;
+		}
+		uv_cond_signal(&l->cond);
+		uv_mutex_unlock(&l->mutex);
+
+		return 0;
+	}
+
+	void executorFail(uv_work_t *req, uv_after_work_cb after, int status) {
+		executorTask *task = tasks.create();
+		task->req = req;
+		task->work = 0;
+		task->after = after;
+		task->timeout = 0;
+		task->status = status;
+		task->queuedAt = uv_hrtime();
+		task->deadline = 0;
+		task->overran = false;
+
+		if (outstanding++ == 0) {
+			uv_ref((uv_handle_t *)&doneHandle);
+		}
+		complete(task);
+	}
+
+	void executorConfigure(ExecutorLane lane, int threads, int queueLimit) {
+		executorLane *l = &lanes[lane];
+
+		uv_mutex_lock(&l->mutex);
+		if (threads > 0) {
+			l->targetThreads = threads > MAX_THREADS ? MAX_THREADS : threads;
+			// Started again on demand, surplus threads leave once idle
+			if (l->liveThreads > 0) {
+				startThreads(l);
+			}
+			uv_cond_broadcast(&l->cond);
+		}
+		if (queueLimit > 0) {
+			l->stats.queueLimit = queueLimit;
+		}
+		uv_mutex_unlock(&l->mutex);
+	}
+
+	void executorStats(ExecutorLane lane, ExecutorLaneStats &stats) {
+		executorLane *l = &lanes[lane];
+
+		uv_mutex_lock(&l->mutex);
+		stats = l->stats;
+		stats.threads = l->targetThreads;
+		uv_mutex_unlock(&l->mutex);
+	}
+
+}
@@ -0,0 +1,66 @@
+#ifndef TELLDUS_V8_EXECUTOR_H
+#define TELLDUS_V8_EXECUTOR_H
+
+#include <stdint.h>
+#include <uv.h>
+
+#include "airtime.h"
+
+namespace telldus_v8 {
+
+	// Thread pool of our own for talking to telldusd, so a slow daemon
+	// can't starve fs/dns/crypto work on the libuv pool and vice versa.
+	// Commands (turnOn, dim, ...) and queries run in separate lanes with
+	// their own threads and bounded queues.
+	//
+	// Usage mirrors uv_queue_work: work runs on a lane thread, after runs
+	// on the loop thread with status 0, or an error (UV_EBUSY when the lane
+	// was full, UV_ETIMEDOUT when the deadline passed before it started) in
+	// which case work was never run. Within a lane, queued work is picked
+	// up by priority (AirtimePriority) and then in order.
+	//
+	// Work that is still running at its deadline can't be stopped. Instead
+	// timeout is called on the loop thread as soon as the deadline passes,
+	// after still follows once the work is done.
+
+	enum ExecutorLane {
+		LANE_COMMAND,
+		LANE_QUERY,
+		LANE_COUNT
+	};
+
+	struct ExecutorLaneStats {
+		int threads;
+		int queueLimit;
+		int depth;
+		int maxDepth;
+		uint64_t queued;
+		uint64_t rejected;
+		uint64_t started; // Taken off the queue to run
+		uint64_t completed;
+		uint64_t expired; // Deadline passed while queued, never ran
+		uint64_t overran; // Deadline passed while running
+		uint64_t waitTotal; // Nanoseconds spent in the queue, summed
+		uint64_t waitMax;
+		uint64_t runTotal; // Nanoseconds spent running, summed
+		uint64_t runMax;
+	};
+
+	void executorInit(uv_loop_t *loop);
+
+	// Returns 0 if the work was queued, otherwise the status after will be called with.
+	// deadline is in uv_hrtime() nanoseconds, 0 for none.
+	int executorQueueWork(ExecutorLane lane, uv_work_t *req, uv_work_cb work, uv_after_work_cb after, int priority = PRIORITY_INTERACTIVE,
+		uint64_t deadline = 0, uv_work_cb timeout = 0);
+
+	// Calls after with status from the loop, without running anything
+	void executorFail(uv_work_t *req, uv_after_work_cb after, int status);
+
+	// threads/queueLimit of 0 or less leave the current value alone
+	void executorConfigure(ExecutorLane lane, int threads, int queueLimit);
+
+	void executorStats(ExecutorLane lane, ExecutorLaneStats &stats);
+
+}
+
+#endif // TELLDUS_V8_EXECUTOR_H
@@ -0,0 +1,513 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "journal.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	static const char SEGMENT_MAGIC[4] = { 'T', 'D', 'J', '1' };
+	static const char SEGMENT_PREFIX[] = "journal-";
+	static const char SEGMENT_SUFFIX[] = ".tdj";
+
+	// Everything is stored in host byte order, journals aren't meant to
+	// move between machines.
+	struct segmentHeader {
+		char magic[4];
+		uint32_t version;
+		uint64_t sequence;
+		uint64_t used; // Bytes in use including this header, bumped after a record is complete
+		uint64_t count;
+		int64_t firstTime;
+		int64_t lastTime;
+		uint8_t reserved[16];
+	};
+
+	struct recordHeader {
+		uint32_t size; // Including this header and padding
+		uint16_t type;
+		uint16_t reserved;
+		int64_t time;
+		int32_t id;
+		int32_t method;
+		int32_t ts;
+		uint16_t lengths[3]; // The strings follow the header back to back
+	};
+
+	static const size_t RECORD_ALIGNMENT = 8;
+
+	struct mappedFile {
+		char *data;
+		size_t size;
+#ifdef _WIN32
+		HANDLE file;
+		HANDLE mapping;
+#else
+		int fd;
+#endif
+	};
+
+#ifndef _WIN32
+	// Allocates the blocks behind a writable mapping up front. A sparse file
+	// would only find out the disk is full when a store into the mapping
+	// faults, and that is a SIGBUS.
+	static bool reserveFile(int fd, size_t size) {
+#ifdef __APPLE__
+		// No posix_fallocate, write the zeros out instead
+		static const char zeros[65536] = { 0 };
+		for (size_t offset = 0; offset < size;) {
+			size_t chunk = min(size - offset, sizeof(zeros));
+			ssize_t written = pwrite(fd, zeros, chunk, (off_t)offset);
+			if (written <= 0) {
+				return false;
+			}
+			offset += (size_t)written;
+		}
+		return true;
+#else
+		return posix_fallocate(fd, 0, (off_t)size) == 0;
+#endif
+	}
+#endif
+
+	// Maps a whole file, a writable file is created and its space reserved first
+	static bool mapFile(const string &path, bool writable, size_t size, mappedFile &file) {
+		file.data = 0;
+#ifdef _WIN32
+		file.file = CreateFileA(path.c_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0),
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file.file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		if (!writable) {
+			LARGE_INTEGER fileSize;
+			GetFileSizeEx(file.file, &fileSize);
+			size = (size_t)fileSize.QuadPart;
+		}
+		file.mapping = size ? CreateFileMappingA(file.file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY,
+			(DWORD)((uint64_t)size >> 32), (DWORD)size, NULL) : NULL;
+		if (file.mapping) {
+			file.data = static_cast<char *>(MapViewOfFile(file.mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size));
+			if (!file.data) {
+				CloseHandle(file.mapping);
+			}
+		}
+		if (!file.data) {
+			CloseHandle(file.file);
+			return false;
+		}
+#else
+		file.fd = open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+		if (file.fd < 0) {
+			return false;
+		}
+		if (writable) {
+			if (ftruncate(file.fd, (off_t)size) != 0 || !reserveFile(file.fd, size)) {
+				close(file.fd);
+				return false;
+			}
+		} else {
+			struct stat st;
+			fstat(file.fd, &st);
+			size = (size_t)st.st_size;
+		}
+		void *data = size ? mmap(0, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file.fd, 0) : MAP_FAILED;
+		if (data == MAP_FAILED) {
+			close(file.fd);
+			return false;
+		}
+		file.data = static_cast<char *>(data);
+#endif
+		file.size = size;
+		return true;
+	}
+
+	static void unmapFile(mappedFile &file) {
+		if (!file.data) {
+			return;
+		}
+#ifdef _WIN32
+		UnmapViewOfFile(file.data);
+		CloseHandle(file.mapping);
+		CloseHandle(file.file);
+#else
+		munmap(file.data, file.size);
+		close(file.fd);
+#endif
+		file.data = 0;
+	}
+
+	static string segmentPath(const string &dir, uint64_t sequence) {
+		char name[64];
+		snprintf(name, sizeof(name), "%s%016llu%s", SEGMENT_PREFIX, (unsigned long long)sequence, SEGMENT_SUFFIX);
+		return dir + "/" + name;
+	}
+
+	// Sequences of the segments in dir, oldest first
+	static vector<uint64_t> listSegments(const string &dir) {
+		vector<uint64_t> sequences;
+		uv_fs_t req;
+		if (uv_fs_scandir(uv_default_loop(), &req, dir.c_str(), 0, NULL) >= 0) {
+			uv_dirent_t entry;
+			size_t prefixLength = sizeof(SEGMENT_PREFIX) - 1;
+			size_t suffixLength = sizeof(SEGMENT_SUFFIX) - 1;
+			while (uv_fs_scandir_next(&req, &entry) != UV_EOF) {
+				size_t length = strlen(entry.name);
+				if (length <= prefixLength + suffixLength
+					|| strncmp(entry.name, SEGMENT_PREFIX, prefixLength) != 0
+					|| strcmp(entry.name + length - suffixLength, SEGMENT_SUFFIX) != 0) {
+					continue;
+				}
+				sequences.push_back(strtoull(entry.name + prefixLength, NULL, 10));
+			}
+		}
+		uv_fs_req_cleanup(&req);
+		sort(sequences.begin(), sequences.end());
+		return sequences;
+	}
+
+	static int64_t nowMs() {
+		return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	// Writer state, guarded by journalMutex
+	static uv_mutex_t journalMutex;
+	static bool initialized = false;
+	static string journalDir;
+	static size_t segmentSize;
+	static int segmentLimit;
+	static int journalTypes;
+	static mappedFile segment;
+	static segmentHeader *header = 0;
+	static uint64_t nextSequence;
+	static JournalStats stats;
+
+	// Types being journaled, 0 while closed. Checked before taking the
+	// mutex so events cost nothing while there is no journal.
+	static atomic<int> activeTypes(0);
+
+	// Must be called with the journal mutex held
+	static void pruneSegments() {
+		vector<uint64_t> sequences = listSegments(journalDir);
+		for (size_t i = 0; i + segmentLimit < sequences.size(); i++) {
+			uv_fs_t req;
+			uv_fs_unlink(uv_default_loop(), &req, segmentPath(journalDir, sequences[i]).c_str(), NULL);
+			uv_fs_req_cleanup(&req);
+		}
+	}
+
+	// Must be called with the journal mutex held
+	static bool startSegment() {
+		if (header) {
+			unmapFile(segment);
+			header = 0;
+		}
+		uint64_t sequence = nextSequence++;
+		if (!mapFile(segmentPath(journalDir, sequence), true, segmentSize, segment)) {
+			return false;
+		}
+		header = reinterpret_cast<segmentHeader *>(segment.data);
+		memset(header, 0, sizeof(segmentHeader));
+		memcpy(header->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+		header->version = 1;
+		header->sequence = sequence;
+		header->used = sizeof(segmentHeader);
+		stats.segments++;
+		stats.sequence = sequence;
+		pruneSegments();
+		return true;
+	}
+
+	static void append(int type, int id, int method, int ts, const char *a, const char *b, const char *c) {
+		if (!(activeTypes.load(memory_order_acquire) & type)) {
+			return;
+		}
+		const char *strings[3] = { a, b, c };
+		uint16_t lengths[3];
+		size_t size = sizeof(recordHeader);
+		for (int i = 0; i < 3; i++) {
+			size_t length = strings[i] ? strlen(strings[i]) : 0;
+			lengths[i] = (uint16_t)(length > 0xffff ? 0xffff : length);
+			size += lengths[i];
+		}
+		size = (size + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+
+		uv_mutex_lock(&journalMutex);
+		if (!stats.open || !(journalTypes & type)) {
+			uv_mutex_unlock(&journalMutex);
+			return;
+		}
+		if (size > segmentSize - sizeof(segmentHeader)
+			|| ((!header || header->used + size > segmentSize) && !startSegment())) {
+			stats.dropped++;
+			uv_mutex_unlock(&journalMutex);
+			return;
+		}
+
+		// Keep times in order within a segment even if the clock steps back
+		int64_t time = nowMs();
+		if (header->count > 0 && time < header->lastTime) {
+			time = header->lastTime;
+		}
+
+		char *out = segment.data + header->used;
+		recordHeader record = recordHeader();
+		record.size = (uint32_t)size;
+		record.type = (uint16_t)type;
+		record.time = time;
+		record.id = id;
+		record.method = method;
+		record.ts = ts;
+		memcpy(record.lengths, lengths, sizeof(lengths));
+		memcpy(out, &record, sizeof(record));
+		out += sizeof(record);
+		for (int i = 0; i < 3; i++) {
+			if (lengths[i]) {
+				memcpy(out, strings[i], lengths[i]);
+				out += lengths[i];
+			}
+		}
+
+		if (header->count == 0) {
+			header->firstTime = time;
+		}
+		header->lastTime = time;
+		header->count++;
+		// Last, and released, readers never see a half written record
+		atomic_thread_fence(memory_order_release);
+		header->used += size;
+
+		stats.records++;
+		stats.bytes += size;
+		uv_mutex_unlock(&journalMutex);
+	}
+
+	void journalDeviceEvent(int deviceId, int method, const char *data) {
+		append(JOURNAL_DEVICE, deviceId, method, 0, data, 0, 0);
+	}
+
+	void journalSensorEvent(const char *protocol, const char *model, int sensorId, int dataType, const char *value, int ts) {
+		append(JOURNAL_SENSOR, sensorId, dataType, ts, protocol, model, value);
+	}
+
+	void journalRawEvent(const char *data, int controllerId) {
+		append(JOURNAL_RAW, controllerId, 0, 0, data, 0, 0);
+	}
+
+	string journalOpen(const string &path, size_t size, int maxSegments, int types) {
+		if (!initialized) {
+			uv_mutex_init(&journalMutex);
+			initialized = true;
+		}
+		if (size < 4096) {
+			return "Segment size must be at least 4096 bytes";
+		}
+		journalClose();
+
+		uv_fs_t req;
+		int err = uv_fs_mkdir(uv_default_loop(), &req, path.c_str(), 0755, NULL);
+		uv_fs_req_cleanup(&req);
+		if (err < 0 && err != UV_EEXIST) {
+			return string("Could not create journal directory: ") + uv_strerror(err);
+		}
+
+		uv_mutex_lock(&journalMutex);
+		journalDir = path;
+		segmentSize = size;
+		segmentLimit = maxSegments > 0 ? maxSegments : 1;
+		journalTypes = types;
+		stats = JournalStats();
+		vector<uint64_t> sequences = listSegments(path);
+		nextSequence = sequences.empty() ? 1 : sequences.back() + 1;
+
+		// Always start a new segment, older ones are never written to again
+		if (!startSegment()) {
+			uv_mutex_unlock(&journalMutex);
+			return "Could not create journal segment in " + path;
+		}
+		stats.open = true;
+		uv_mutex_unlock(&journalMutex);
+
+		activeTypes.store(types, memory_order_release);
+		return "";
+	}
+
+	void journalClose() {
+		if (!initialized) {
+			return;
+		}
+		activeTypes.store(0, memory_order_release);
+
+		uv_mutex_lock(&journalMutex);
+		stats.open = false;
+		if (header) {
+			unmapFile(segment);
+			header = 0;
+		}
+		uv_mutex_unlock(&journalMutex);
+	}
+
+	void journalStats(JournalStats &out) {
+		if (!initialized) {
+			out = JournalStats();
+			return;
+		}
+		uv_mutex_lock(&journalMutex);
+		out = stats;
+		uv_mutex_unlock(&journalMutex);
+	}
+
+	string journalPath() {
+		if (!initialized) {
+			return "";
+		}
+		uv_mutex_lock(&journalMutex);
+		string path = stats.open ? journalDir : "";
+		uv_mutex_unlock(&journalMutex);
+		return path;
+	}
+
+	struct journalReader {
+		string dir;
+		vector<uint64_t> sequences;
+		size_t nextSegment;
+		mappedFile file;
+		uint64_t used; // Snapshot of the segment's used bytes when it was mapped
+		uint64_t offset;
+		int64_t from;
+		int64_t to;
+		int types;
+	};
+
+	static map<int, journalReader *> readers;
+	static int nextReaderId = 1;
+
+	// Maps the next segment that may hold records in range, false when there are none left
+	static bool nextSegment(journalReader *reader) {
+		unmapFile(reader->file);
+		while (reader->nextSegment < reader->sequences.size()) {
+			string path = segmentPath(reader->dir, reader->sequences[reader->nextSegment++]);
+			if (!mapFile(path, false, 0, reader->file)) {
+				continue; // Pruned since the reader was opened
+			}
+			const segmentHeader *segmentInfo = reinterpret_cast<const segmentHeader *>(reader->file.data);
+			if (reader->file.size < sizeof(segmentHeader) || memcmp(segmentInfo->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0
+				|| segmentInfo->count == 0 || segmentInfo->lastTime < reader->from || segmentInfo->firstTime >= reader->to) {
+				unmapFile(reader->file);
+				continue;
+			}
+			uint64_t used = segmentInfo->used;
+			atomic_thread_fence(memory_order_acquire); // Pairs with the release in append
+			reader->used = min((uint64_t)reader->file.size, used);
+			reader->offset = sizeof(segmentHeader);
+			return true;
+		}
+		return false;
+	}
+
+	int journalOpenReader(const string &path, int64_t from, int64_t to, int types, string &error) {
+		vector<uint64_t> sequences = listSegments(path);
+		if (sequences.empty()) {
+			uv_fs_t req;
+			int err = uv_fs_stat(uv_default_loop(), &req, path.c_str(), NULL);
+			uv_fs_req_cleanup(&req);
+			if (err < 0) {
+				error = string("Could not open journal: ") + uv_strerror(err);
+				return 0;
+			}
+		}
+
+		journalReader *reader = new journalReader();
+		reader->dir = path;
+		reader->sequences.swap(sequences);
+		reader->nextSegment = 0;
+		reader->file.data = 0;
+		reader->used = 0;
+		reader->offset = 0;
+		reader->from = from;
+		reader->to = to;
+		reader->types = types;
+
+		int id = nextReaderId++;
+		readers[id] = reader;
+		return id;
+	}
+
+	bool journalRead(int readerId, size_t max, JournalVisitor visit, void *context) {
+		map<int, journalReader *>::iterator it = readers.find(readerId);
+		if (it == readers.end()) {
+			return false;
+		}
+		journalReader *reader = it->second;
+
+		size_t delivered = 0;
+		while (delivered < max) {
+			if (!reader->file.data || reader->offset + sizeof(recordHeader) > reader->used) {
+				if (!nextSegment(reader)) {
+					journalCloseReader(readerId);
+					return false;
+				}
+			}
+
+			recordHeader record;
+			memcpy(&record, reader->file.data + reader->offset, sizeof(record));
+			if (record.size < sizeof(recordHeader) + (size_t)record.lengths[0] + record.lengths[1] + record.lengths[2]
+				|| reader->offset + record.size > reader->used) {
+				reader->offset = reader->used; // Damaged, skip the rest of the segment
+				continue;
+			}
+			if (record.time >= reader->to) {
+				reader->offset = reader->used; // Sorted by time, nothing more in this segment
+				continue;
+			}
+
+			const char *strings = reader->file.data + reader->offset + sizeof(recordHeader);
+			reader->offset += record.size;
+			if (record.time < reader->from || !(record.type & reader->types)) {
+				continue;
+			}
+
+			JournalRecord decoded;
+			decoded.type = record.type;
+			decoded.time = record.time;
+			decoded.id = record.id;
+			decoded.method = record.method;
+			decoded.ts = record.ts;
+			for (int i = 0; i < 3; i++) {
+				decoded.strings[i] = strings;
+				decoded.lengths[i] = record.lengths[i];
+				strings += record.lengths[i];
+			}
+			visit(decoded, context);
+			delivered++;
+		}
+		return true;
+	}
+
+	void journalCloseReader(int readerId) {
+		map<int, journalReader *>::iterator it = readers.find(readerId);
+		if (it == readers.end()) {
+			return;
+		}
+		unmapFile(it->second->file);
+		delete it->second;
+		readers.erase(it);
+	}
+
+}
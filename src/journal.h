@@ -0,0 +1,76 @@
+#ifndef TELLDUS_V8_JOURNAL_H
+#define TELLDUS_V8_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace telldus_v8 {
+
+	// Append-only journal of device, sensor and raw events. Records are
+	// written on the telldus callback thread into memory mapped segment
+	// files of a fixed size (journal-<sequence>.tdj in one directory),
+	// a new segment is started when the current one is full and the
+	// oldest ones are deleted beyond the configured count.
+	//
+	// Segment headers carry the time span of their records, so readers
+	// skip whole segments outside the range they ask for and only ever
+	// map one segment at a time.
+
+	enum JournalRecordType {
+		JOURNAL_DEVICE = 1,
+		JOURNAL_SENSOR = 2,
+		JOURNAL_RAW = 4
+	};
+
+	const int JOURNAL_ALL_TYPES = JOURNAL_DEVICE | JOURNAL_SENSOR | JOURNAL_RAW;
+
+	struct JournalStats {
+		bool open;
+		uint64_t records;
+		uint64_t bytes;
+		uint64_t dropped; // Too large for a segment, or a segment couldn't be created
+		uint64_t segments; // Started since the journal was opened
+		uint64_t sequence; // Of the segment being written
+	};
+
+	// Decoded record, strings point into the mapped segment and are only
+	// valid until the reader moves on. They are not null terminated.
+	struct JournalRecord {
+		int type;
+		int64_t time; // Milliseconds since the epoch, when the record was written
+		int id; // Device, sensor or controller id
+		int method; // Device: method, sensor: data type
+		int ts; // Sensor: timestamp of the reading
+		const char *strings[3]; // Device: data, sensor: protocol, model, value, raw: data
+		size_t lengths[3];
+	};
+
+	// Returns an empty string on success, otherwise what went wrong.
+	// Loop thread only.
+	std::string journalOpen(const std::string &path, size_t segmentSize, int maxSegments, int types);
+	void journalClose();
+	void journalStats(JournalStats &stats);
+
+	// Events from the addon's single registration per stream, appended if
+	// the journal is open and takes that type. Callback thread.
+	void journalDeviceEvent(int deviceId, int method, const char *data);
+	void journalSensorEvent(const char *protocol, const char *model, int sensorId, int dataType, const char *value, int ts);
+	void journalRawEvent(const char *data, int controllerId);
+
+	// Path of the open journal, empty if none
+	std::string journalPath();
+
+	// Readers, identified by id. Loop thread only.
+	int journalOpenReader(const std::string &path, int64_t from, int64_t to, int types, std::string &error);
+
+	// Calls visit for up to max records with from <= time < to, returns
+	// false once the reader is exhausted (it is closed by then)
+	typedef void (*JournalVisitor)(const JournalRecord &record, void *context);
+	bool journalRead(int readerId, size_t max, JournalVisitor visit, void *context);
+
+	void journalCloseReader(int readerId);
+
+}
+
+#endif // TELLDUS_V8_JOURNAL_H
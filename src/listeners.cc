@@ -0,0 +1,91 @@
+#include <uv.h>
+
+#include "listeners.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	struct listenerTable {
+		uv_mutex_t mutex;
+		vector<ListenerEntry> entries; // Sorted by id, ids only ever grow
+	};
+
+	static listenerTable tables[EVENT_STREAM_COUNT];
+	static int nextListenerId = 1; // Only touched on the loop thread
+
+	static vector<ListenerEntry>::iterator findEntry(vector<ListenerEntry> &entries, int id) {
+		size_t low = 0, high = entries.size();
+		while (low < high) {
+			size_t mid = (low + high) / 2;
+			if (entries[mid].id < id) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+		if (low < entries.size() && entries[low].id == id) {
+			return entries.begin() + low;
+		}
+		return entries.end();
+	}
+
+	void listenersInit() {
+		for (int i = 0; i < EVENT_STREAM_COUNT; i++) {
+			uv_mutex_init(&tables[i].mutex);
+		}
+	}
+
+	int listenerAdd(EventStream stream, EventContext *context, EventFilter *filter, bool parse) {
+		listenerTable &table = tables[stream];
+		ListenerEntry entry;
+		entry.id = nextListenerId;
+		entry.context = context;
+		entry.filter = filter;
+		entry.parse = parse;
+
+		uv_mutex_lock(&table.mutex);
+		table.entries.push_back(entry);
+		uv_mutex_unlock(&table.mutex);
+
+		nextListenerId++;
+		return entry.id;
+	}
+
+	bool listenerRemove(int id, ListenerEntry &removed) {
+		for (int i = 0; i < EVENT_STREAM_COUNT; i++) {
+			listenerTable &table = tables[i];
+			uv_mutex_lock(&table.mutex);
+			vector<ListenerEntry>::iterator it = findEntry(table.entries, id);
+			if (it != table.entries.end()) {
+				removed = *it;
+				table.entries.erase(it);
+				uv_mutex_unlock(&table.mutex);
+				return true;
+			}
+			uv_mutex_unlock(&table.mutex);
+		}
+		return false;
+	}
+
+	EventContext *listenerFind(EventStream stream, int id) {
+		// The table only changes on the loop thread, reading it here needs no lock
+		vector<ListenerEntry> &entries = tables[stream].entries;
+		vector<ListenerEntry>::iterator it = findEntry(entries, id);
+		return it == entries.end() ? 0 : it->context;
+	}
+
+	size_t listenerCount(EventStream stream) {
+		return tables[stream].entries.size();
+	}
+
+	const vector<ListenerEntry> &listenersLock(EventStream stream) {
+		uv_mutex_lock(&tables[stream].mutex);
+		return tables[stream].entries;
+	}
+
+	void listenersUnlock(EventStream stream) {
+		uv_mutex_unlock(&tables[stream].mutex);
+	}
+
+}
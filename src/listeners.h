@@ -0,0 +1,49 @@
+#ifndef TELLDUS_V8_LISTENERS_H
+#define TELLDUS_V8_LISTENERS_H
+
+#include <vector>
+
+#include "event_filter.h"
+#include "event_hub.h"
+
+namespace telldus_v8 {
+
+	// JavaScript listeners, one table per event stream. The addon keeps a
+	// single telldus-core registration per stream and fans every event out
+	// to the listeners in here, so adding or removing a listener never
+	// talks to telldusd.
+	//
+	// The callback thread matches an event against the table while holding
+	// its lock and queues one baton carrying the ids of the listeners that
+	// want it. The loop thread looks the ids up again when dispatching,
+	// listeners removed in between are skipped. Ids are never reused.
+
+	struct ListenerEntry {
+		int id;
+		EventContext *context;
+		EventFilter *filter; // Null if the listener wants everything
+		bool parse; // Raw events only, the listener wants them parsed
+	};
+
+	void listenersInit();
+
+	// Returns the new listener id. Loop thread only.
+	int listenerAdd(EventStream stream, EventContext *context, EventFilter *filter, bool parse);
+
+	// Takes the listener out of its table and hands it back, so the caller
+	// can release it. False if there is no listener with that id. Once this
+	// returns the callback thread no longer touches the entry. Loop thread only.
+	bool listenerRemove(int id, ListenerEntry &removed);
+
+	// Context of a listener that is still registered, null otherwise. Loop thread only.
+	EventContext *listenerFind(EventStream stream, int id);
+
+	size_t listenerCount(EventStream stream);
+
+	// Callback thread, the entries stay valid until listenersUnlock
+	const std::vector<ListenerEntry> &listenersLock(EventStream stream);
+	void listenersUnlock(EventStream stream);
+
+}
+
+#endif // TELLDUS_V8_LISTENERS_H
@@ -0,0 +1,174 @@
+#include <map>
+#include <string.h>
+#include <uv.h>
+
+#include <telldus-core.h>
+
+#include "metadata_cache.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	struct deviceMetadata {
+		unsigned int valid; // Bitmask of (1 << MetadataField), plus TYPE_VALID
+		string fields[3];
+		int type;
+		map<string, string> parameters; // Keyed by name + '\0' + default value
+	};
+
+	static const unsigned int TYPE_VALID = 1 << 8;
+
+	static uv_mutex_t cacheMutex;
+	static map<int, deviceMetadata> cache;
+	static unsigned int generation = 0;
+	static bool attached = false;
+
+	static string parameterKey(const char *name, const char *defaultValue) {
+		string key(name);
+		key.push_back('\0');
+		key.append(defaultValue);
+		return key;
+	}
+
+	// Telldus reports "UNKNOWN" for devices it doesn't know about, don't keep those around
+	static bool cacheable(const char *value) {
+		return value && strcmp(value, "UNKNOWN") != 0;
+	}
+
+	void metadataCacheInit() {
+		uv_mutex_init(&cacheMutex);
+	}
+
+	void metadataCacheAttach() {
+		// Anything cached while we weren't listening can't be trusted
+		metadataInvalidateAll();
+		uv_mutex_lock(&cacheMutex);
+		attached = true;
+		uv_mutex_unlock(&cacheMutex);
+	}
+
+	void metadataCacheDetach() {
+		uv_mutex_lock(&cacheMutex);
+		attached = false;
+		uv_mutex_unlock(&cacheMutex);
+		metadataInvalidateAll();
+	}
+
+	void metadataCacheDeviceChanged(int deviceId, int changeEvent) {
+		if (changeEvent == TELLSTICK_DEVICE_STATE_CHANGED) {
+			return;
+		}
+		metadataInvalidate(deviceId);
+	}
+
+	unsigned int metadataGeneration() {
+		uv_mutex_lock(&cacheMutex);
+		unsigned int current = generation;
+		uv_mutex_unlock(&cacheMutex);
+		return current;
+	}
+
+	bool metadataLookup(int deviceId, MetadataField field, string &value) {
+		bool found = false;
+		uv_mutex_lock(&cacheMutex);
+		map<int, deviceMetadata>::const_iterator it = cache.find(deviceId);
+		if (it != cache.end() && (it->second.valid & (1 << field))) {
+			value = it->second.fields[field];
+			found = true;
+		}
+		uv_mutex_unlock(&cacheMutex);
+		return found;
+	}
+
+	bool metadataLookupType(int deviceId, int &type) {
+		bool found = false;
+		uv_mutex_lock(&cacheMutex);
+		map<int, deviceMetadata>::const_iterator it = cache.find(deviceId);
+		if (it != cache.end() && (it->second.valid & TYPE_VALID)) {
+			type = it->second.type;
+			found = true;
+		}
+		uv_mutex_unlock(&cacheMutex);
+		return found;
+	}
+
+	bool metadataLookupParameter(int deviceId, const char *name, const char *defaultValue, string &value) {
+		bool found = false;
+		uv_mutex_lock(&cacheMutex);
+		map<int, deviceMetadata>::const_iterator it = cache.find(deviceId);
+		if (it != cache.end()) {
+			map<string, string>::const_iterator param = it->second.parameters.find(parameterKey(name, defaultValue));
+			if (param != it->second.parameters.end()) {
+				value = param->second;
+				found = true;
+			}
+		}
+		uv_mutex_unlock(&cacheMutex);
+		return found;
+	}
+
+	// Must be called with cacheMutex held
+	static deviceMetadata *entryFor(int deviceId, unsigned int readGeneration) {
+		if (readGeneration != generation || !attached) {
+			return 0;
+		}
+		map<int, deviceMetadata>::iterator it = cache.find(deviceId);
+		if (it == cache.end()) {
+			it = cache.insert(make_pair(deviceId, deviceMetadata())).first;
+			it->second.valid = 0;
+			it->second.type = 0;
+		}
+		return &it->second;
+	}
+
+	void metadataStore(int deviceId, MetadataField field, const char *value, unsigned int readGeneration) {
+		if (!cacheable(value)) {
+			return;
+		}
+		uv_mutex_lock(&cacheMutex);
+		deviceMetadata *entry = entryFor(deviceId, readGeneration);
+		if (entry) {
+			entry->fields[field] = value;
+			entry->valid |= (1 << field);
+		}
+		uv_mutex_unlock(&cacheMutex);
+	}
+
+	void metadataStoreType(int deviceId, int type, unsigned int readGeneration) {
+		uv_mutex_lock(&cacheMutex);
+		deviceMetadata *entry = entryFor(deviceId, readGeneration);
+		if (entry) {
+			entry->type = type;
+			entry->valid |= TYPE_VALID;
+		}
+		uv_mutex_unlock(&cacheMutex);
+	}
+
+	void metadataStoreParameter(int deviceId, const char *name, const char *defaultValue, const char *value, unsigned int readGeneration) {
+		if (!cacheable(value)) {
+			return;
+		}
+		uv_mutex_lock(&cacheMutex);
+		deviceMetadata *entry = entryFor(deviceId, readGeneration);
+		if (entry) {
+			entry->parameters[parameterKey(name, defaultValue)] = value;
+		}
+		uv_mutex_unlock(&cacheMutex);
+	}
+
+	void metadataInvalidate(int deviceId) {
+		uv_mutex_lock(&cacheMutex);
+		cache.erase(deviceId);
+		generation++;
+		uv_mutex_unlock(&cacheMutex);
+	}
+
+	void metadataInvalidateAll() {
+		uv_mutex_lock(&cacheMutex);
+		cache.clear();
+		generation++;
+		uv_mutex_unlock(&cacheMutex);
+	}
+
+}
@@ -0,0 +1,48 @@
+#ifndef TELLDUS_V8_METADATA_CACHE_H
+#define TELLDUS_V8_METADATA_CACHE_H
+
+#include <string>
+
+namespace telldus_v8 {
+
+	// In-process cache of device metadata (name, model, protocol, type and
+	// parameters) keyed by device id. Entries are filled on first access and
+	// dropped when telldusd reports a change to the device, or when we change
+	// it ourselves.
+	//
+	// A miss should be followed by a store passing the generation that was
+	// read before the IPC call, so a value fetched before an invalidation
+	// never ends up in the cache.
+
+	enum MetadataField {
+		METADATA_NAME,
+		METADATA_MODEL,
+		METADATA_PROTOCOL
+	};
+
+	void metadataCacheInit();
+
+	// Call once device change events are coming in (after tdInit) and
+	// before they stop (before tdClose). Nothing is cached while detached.
+	void metadataCacheAttach();
+	void metadataCacheDetach();
+
+	// Device change event, from the addon's single registration. Any thread.
+	void metadataCacheDeviceChanged(int deviceId, int changeEvent);
+
+	unsigned int metadataGeneration();
+
+	bool metadataLookup(int deviceId, MetadataField field, std::string &value);
+	bool metadataLookupType(int deviceId, int &type);
+	bool metadataLookupParameter(int deviceId, const char *name, const char *defaultValue, std::string &value);
+
+	void metadataStore(int deviceId, MetadataField field, const char *value, unsigned int generation);
+	void metadataStoreType(int deviceId, int type, unsigned int generation);
+	void metadataStoreParameter(int deviceId, const char *name, const char *defaultValue, const char *value, unsigned int generation);
+
+	void metadataInvalidate(int deviceId);
+	void metadataInvalidateAll();
+
+}
+
+#endif // TELLDUS_V8_METADATA_CACHE_H
@@ -0,0 +1,77 @@
+#ifndef TELLDUS_V8_OPERATIONS_H
+#define TELLDUS_V8_OPERATIONS_H
+
+#include "executor.h"
+
+namespace telldus_v8 {
+
+	// Every call that goes to telldus-core, in one table. The addon expands
+	// it into the per worktype run function, lane and result type, and into
+	// typed sync and async entry points (name and nameSync) that only
+	// convert the arguments the operation takes. The generic AsyncCaller
+	// and SyncCaller as well as the bulk calls and scenes look operations
+	// up by worktype in the same table.
+	//
+	// X(name, worktype, arguments, result, lane, run, guard)
+	//
+	// Worktypes are the numbers the JavaScript side has always used, 13
+	// (removeEventListener) is handled natively without telldus-core.
+
+	enum OperationArgs {
+		ARGS_NONE,
+		ARGS_ID, // (id)
+		ARGS_ID_VALUE, // (id, number)
+		ARGS_ID_STRING, // (id, string)
+		ARGS_ID_STRING2, // (id, string, string)
+		ARGS_VERSION // (number version), see device_versions.h
+	};
+
+	enum OperationResult {
+		RESULT_NUMBER,
+		RESULT_BOOL,
+		RESULT_STRING,
+		RESULT_DEVICES,
+		RESULT_COMPACT_DEVICES, // Typed array columns, see getCompactDevicesFromInternals
+		RESULT_DEVICE_CHANGES // {version, full, devices, removed}
+	};
+
+	enum OperationGuard {
+		GUARDED, // Subject to the circuit breaker and deadlines, see breaker.h
+		UNGUARDED // Always goes through, whatever state telldusd is in
+	};
+
+	const int OPERATION_COUNT = 29; // Worktypes are below this
+
+#define TELLDUS_OPERATIONS(X) \
+	X(turnOn, 0, ARGS_ID, RESULT_NUMBER, LANE_COMMAND, RunDeviceCommand, GUARDED) \
+	X(turnOff, 1, ARGS_ID, RESULT_NUMBER, LANE_COMMAND, RunDeviceCommand, GUARDED) \
+	X(dim, 2, ARGS_ID_VALUE, RESULT_NUMBER, LANE_COMMAND, RunDeviceCommand, GUARDED) \
+	X(learn, 3, ARGS_ID, RESULT_NUMBER, LANE_COMMAND, RunDeviceCommand, GUARDED) \
+	X(addDevice, 4, ARGS_NONE, RESULT_NUMBER, LANE_QUERY, RunAddDevice, GUARDED) \
+	X(setName, 5, ARGS_ID_STRING, RESULT_BOOL, LANE_QUERY, RunSetName, GUARDED) \
+	X(getName, 6, ARGS_ID, RESULT_STRING, LANE_QUERY, RunGetName, GUARDED) \
+	X(setProtocol, 7, ARGS_ID_STRING, RESULT_BOOL, LANE_QUERY, RunSetProtocol, GUARDED) \
+	X(getProtocol, 8, ARGS_ID, RESULT_STRING, LANE_QUERY, RunGetProtocol, GUARDED) \
+	X(setModel, 9, ARGS_ID_STRING, RESULT_BOOL, LANE_QUERY, RunSetModel, GUARDED) \
+	X(getModel, 10, ARGS_ID, RESULT_STRING, LANE_QUERY, RunGetModel, GUARDED) \
+	X(getDeviceType, 11, ARGS_ID, RESULT_NUMBER, LANE_QUERY, RunGetDeviceType, GUARDED) \
+	X(removeDevice, 12, ARGS_ID, RESULT_BOOL, LANE_QUERY, RunRemoveDevice, GUARDED) \
+	X(getErrorString, 14, ARGS_ID, RESULT_STRING, LANE_QUERY, RunGetErrorString, GUARDED) \
+	X(init, 15, ARGS_NONE, RESULT_BOOL, LANE_QUERY, RunInit, UNGUARDED) \
+	X(close, 16, ARGS_NONE, RESULT_BOOL, LANE_QUERY, RunClose, UNGUARDED) \
+	X(getNumberOfDevices, 17, ARGS_NONE, RESULT_NUMBER, LANE_QUERY, RunGetNumberOfDevices, GUARDED) \
+	X(stop, 18, ARGS_ID, RESULT_NUMBER, LANE_COMMAND, RunDeviceCommand, GUARDED) \
+	X(bell, 19, ARGS_ID, RESULT_NUMBER, LANE_COMMAND, RunDeviceCommand, GUARDED) \
+	X(getDeviceId, 20, ARGS_ID, RESULT_NUMBER, LANE_QUERY, RunGetDeviceId, GUARDED) \
+	X(getDeviceParameter, 21, ARGS_ID_STRING2, RESULT_STRING, LANE_QUERY, RunGetDeviceParameter, GUARDED) \
+	X(setDeviceParameter, 22, ARGS_ID_STRING2, RESULT_BOOL, LANE_QUERY, RunSetDeviceParameter, GUARDED) \
+	X(execute, 23, ARGS_ID, RESULT_NUMBER, LANE_COMMAND, RunDeviceCommand, GUARDED) \
+	X(up, 24, ARGS_ID, RESULT_NUMBER, LANE_COMMAND, RunDeviceCommand, GUARDED) \
+	X(down, 25, ARGS_ID, RESULT_NUMBER, LANE_COMMAND, RunDeviceCommand, GUARDED) \
+	X(getDevices, 26, ARGS_NONE, RESULT_DEVICES, LANE_QUERY, RunGetDevices, GUARDED) \
+	X(getDevicesCompact, 27, ARGS_NONE, RESULT_COMPACT_DEVICES, LANE_QUERY, RunGetDevices, GUARDED) \
+	X(getDevicesSince, 28, ARGS_VERSION, RESULT_DEVICE_CHANGES, LANE_QUERY, RunGetDevicesSince, GUARDED)
+
+}
+
+#endif // TELLDUS_V8_OPERATIONS_H
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	static const size_t RECORD_ALIGN = 16;
+
+	static vector<SlabPool *> &registry() {
+		// Pools are globals in several translation units, don't depend on their order
+		static vector<SlabPool *> pools;
+		return pools;
+	}
+
+	SlabPool::SlabPool(const char *name, size_t recordSize, size_t recordsPerSlab)
+		: name(name), recordsPerSlab(recordsPerSlab), freeList(0), allocations(0), inUse(0), peak(0) {
+		if (recordSize < sizeof(freeRecord)) {
+			recordSize = sizeof(freeRecord);
+		}
+		this->recordSize = (recordSize + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+		registry().push_back(this);
+	}
+
+	void SlabPool::grow() {
+		char *slab = static_cast<char *>(malloc(recordSize * recordsPerSlab));
+		if (!slab) {
+			throw std::bad_alloc();
+		}
+		slabs.push_back(slab);
+		// Thread the new records onto the free list, first one on top
+		for (size_t i = recordsPerSlab; i-- > 0;) {
+			freeRecord *record = reinterpret_cast<freeRecord *>(slab + i * recordSize);
+			record->next = freeList;
+			freeList = record;
+		}
+	}
+
+	void *SlabPool::acquire() {
+		if (!freeList) {
+			grow();
+		}
+		freeRecord *record = freeList;
+		freeList = record->next;
+		allocations++;
+		if (++inUse > peak) {
+			peak = inUse;
+		}
+		return record;
+	}
+
+	void SlabPool::release(void *record) {
+		freeRecord *entry = static_cast<freeRecord *>(record);
+		entry->next = freeList;
+		freeList = entry;
+		inUse--;
+	}
+
+	void SlabPool::stats(PoolStats &out) const {
+		out.name = name;
+		out.recordSize = recordSize;
+		out.allocations = allocations;
+		out.slabs = slabs.size();
+		out.inUse = inUse;
+		out.peak = peak;
+		out.capacity = slabs.size() * recordsPerSlab;
+	}
+
+	void poolStatsAll(vector<PoolStats> &stats) {
+		vector<SlabPool *> &pools = registry();
+		stats.resize(pools.size());
+		for (size_t i = 0; i < pools.size(); i++) {
+			pools[i]->stats(stats[i]);
+		}
+	}
+
+	// Strings are carved from 4 kB chunks, anything over a quarter of that
+	// is cheaper to malloc on its own. A few empty chunks are kept around.
+	static const size_t CHUNK_SIZE = 4096;
+	static const size_t MAX_STRING = CHUNK_SIZE / 4;
+	static const size_t MAX_SPARE_CHUNKS = 4;
+
+	struct arenaChunk {
+		size_t used;
+		size_t live; // Strings handed out and not released yet
+		arenaChunk *next; // Spare list
+		char data[CHUNK_SIZE];
+	};
+
+	// In front of every string, chunk is null for oversized ones
+	struct arenaHeader {
+		arenaChunk *chunk;
+		size_t size;
+	};
+
+	static arenaChunk *current = 0;
+	static arenaChunk *spare = 0;
+	static size_t spareCount = 0;
+	static ArenaStats arena;
+
+	static arenaChunk *newChunk() {
+		arenaChunk *chunk = spare;
+		if (chunk) {
+			spare = chunk->next;
+			spareCount--;
+		} else {
+			chunk = static_cast<arenaChunk *>(malloc(sizeof(arenaChunk)));
+			if (!chunk) {
+				throw std::bad_alloc();
+			}
+			if (++arena.chunks > arena.peakChunks) {
+				arena.peakChunks = arena.chunks;
+			}
+		}
+		chunk->used = 0;
+		chunk->live = 0;
+		chunk->next = 0;
+		return chunk;
+	}
+
+	char *arenaAlloc(size_t length) {
+		size_t size = (sizeof(arenaHeader) + length + 1 + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+		arenaHeader *header;
+
+		if (size > MAX_STRING) {
+			header = static_cast<arenaHeader *>(malloc(size));
+			if (!header) {
+				throw std::bad_alloc();
+			}
+			header->chunk = 0;
+			arena.oversized++;
+		} else {
+			if (!current || current->used + size > CHUNK_SIZE) {
+				if (current && current->live == 0) {
+					current->used = 0;
+				} else {
+					// The old chunk is recycled once its last string is released
+					current = newChunk();
+				}
+			}
+			header = reinterpret_cast<arenaHeader *>(current->data + current->used);
+			header->chunk = current;
+			current->used += size;
+			current->live++;
+		}
+
+		header->size = size;
+		char *buffer = reinterpret_cast<char *>(header + 1);
+		buffer[length] = '\0';
+
+		arena.allocations++;
+		arena.bytes += size;
+		if (arena.bytes > arena.peakBytes) {
+			arena.peakBytes = arena.bytes;
+		}
+		return buffer;
+	}
+
+	char *arenaCopy(const char *s, size_t length) {
+		char *copy = arenaAlloc(length);
+		memcpy(copy, s, length);
+		return copy;
+	}
+
+	void arenaRelease(char *s) {
+		if (!s) {
+			return;
+		}
+		arenaHeader *header = reinterpret_cast<arenaHeader *>(s) - 1;
+		arena.bytes -= header->size;
+
+		arenaChunk *chunk = header->chunk;
+		if (!chunk) {
+			free(header);
+			return;
+		}
+		if (--chunk->live > 0) {
+			return;
+		}
+		if (chunk == current) {
+			chunk->used = 0;
+		} else if (spareCount < MAX_SPARE_CHUNKS) {
+			chunk->next = spare;
+			spare = chunk;
+			spareCount++;
+		} else {
+			free(chunk);
+			arena.chunks--;
+		}
+	}
+
+	void arenaStats(ArenaStats &stats) {
+		stats = arena;
+	}
+
+}
@@ -0,0 +1,96 @@
+#ifndef TELLDUS_V8_POOL_H
+#define TELLDUS_V8_POOL_H
+
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace telldus_v8 {
+
+	// Recycled storage for the records every async call and queued command
+	// goes through (work requests, executor tasks, command jobs) and for
+	// the strings they carry, so steady traffic stops hitting malloc.
+	//
+	// Records come out of fixed size slabs and go back on a free list,
+	// slabs are never returned. Strings are bump allocated from chunks that
+	// are recycled once everything carved out of them has been released.
+	//
+	// Pools are not locked, they are only used on the loop thread.
+
+	struct PoolStats {
+		const char *name;
+		size_t recordSize;
+		uint64_t allocations;
+		uint64_t slabs; // Each one a single malloc
+		size_t inUse;
+		size_t peak;
+		size_t capacity; // Records in all slabs
+	};
+
+	class SlabPool {
+	public:
+		SlabPool(const char *name, size_t recordSize, size_t recordsPerSlab = 64);
+
+		void *acquire();
+		void release(void *record);
+		void stats(PoolStats &stats) const;
+
+	private:
+		struct freeRecord {
+			freeRecord *next;
+		};
+
+		void grow();
+
+		const char *name;
+		size_t recordSize;
+		size_t recordsPerSlab;
+		freeRecord *freeList;
+		std::vector<char *> slabs;
+		uint64_t allocations;
+		size_t inUse;
+		size_t peak;
+
+		SlabPool(const SlabPool &);
+		SlabPool &operator=(const SlabPool &);
+	};
+
+	template <typename T>
+	class ObjectPool : public SlabPool {
+	public:
+		explicit ObjectPool(const char *name) : SlabPool(name, sizeof(T)) {}
+
+		T *create() {
+			return new (acquire()) T();
+		}
+
+		void destroy(T *object) {
+			object->~T();
+			release(object);
+		}
+	};
+
+	// Every pool there is, in the order they were created
+	void poolStatsAll(std::vector<PoolStats> &stats);
+
+	struct ArenaStats {
+		uint64_t allocations;
+		uint64_t oversized; // Too large for a chunk, went to malloc
+		size_t bytes; // Handed out and not released yet
+		size_t peakBytes;
+		size_t chunks; // Allocated, in use or kept for reuse
+		size_t peakChunks;
+	};
+
+	// Room for length bytes and a terminator, released with arenaRelease
+	char *arenaAlloc(size_t length);
+
+	// Null terminated copy of length bytes of s
+	char *arenaCopy(const char *s, size_t length);
+	void arenaRelease(char *s);
+	void arenaStats(ArenaStats &stats);
+
+}
+
+#endif // TELLDUS_V8_POOL_H
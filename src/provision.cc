@@ -0,0 +1,48 @@
+#include <telldus-core.h>
+
+#include "device_versions.h"
+#include "metadata_cache.h"
+#include "provision.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	// TELLSTICK_SUCCESS, or the error of the step that failed
+	static int configure(int id, const DeviceSpec &spec) {
+		if (spec.hasName && !tdSetName(id, spec.name.c_str())) {
+			return TELLSTICK_ERROR_DEVICE_NOT_FOUND;
+		}
+		// Protocol before model and parameters, telldus-core checks them against it
+		if (spec.hasProtocol && !tdSetProtocol(id, spec.protocol.c_str())) {
+			return TELLSTICK_ERROR_METHOD_NOT_SUPPORTED;
+		}
+		if (spec.hasModel && !tdSetModel(id, spec.model.c_str())) {
+			return TELLSTICK_ERROR_METHOD_NOT_SUPPORTED;
+		}
+		for (size_t i = 0; i < spec.parameters.size(); i++) {
+			if (!tdSetDeviceParameter(id, spec.parameters[i].first.c_str(), spec.parameters[i].second.c_str())) {
+				return TELLSTICK_ERROR_METHOD_NOT_SUPPORTED;
+			}
+		}
+		return TELLSTICK_SUCCESS;
+	}
+
+	int provisionDevice(const DeviceSpec &spec) {
+		int id = tdAddDevice();
+		if (id <= 0) {
+			return id < 0 ? id : TELLSTICK_ERROR_UNKNOWN;
+		}
+
+		int result = configure(id, spec);
+		metadataInvalidate(id);
+		if (result != TELLSTICK_SUCCESS) {
+			tdRemoveDevice(id);
+			return result;
+		}
+
+		deviceVersionTouch(id);
+		return id;
+	}
+
+}
@@ -0,0 +1,32 @@
+#ifndef TELLDUS_V8_PROVISION_H
+#define TELLDUS_V8_PROVISION_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace telldus_v8 {
+
+	// Creating a device is addDevice followed by a handful of setters.
+	// provisionDevice does all of them in one go, on the calling thread,
+	// and removes the device again if any step fails, so a failure never
+	// leaves a half configured device behind.
+
+	struct DeviceSpec {
+		bool hasName;
+		std::string name;
+		bool hasProtocol;
+		std::string protocol;
+		bool hasModel;
+		std::string model;
+		std::vector<std::pair<std::string, std::string> > parameters; // Name, value
+	};
+
+	// Id of the new device, or the telldus error code of the step that
+	// failed: TELLSTICK_ERROR_METHOD_NOT_SUPPORTED if telldus-core refused
+	// the protocol, model or a parameter
+	int provisionDevice(const DeviceSpec &spec);
+
+}
+
+#endif // TELLDUS_V8_PROVISION_H
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "raw_event.h"
+
+namespace telldus_v8 {
+
+	const char *RAW_EVENT_KEYS[RAW_KEY_COUNT] = {
+		"class",
+		"protocol",
+		"model",
+		"house",
+		"unit",
+		"group",
+		"method",
+		"id",
+		"temp",
+		"humidity"
+	};
+
+	static uint8_t lookupKey(const char *key, int length) {
+		for (int i = 0; i < RAW_KEY_COUNT; i++) {
+			if ((int)strlen(RAW_EVENT_KEYS[i]) == length && memcmp(RAW_EVENT_KEYS[i], key, length) == 0) {
+				return (uint8_t)i;
+			}
+		}
+		return RAW_KEY_OTHER;
+	}
+
+	// Only plain decimals become numbers. Hex data, codes like "A" and
+	// values with leading zeros are kept as strings so nothing is lost.
+	static bool decodeNumber(const char *value, int length, double &number) {
+		int i = 0;
+		if (length > 0 && value[0] == '-') {
+			i++;
+		}
+		int digitsStart = i;
+		bool dot = false;
+		for (; i < length; i++) {
+			if (value[i] == '.' && !dot && i > digitsStart) {
+				dot = true;
+			} else if (value[i] < '0' || value[i] > '9') {
+				return false;
+			}
+		}
+		if (i == digitsStart || value[length - 1] == '.') {
+			return false;
+		}
+		if (value[digitsStart] == '0' && length > digitsStart + 1 && value[digitsStart + 1] != '.') {
+			return false;
+		}
+
+		char buffer[32];
+		if (length >= (int)sizeof(buffer)) {
+			return false;
+		}
+		memcpy(buffer, value, length);
+		buffer[length] = '\0';
+		number = strtod(buffer, 0);
+		return true;
+	}
+
+	int parseRawEvent(const char *data, RawEventField *fields, int maxFields) {
+		int count = 0;
+		const char *pos = data;
+
+		while (*pos && count < maxFields) {
+			const char *end = strchr(pos, ';');
+			if (!end) {
+				end = pos + strlen(pos);
+			}
+			const char *colon = (const char *)memchr(pos, ':', end - pos);
+			if (colon) {
+				RawEventField &field = fields[count++];
+				field.keyOffset = (uint16_t)(pos - data);
+				field.keyLength = (uint16_t)(colon - pos);
+				field.valueOffset = (uint16_t)(colon + 1 - data);
+				field.valueLength = (uint16_t)(end - colon - 1);
+				field.key = lookupKey(pos, field.keyLength);
+				field.isNumber = decodeNumber(colon + 1, field.valueLength, field.number) ? 1 : 0;
+			}
+			if (!*end) {
+				break;
+			}
+			pos = end + 1;
+		}
+
+		return count;
+	}
+
+}
@@ -0,0 +1,48 @@
+#ifndef TELLDUS_V8_RAW_EVENT_H
+#define TELLDUS_V8_RAW_EVENT_H
+
+#include <stdint.h>
+
+namespace telldus_v8 {
+
+	// Raw device events look like
+	//   class:command;protocol:arctech;model:selflearning;house:5804222;unit:2;group:0;method:turnon;
+	// parseRawEvent splits such a string into key/value fields in place
+	// (offsets into the original string), recognizing the common keys and
+	// decoding plain decimal values to numbers.
+
+	enum RawEventKey {
+		RAW_KEY_CLASS,
+		RAW_KEY_PROTOCOL,
+		RAW_KEY_MODEL,
+		RAW_KEY_HOUSE,
+		RAW_KEY_UNIT,
+		RAW_KEY_GROUP,
+		RAW_KEY_METHOD,
+		RAW_KEY_ID,
+		RAW_KEY_TEMP,
+		RAW_KEY_HUMIDITY,
+		RAW_KEY_COUNT,
+		RAW_KEY_OTHER = RAW_KEY_COUNT
+	};
+
+	extern const char *RAW_EVENT_KEYS[RAW_KEY_COUNT];
+
+	const int RAW_EVENT_MAX_FIELDS = 16;
+
+	struct RawEventField {
+		uint16_t keyOffset;
+		uint16_t keyLength;
+		uint16_t valueOffset;
+		uint16_t valueLength;
+		uint8_t key; // RawEventKey
+		uint8_t isNumber;
+		double number;
+	};
+
+	// Returns the number of fields found, at most maxFields
+	int parseRawEvent(const char *data, RawEventField *fields, int maxFields);
+
+}
+
+#endif // TELLDUS_V8_RAW_EVENT_H
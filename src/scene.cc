@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <deque>
+#include <map>
+
+#include "errors.h"
+#include "scene.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	// 5 ms ticks, 256 slots: one turn of the wheel is 1.28 s, longer waits
+	// stay in their slot for as many turns as they need.
+	static const uint64_t TICK_NS = 5 * 1000 * 1000;
+	static const int WHEEL_SLOTS = 256;
+
+	struct scene {
+		int id;
+		vector<SceneStep> steps;
+		vector<int> results;
+		size_t next; // Next step to run
+		int priority;
+		void *waiter;
+		bool running; // A step is being sent right now
+		bool cancelled;
+		uint64_t expiryTick; // Only meaningful while in the wheel
+		uint64_t dueAt;
+	};
+
+	static uv_mutex_t sceneMutex;
+	static uv_cond_t sceneCond;
+	static vector<scene *> wheel[WHEEL_SLOTS];
+	static int wheelCount = 0;
+	static uint64_t currentTick = 0;
+	static uint64_t epoch;
+	static deque<scene *> ready; // Due, waiting for the runner
+	static map<int, scene *> scenes;
+	static int nextSceneId = 1;
+	static SceneStats stats;
+	static SceneStepRunner runStep;
+
+	// Finished scenes waiting to be handed back on the loop thread
+	static vector<scene *> done;
+	static uv_async_t doneHandle;
+	static SceneDoneCallback resolveScene;
+	static int outstanding = 0; // Only touched on the loop thread
+
+	static uint64_t tickAt(uint64_t time) {
+		return (time - epoch) / TICK_NS;
+	}
+
+	// Must be called with the scene mutex held
+	static void schedule(scene *s, uint64_t now) {
+		uint32_t delay = s->steps[s->next].delay;
+		s->dueAt = now + (uint64_t)delay * 1000 * 1000;
+		if (delay == 0) {
+			ready.push_back(s);
+			return;
+		}
+		// Round up, a step never runs early
+		s->expiryTick = tickAt(s->dueAt + TICK_NS - 1);
+		if (s->expiryTick <= currentTick) {
+			s->expiryTick = currentTick + 1;
+		}
+		wheel[s->expiryTick % WHEEL_SLOTS].push_back(s);
+		wheelCount++;
+	}
+
+	// Must be called with the scene mutex held
+	static void unschedule(scene *s) {
+		deque<scene *>::iterator it = find(ready.begin(), ready.end(), s);
+		if (it != ready.end()) {
+			ready.erase(it);
+			return;
+		}
+		vector<scene *> &slot = wheel[s->expiryTick % WHEEL_SLOTS];
+		vector<scene *>::iterator entry = find(slot.begin(), slot.end(), s);
+		if (entry != slot.end()) {
+			slot.erase(entry);
+			wheelCount--;
+		}
+	}
+
+	// Must be called with the scene mutex held
+	static void finish(scene *s) {
+		if (s->cancelled) {
+			stats.cancelled++;
+			for (size_t i = s->next; i < s->results.size(); i++) {
+				s->results[i] = ERROR_CANCELLED;
+			}
+		} else {
+			stats.completed++;
+		}
+		stats.active--;
+		scenes.erase(s->id);
+		done.push_back(s);
+		uv_async_send(&doneHandle);
+	}
+
+	// Moves everything that expired up to now from the wheel to the ready
+	// queue. Must be called with the scene mutex held.
+	static void advance(uint64_t now) {
+		uint64_t target = tickAt(now);
+		if (wheelCount == 0) {
+			// Nothing to expire, skip ahead instead of walking empty slots
+			currentTick = target;
+			return;
+		}
+		while (currentTick < target) {
+			currentTick++;
+			vector<scene *> &slot = wheel[currentTick % WHEEL_SLOTS];
+			size_t kept = 0;
+			for (size_t i = 0; i < slot.size(); i++) {
+				if (slot[i]->expiryTick <= currentTick) {
+					ready.push_back(slot[i]);
+					wheelCount--;
+				} else {
+					slot[kept++] = slot[i];
+				}
+			}
+			slot.resize(kept);
+		}
+	}
+
+	static void sceneRunner(void *arg) {
+		uv_mutex_lock(&sceneMutex);
+		for (;;) {
+			uint64_t now = uv_hrtime();
+			advance(now);
+
+			if (ready.empty()) {
+				if (wheelCount == 0) {
+					uv_cond_wait(&sceneCond, &sceneMutex);
+				} else {
+					uint64_t nextTickAt = epoch + (currentTick + 1) * TICK_NS;
+					uv_cond_timedwait(&sceneCond, &sceneMutex, nextTickAt - now);
+				}
+				continue;
+			}
+
+			scene *s = ready.front();
+			ready.pop_front();
+			s->running = true;
+
+			uint64_t started = uv_hrtime();
+			uint64_t late = started > s->dueAt ? started - s->dueAt : 0;
+			stats.lateTotal += late;
+			if (late > stats.lateMax) {
+				stats.lateMax = late;
+			}
+			stats.steps++;
+			const SceneStep &step = s->steps[s->next];
+			uv_mutex_unlock(&sceneMutex);
+
+			int result = runStep(step.method, step.deviceId, step.value, s->priority);
+
+			uv_mutex_lock(&sceneMutex);
+			s->results[s->next++] = result;
+			s->running = false;
+			if (s->cancelled || s->next == s->steps.size()) {
+				finish(s);
+			} else {
+				schedule(s, uv_hrtime());
+			}
+		}
+	}
+
+	static void afterDone(uv_async_t *handle) {
+		vector<scene *> finished;
+		uv_mutex_lock(&sceneMutex);
+		finished.swap(done);
+		uv_mutex_unlock(&sceneMutex);
+
+		for (size_t i = 0; i < finished.size(); i++) {
+			scene *s = finished[i];
+			resolveScene(s->waiter, s->id, s->results, s->cancelled);
+			delete s;
+			outstanding--;
+		}
+
+		// Only keep the loop alive while a scene is running
+		if (outstanding == 0) {
+			uv_unref((uv_handle_t *)&doneHandle);
+		}
+	}
+
+	void sceneInit(uv_loop_t *loop, SceneStepRunner runner, SceneDoneCallback resolve) {
+		uv_mutex_init(&sceneMutex);
+		uv_cond_init(&sceneCond);
+		stats = SceneStats();
+		runStep = runner;
+		resolveScene = resolve;
+		epoch = uv_hrtime();
+		uv_async_init(loop, &doneHandle, (uv_async_cb)afterDone);
+		uv_unref((uv_handle_t *)&doneHandle);
+
+		// Never joined, the runner lives as long as the process
+		uv_thread_t thread;
+		uv_thread_create(&thread, sceneRunner, NULL);
+	}
+
+	int sceneSubmit(const vector<SceneStep> &steps, int priority, void *waiter) {
+		scene *s = new scene;
+		s->steps = steps;
+		s->results.assign(steps.size(), ERROR_CANCELLED);
+		s->next = 0;
+		s->priority = priority;
+		s->waiter = waiter;
+		s->running = false;
+		s->cancelled = false;
+
+		if (outstanding++ == 0) {
+			uv_ref((uv_handle_t *)&doneHandle);
+		}
+
+		uv_mutex_lock(&sceneMutex);
+		s->id = nextSceneId++;
+		stats.submitted++;
+		stats.active++;
+		scenes[s->id] = s;
+		if (steps.empty()) {
+			finish(s);
+		} else {
+			advance(uv_hrtime());
+			schedule(s, uv_hrtime());
+			uv_cond_signal(&sceneCond);
+		}
+		int id = s->id;
+		uv_mutex_unlock(&sceneMutex);
+		return id;
+	}
+
+	bool sceneCancel(int sceneId) {
+		uv_mutex_lock(&sceneMutex);
+		map<int, scene *>::iterator it = scenes.find(sceneId);
+		if (it == scenes.end() || it->second->cancelled) {
+			uv_mutex_unlock(&sceneMutex);
+			return false;
+		}
+		scene *s = it->second;
+		s->cancelled = true;
+		if (!s->running) {
+			// Waiting for its next step, the runner finishes running ones itself
+			unschedule(s);
+			finish(s);
+		}
+		uv_mutex_unlock(&sceneMutex);
+		return true;
+	}
+
+	void sceneStats(SceneStats &out) {
+		uv_mutex_lock(&sceneMutex);
+		out = stats;
+		uv_mutex_unlock(&sceneMutex);
+	}
+
+}
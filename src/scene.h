@@ -0,0 +1,55 @@
+#ifndef TELLDUS_V8_SCENE_H
+#define TELLDUS_V8_SCENE_H
+
+#include <stdint.h>
+#include <uv.h>
+#include <vector>
+
+namespace telldus_v8 {
+
+	// Scenes are fixed sequences of commands with waits in between, run
+	// on a thread of their own so their timing doesn't depend on how busy
+	// the event loop is. Waits are kept in a hashed timer wheel, the delay
+	// of a step counts from the moment the step before it finished (or
+	// from submission for the first step).
+	//
+	// Results of all steps are handed back in one go once the scene is
+	// done, always on the loop thread.
+
+	struct SceneStep {
+		int method; // Worktype of a command (turnOn, dim, ...)
+		int deviceId;
+		int value;
+		uint32_t delay; // Milliseconds to wait before this step
+	};
+
+	// Runs a single step on the scene thread, returns the telldus-core result
+	typedef int (*SceneStepRunner)(int method, int deviceId, int value, int priority);
+
+	// results has one entry per step, steps that never ran hold ERROR_CANCELLED
+	typedef void (*SceneDoneCallback)(void *waiter, int sceneId, const std::vector<int> &results, bool cancelled);
+
+	struct SceneStats {
+		uint64_t submitted;
+		uint64_t completed;
+		uint64_t cancelled;
+		uint64_t steps;
+		uint64_t lateTotal; // Nanoseconds steps started after their due time, summed
+		uint64_t lateMax;
+		int active;
+	};
+
+	void sceneInit(uv_loop_t *loop, SceneStepRunner runner, SceneDoneCallback done);
+
+	// Loop thread only, returns the scene id
+	int sceneSubmit(const std::vector<SceneStep> &steps, int priority, void *waiter);
+
+	// Stops a scene before its next step, false if it already finished.
+	// A step that is being sent when this is called still completes.
+	bool sceneCancel(int sceneId);
+
+	void sceneStats(SceneStats &stats);
+
+}
+
+#endif // TELLDUS_V8_SCENE_H
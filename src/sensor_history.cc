@@ -0,0 +1,104 @@
+#include <limits>
+
+#include "sensor_history.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	void historyResize(SensorHistory &history, size_t capacity) {
+		size_t keep = history.count < capacity ? history.count : capacity;
+		size_t oldCapacity = history.timestamps.size();
+
+		vector<int32_t> timestamps(capacity);
+		vector<double> values(capacity);
+		for (size_t i = 0; i < keep; i++) {
+			size_t from = (history.head + history.count - keep + i) % oldCapacity;
+			timestamps[i] = history.timestamps[from];
+			values[i] = history.values[from];
+		}
+
+		history.timestamps.swap(timestamps);
+		history.values.swap(values);
+		history.head = 0;
+		history.count = keep;
+	}
+
+	void historyPush(SensorHistory &history, int ts, double value) {
+		size_t capacity = history.timestamps.size();
+		if (capacity == 0) {
+			return;
+		}
+		if (history.count > 0 && ts < history.timestamps[(history.head + history.count - 1) % capacity]) {
+			return;
+		}
+
+		size_t tail = (history.head + history.count) % capacity;
+		history.timestamps[tail] = ts;
+		history.values[tail] = value;
+		if (history.count < capacity) {
+			history.count++;
+		} else {
+			history.head = (history.head + 1) % capacity;
+		}
+	}
+
+	size_t historyRange(const SensorHistory &history, int from, int to, int32_t *timestamps, double *values, size_t max) {
+		size_t capacity = history.timestamps.size();
+		size_t found = 0;
+		for (size_t i = 0; i < history.count; i++) {
+			size_t index = (history.head + i) % capacity;
+			int ts = history.timestamps[index];
+			if (ts < from) {
+				continue;
+			}
+			if (ts >= to) {
+				break;
+			}
+			if (timestamps && found < max) {
+				timestamps[found] = ts;
+				values[found] = history.values[index];
+			}
+			found++;
+		}
+		return found;
+	}
+
+	void historyAggregate(const SensorHistory &history, int from, int bucketSize, size_t buckets,
+		int32_t *counts, double *min, double *max, double *avg) {
+		const double nan = numeric_limits<double>::quiet_NaN();
+		for (size_t i = 0; i < buckets; i++) {
+			counts[i] = 0;
+			min[i] = nan;
+			max[i] = nan;
+			avg[i] = 0;
+		}
+
+		size_t capacity = history.timestamps.size();
+		for (size_t i = 0; i < history.count; i++) {
+			size_t index = (history.head + i) % capacity;
+			int ts = history.timestamps[index];
+			if (ts < from) {
+				continue;
+			}
+			size_t bucket = (size_t)((int64_t)ts - from) / bucketSize;
+			if (bucket >= buckets) {
+				break;
+			}
+			double value = history.values[index];
+			if (counts[bucket] == 0 || value < min[bucket]) {
+				min[bucket] = value;
+			}
+			if (counts[bucket] == 0 || value > max[bucket]) {
+				max[bucket] = value;
+			}
+			avg[bucket] += value; // Summed here, divided below
+			counts[bucket]++;
+		}
+
+		for (size_t i = 0; i < buckets; i++) {
+			avg[i] = counts[i] ? avg[i] / counts[i] : nan;
+		}
+	}
+
+}
@@ -0,0 +1,38 @@
+#ifndef TELLDUS_V8_SENSOR_HISTORY_H
+#define TELLDUS_V8_SENSOR_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace telldus_v8 {
+
+	// Fixed size ring of (timestamp, value) samples for one sensor reading,
+	// oldest samples are overwritten once it is full. Samples are kept in
+	// timestamp order, anything older than the newest sample is ignored.
+	// Not thread safe, the sensor store locks around it.
+
+	struct SensorHistory {
+		std::vector<int32_t> timestamps;
+		std::vector<double> values;
+		size_t head; // Index of the oldest sample
+		size_t count;
+	};
+
+	// Keeps the newest samples that fit, a capacity of 0 drops everything
+	void historyResize(SensorHistory &history, size_t capacity);
+
+	void historyPush(SensorHistory &history, int ts, double value);
+
+	// Copies the samples with from <= ts < to, at most max of them, and
+	// returns how many there were. Pass null pointers to only count them.
+	size_t historyRange(const SensorHistory &history, int from, int to, int32_t *timestamps, double *values, size_t max);
+
+	// Downsamples into buckets of bucketSize seconds starting at from.
+	// Empty buckets get a count of 0 and NaN for min, max and avg.
+	void historyAggregate(const SensorHistory &history, int from, int bucketSize, size_t buckets,
+		int32_t *counts, double *min, double *max, double *avg);
+
+}
+
+#endif // TELLDUS_V8_SENSOR_HISTORY_H
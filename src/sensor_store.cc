@@ -0,0 +1,281 @@
+#include <map>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <uv.h>
+
+#include <telldus-core.h>
+
+#include "event_hub.h"
+#include "sensor_history.h"
+#include "sensor_store.h"
+
+using namespace std;
+
+namespace telldus_v8 {
+
+	// Open addressing with linear probing. Sensors never go away, so there
+	// are no deletions and no tombstones to worry about.
+	struct sensorSlot {
+		bool used;
+		uint32_t hash;
+		SensorReading reading;
+		SensorHistory *history; // Null until the first numeric reading
+	};
+
+	static const size_t INITIAL_CAPACITY = 64; // Power of two
+	static const size_t DEFAULT_HISTORY_SAMPLES = 2880; // 24 hours at one reading every 30 seconds
+
+	static uv_mutex_t storeMutex;
+	static vector<sensorSlot> table;
+	static size_t used = 0;
+	static size_t historySamples = DEFAULT_HISTORY_SAMPLES;
+	static map<string, size_t> historyLimits; // Per reading overrides, by limitKey
+
+	// Names as they are stored, cut to SENSOR_STRING_SIZE. Keys are cut the
+	// same way, or a long name would never match its own slot.
+	struct sensorName {
+		char protocol[SENSOR_STRING_SIZE];
+		char model[SENSOR_STRING_SIZE];
+
+		sensorName(const char *p, const char *m) {
+			copyEventString(protocol, SENSOR_STRING_SIZE, p);
+			copyEventString(model, SENSOR_STRING_SIZE, m);
+		}
+	};
+
+	static uint32_t fnv1a(uint32_t hash, const void *data, size_t length) {
+		const unsigned char *bytes = static_cast<const unsigned char *>(data);
+		for (size_t i = 0; i < length; i++) {
+			hash ^= bytes[i];
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	static uint32_t hashKey(const char *protocol, const char *model, int sensorId, int dataType) {
+		uint32_t hash = 2166136261u;
+		hash = fnv1a(hash, protocol, strlen(protocol) + 1);
+		hash = fnv1a(hash, model, strlen(model) + 1);
+		hash = fnv1a(hash, &sensorId, sizeof(sensorId));
+		return fnv1a(hash, &dataType, sizeof(dataType));
+	}
+
+	static string limitKey(const char *protocol, const char *model, int sensorId, int dataType) {
+		string key(protocol);
+		key.push_back('\0');
+		key.append(model);
+		key.push_back('\0');
+		key.append(reinterpret_cast<const char *>(&sensorId), sizeof(sensorId));
+		key.append(reinterpret_cast<const char *>(&dataType), sizeof(dataType));
+		return key;
+	}
+
+	// Must be called with the store mutex held
+	static size_t historyLimit(const SensorReading &reading) {
+		map<string, size_t>::const_iterator it = historyLimits.find(limitKey(reading.protocol, reading.model, reading.sensorId, reading.dataType));
+		return it == historyLimits.end() ? historySamples : it->second;
+	}
+
+	// Must be called with the store mutex held
+	static void record(sensorSlot &slot, const char *value, int ts) {
+		char *end;
+		double number = strtod(value, &end);
+		if (end == value || *end != '\0') {
+			return; // Not a number, nothing to chart
+		}
+		if (!slot.history) {
+			size_t limit = historyLimit(slot.reading);
+			if (limit == 0) {
+				return;
+			}
+			slot.history = new SensorHistory();
+			historyResize(*slot.history, limit);
+		}
+		historyPush(*slot.history, ts, number);
+	}
+
+	// Index of the key's slot, or of the empty slot it would go in.
+	// Must be called with the store mutex held.
+	static size_t probe(uint32_t hash, const char *protocol, const char *model, int sensorId, int dataType) {
+		size_t mask = table.size() - 1;
+		size_t i = hash & mask;
+		while (table[i].used) {
+			const SensorReading &reading = table[i].reading;
+			if (table[i].hash == hash && reading.sensorId == sensorId && reading.dataType == dataType
+				&& strcmp(reading.protocol, protocol) == 0 && strcmp(reading.model, model) == 0) {
+				break;
+			}
+			i = (i + 1) & mask;
+		}
+		return i;
+	}
+
+	// Must be called with the store mutex held
+	static void grow() {
+		vector<sensorSlot> old;
+		old.swap(table);
+		table.resize(old.size() * 2, sensorSlot());
+		for (size_t i = 0; i < old.size(); i++) {
+			if (old[i].used) {
+				const SensorReading &reading = old[i].reading;
+				table[probe(old[i].hash, reading.protocol, reading.model, reading.sensorId, reading.dataType)] = old[i];
+			}
+		}
+	}
+
+	void sensorStoreSeed() {
+		char protocol[SENSOR_STRING_SIZE];
+		char model[SENSOR_STRING_SIZE];
+		int sensorId, dataTypes;
+
+		while (tdSensor(protocol, sizeof(protocol), model, sizeof(model), &sensorId, &dataTypes) == TELLSTICK_SUCCESS) {
+			for (int dataType = TELLSTICK_TEMPERATURE; dataType <= TELLSTICK_WINDGUST; dataType <<= 1) {
+				if (!(dataTypes & dataType)) {
+					continue;
+				}
+				char value[SENSOR_STRING_SIZE];
+				int ts = 0;
+				if (tdSensorValue(protocol, model, sensorId, dataType, value, sizeof(value), &ts) == TELLSTICK_SUCCESS) {
+					sensorStoreUpdate(protocol, model, sensorId, dataType, value, ts);
+				}
+			}
+		}
+	}
+
+	void sensorStoreInit() {
+		uv_mutex_init(&storeMutex);
+		table.resize(INITIAL_CAPACITY, sensorSlot());
+	}
+
+
+	void sensorStoreUpdate(const char *protocol, const char *model, int sensorId, int dataType, const char *value, int ts) {
+		if (!protocol || !model || !value) {
+			return;
+		}
+		sensorName name(protocol, model);
+		uint32_t hash = hashKey(name.protocol, name.model, sensorId, dataType);
+
+		uv_mutex_lock(&storeMutex);
+		size_t i = probe(hash, name.protocol, name.model, sensorId, dataType);
+		if (!table[i].used) {
+			// Keep the load factor below 0.7
+			if ((used + 1) * 10 > table.size() * 7) {
+				grow();
+				i = probe(hash, name.protocol, name.model, sensorId, dataType);
+			}
+			sensorSlot &slot = table[i];
+			slot.used = true;
+			slot.hash = hash;
+			memcpy(slot.reading.protocol, name.protocol, SENSOR_STRING_SIZE);
+			memcpy(slot.reading.model, name.model, SENSOR_STRING_SIZE);
+			slot.reading.sensorId = sensorId;
+			slot.reading.dataType = dataType;
+			slot.reading.ts = ts - 1; // Never newer than the reading being stored
+			slot.history = 0;
+			used++;
+		}
+		SensorReading &reading = table[i].reading;
+		if (ts >= reading.ts) {
+			copyEventString(reading.value, SENSOR_STRING_SIZE, value);
+			reading.ts = ts;
+			record(table[i], value, ts);
+		}
+		uv_mutex_unlock(&storeMutex);
+	}
+
+	bool sensorStoreLookup(const char *protocol, const char *model, int sensorId, int dataType, SensorReading &reading) {
+		sensorName name(protocol, model);
+		uint32_t hash = hashKey(name.protocol, name.model, sensorId, dataType);
+
+		uv_mutex_lock(&storeMutex);
+		size_t i = probe(hash, name.protocol, name.model, sensorId, dataType);
+		bool found = table[i].used;
+		if (found) {
+			reading = table[i].reading;
+		}
+		uv_mutex_unlock(&storeMutex);
+		return found;
+	}
+
+	void sensorStoreSnapshot(vector<SensorReading> &readings) {
+		uv_mutex_lock(&storeMutex);
+		readings.clear();
+		readings.reserve(used);
+		for (size_t i = 0; i < table.size(); i++) {
+			if (table[i].used) {
+				readings.push_back(table[i].reading);
+			}
+		}
+		uv_mutex_unlock(&storeMutex);
+	}
+
+	void sensorHistorySetDefault(size_t samples) {
+		uv_mutex_lock(&storeMutex);
+		historySamples = samples;
+		for (size_t i = 0; i < table.size(); i++) {
+			if (table[i].history) {
+				historyResize(*table[i].history, historyLimit(table[i].reading));
+			}
+		}
+		uv_mutex_unlock(&storeMutex);
+	}
+
+	void sensorHistorySetLimit(const char *protocol, const char *model, int sensorId, int dataType, size_t samples) {
+		sensorName name(protocol, model);
+		uint32_t hash = hashKey(name.protocol, name.model, sensorId, dataType);
+
+		uv_mutex_lock(&storeMutex);
+		historyLimits[limitKey(name.protocol, name.model, sensorId, dataType)] = samples;
+		size_t i = probe(hash, name.protocol, name.model, sensorId, dataType);
+		if (table[i].used && table[i].history) {
+			historyResize(*table[i].history, samples);
+		}
+		uv_mutex_unlock(&storeMutex);
+	}
+
+	size_t sensorHistoryRange(const char *protocol, const char *model, int sensorId, int dataType,
+		int from, int to, int32_t *timestamps, double *values, size_t max) {
+		sensorName name(protocol, model);
+		uint32_t hash = hashKey(name.protocol, name.model, sensorId, dataType);
+
+		uv_mutex_lock(&storeMutex);
+		size_t i = probe(hash, name.protocol, name.model, sensorId, dataType);
+		size_t found = 0;
+		if (table[i].used && table[i].history) {
+			found = historyRange(*table[i].history, from, to, timestamps, values, max);
+		}
+		uv_mutex_unlock(&storeMutex);
+		return found;
+	}
+
+	void sensorHistoryAggregate(const char *protocol, const char *model, int sensorId, int dataType,
+		int from, int bucketSize, size_t buckets, int32_t *counts, double *min, double *max, double *avg) {
+		sensorName name(protocol, model);
+		uint32_t hash = hashKey(name.protocol, name.model, sensorId, dataType);
+		SensorHistory none = SensorHistory();
+
+		uv_mutex_lock(&storeMutex);
+		size_t i = probe(hash, name.protocol, name.model, sensorId, dataType);
+		const SensorHistory *history = table[i].used && table[i].history ? table[i].history : &none;
+		historyAggregate(*history, from, bucketSize, buckets, counts, min, max, avg);
+		uv_mutex_unlock(&storeMutex);
+	}
+
+	void sensorHistoryStats(SensorHistoryStats &stats) {
+		uv_mutex_lock(&storeMutex);
+		stats = SensorHistoryStats();
+		stats.defaultSamples = historySamples;
+		for (size_t i = 0; i < table.size(); i++) {
+			const SensorHistory *history = table[i].history;
+			if (table[i].used && history) {
+				stats.sensors++;
+				stats.samples += history->count;
+				stats.bytes += history->timestamps.size() * (sizeof(int32_t) + sizeof(double));
+			}
+		}
+		uv_mutex_unlock(&storeMutex);
+	}
+
+}
@@ -0,0 +1,70 @@
+#ifndef TELLDUS_V8_SENSOR_STORE_H
+#define TELLDUS_V8_SENSOR_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace telldus_v8 {
+
+	// Last known value of every sensor reading, keyed by (protocol, model,
+	// sensor id, data type). Seeded from telldusd when attached and kept
+	// up to date from sensor events on the callback thread, so lookups
+	// are answered from memory.
+	//
+	// Numeric readings also get a history ring (see sensor_history.h),
+	// sized by a global default that can be overridden per reading.
+
+	const int SENSOR_STRING_SIZE = 32;
+
+	struct SensorReading {
+		char protocol[SENSOR_STRING_SIZE];
+		char model[SENSOR_STRING_SIZE];
+		int sensorId;
+		int dataType; // One of TELLSTICK_TEMPERATURE, TELLSTICK_HUMIDITY, ...
+		char value[SENSOR_STRING_SIZE];
+		int ts;
+	};
+
+	void sensorStoreInit();
+
+	// Fills the store from telldusd. Call once sensor events are coming
+	// in, a reading that arrives while seeding is then either seen as an
+	// event or newer than what tdSensorValue returned.
+	void sensorStoreSeed();
+
+	// Newer readings win, safe to call from any thread. Sensor events are
+	// fed in here from the addon's single registration.
+	void sensorStoreUpdate(const char *protocol, const char *model, int sensorId, int dataType, const char *value, int ts);
+
+	bool sensorStoreLookup(const char *protocol, const char *model, int sensorId, int dataType, SensorReading &reading);
+
+	// All readings, in no particular order
+	void sensorStoreSnapshot(std::vector<SensorReading> &readings);
+
+	struct SensorHistoryStats {
+		size_t defaultSamples;
+		size_t sensors; // Readings with a history ring
+		size_t samples; // Stored across all rings
+		size_t bytes; // Allocated for all rings
+	};
+
+	// Samples kept per reading unless overridden, applies to existing rings too
+	void sensorHistorySetDefault(size_t samples);
+
+	// Per reading override, also for readings that haven't been seen yet
+	void sensorHistorySetLimit(const char *protocol, const char *model, int sensorId, int dataType, size_t samples);
+
+	// See historyRange, returns 0 for unknown readings
+	size_t sensorHistoryRange(const char *protocol, const char *model, int sensorId, int dataType,
+		int from, int to, int32_t *timestamps, double *values, size_t max);
+
+	// See historyAggregate, unknown readings give all empty buckets
+	void sensorHistoryAggregate(const char *protocol, const char *model, int sensorId, int dataType,
+		int from, int bucketSize, size_t buckets, int32_t *counts, double *min, double *max, double *avg);
+
+	void sensorHistoryStats(SensorHistoryStats &stats);
+
+}
+
+#endif // TELLDUS_V8_SENSOR_STORE_H
@@ -3,664 +3,2622 @@
 #endif // BUILDING_NODE_EXTENSION
 
 #include <cstdlib>
+#include <ctime>
+#include <limits>
+#include <map>
 #include <string.h>
-#include <list>
+#include <vector>
 #include <uv.h>
 #include <node.h>
 #include <v8.h>
 
 #include <telldus-core.h>
 
+#include "src/airtime.h"
+#include "src/breaker.h"
+#include "src/command_queue.h"
+#include "src/dedup.h"
+#include "src/device_versions.h"
+#include "src/devices.h"
+#include "src/errors.h"
+#include "src/event_filter.h"
+#include "src/event_hub.h"
+#include "src/executor.h"
+#include "src/journal.h"
+#include "src/listeners.h"
+#include "src/metadata_cache.h"
+#include "src/operations.h"
+#include "src/pool.h"
+#include "src/provision.h"
+#include "src/scene.h"
+#include "src/sensor_store.h"
+
 using namespace v8;
 using namespace node;
 using namespace std;
 
 namespace telldus_v8 {
 
-	struct EventContext {
-		v8::Persistent<v8::Function, v8::CopyablePersistentTraits<v8::Function> > callback;
+	// Property names and enum-like values handed to JavaScript over and
+	// over, created once in init and kept for the life of the isolate
+#define INTERNED_STRINGS(X) \
+	X(STRING_NAME, "name") \
+	X(STRING_ID, "id") \
+	X(STRING_METHODS, "methods") \
+	X(STRING_MODEL, "model") \
+	X(STRING_PROTOCOL, "protocol") \
+	X(STRING_TYPE, "type") \
+	X(STRING_STATUS, "status") \
+	X(STRING_LEVEL, "level") \
+	X(STRING_VALUE, "value") \
+	X(STRING_TIMESTAMP, "timestamp") \
+	X(STRING_CONTROLLER_ID, "controllerId") \
+	X(STRING_DATA, "data") \
+	X(STRING_TURNON, "TURNON") \
+	X(STRING_TURNOFF, "TURNOFF") \
+	X(STRING_BELL, "BELL") \
+	X(STRING_TOGGLE, "TOGGLE") \
+	X(STRING_DIM, "DIM") \
+	X(STRING_UP, "UP") \
+	X(STRING_DOWN, "DOWN") \
+	X(STRING_STOP, "STOP") \
+	X(STRING_LEARN, "LEARN") \
+	X(STRING_ON, "ON") \
+	X(STRING_OFF, "OFF") \
+	X(STRING_STATUS_UNKNOWN, "UNNKOWN") \
+	X(STRING_DEVICE, "DEVICE") \
+	X(STRING_GROUP, "GROUP") \
+	X(STRING_SCENE, "SCENE") \
+	X(STRING_UNKNOWN, "UNKNOWN")
+
+	enum InternedString {
+#define X(id, value) id,
+		INTERNED_STRINGS(X)
+#undef X
+		STRING_COUNT
 	};
 
-	struct DeviceEventBaton {
-		EventContext *eventContext;
-		int deviceId;
-		int lastSentCommand;
-		int levelNum;
-		const char * data;
-	};
+	Eternal<String> internedStrings[STRING_COUNT];
 
-	struct SensorEventBaton {
-		EventContext *eventContext;
-		int sensorId;
-		char *model;
-		char *protocol;
-		char *value;
-		int ts;
-		int dataType;
+	inline Local<String> Interned(Isolate* isolate, InternedString string) {
+		return internedStrings[string].Get(isolate);
+	}
+
+	// Objects of the same kind are created from one template, with all
+	// their properties in place, so they share a single shape
+	enum ObjectShape {
+		SHAPE_DEVICE,
+		SHAPE_STATUS,
+		SHAPE_DIM_STATUS,
+		SHAPE_DEVICE_EVENT,
+		SHAPE_SENSOR_EVENT,
+		SHAPE_RAW_EVENT,
+		SHAPE_COUNT
 	};
 
-	struct RawDeviceEventBaton {
-		EventContext *eventContext;
-		int controllerId;
-		char *data;
+	Eternal<ObjectTemplate> shapeTemplates[SHAPE_COUNT];
+
+	inline Local<Object> NewShaped(Isolate* isolate, ObjectShape shape) {
+		return shapeTemplates[shape].Get(isolate)->NewInstance();
+	}
+
+	void InitInterned(Isolate* isolate) {
+		static const char *values[STRING_COUNT] = {
+#define X(id, value) value,
+			INTERNED_STRINGS(X)
+#undef X
+		};
+		for (int i = 0; i < STRING_COUNT; i++) {
+			internedStrings[i].Set(isolate, v8::String::NewFromUtf8(isolate, values[i], v8::String::kInternalizedString));
+		}
+
+		static const InternedString device[] = { STRING_NAME, STRING_ID, STRING_METHODS, STRING_MODEL, STRING_PROTOCOL, STRING_TYPE, STRING_STATUS };
+		static const InternedString status[] = { STRING_NAME };
+		static const InternedString dimStatus[] = { STRING_NAME, STRING_LEVEL };
+		static const InternedString deviceEvent[] = { STRING_ID, STRING_STATUS, STRING_TIMESTAMP };
+		static const InternedString sensorEvent[] = { STRING_ID, STRING_MODEL, STRING_PROTOCOL, STRING_TYPE, STRING_VALUE, STRING_TIMESTAMP };
+		static const InternedString rawEvent[] = { STRING_CONTROLLER_ID, STRING_DATA };
+		static const struct { ObjectShape shape; const InternedString *keys; size_t count; } shapes[] = {
+			{ SHAPE_DEVICE, device, sizeof(device) / sizeof(device[0]) },
+			{ SHAPE_STATUS, status, sizeof(status) / sizeof(status[0]) },
+			{ SHAPE_DIM_STATUS, dimStatus, sizeof(dimStatus) / sizeof(dimStatus[0]) },
+			{ SHAPE_DEVICE_EVENT, deviceEvent, sizeof(deviceEvent) / sizeof(deviceEvent[0]) },
+			{ SHAPE_SENSOR_EVENT, sensorEvent, sizeof(sensorEvent) / sizeof(sensorEvent[0]) },
+			{ SHAPE_RAW_EVENT, rawEvent, sizeof(rawEvent) / sizeof(rawEvent[0]) }
+		};
+		for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+			Local<ObjectTemplate> shape = ObjectTemplate::New(isolate);
+			for (size_t k = 0; k < shapes[i].count; k++) {
+				shape->Set(Interned(isolate, shapes[i].keys[k]), Undefined(isolate));
+			}
+			shapeTemplates[shapes[i].shape].Set(isolate, shape);
+		}
+	}
+
+	struct methodName {
+		int method;
+		InternedString name;
 	};
 
-	const int SUPPORTED_METHODS =
-		TELLSTICK_TURNON
-		| TELLSTICK_TURNOFF
-		| TELLSTICK_BELL
-		| TELLSTICK_TOGGLE
-		| TELLSTICK_DIM
-		| TELLSTICK_LEARN
-		| TELLSTICK_EXECUTE
-		| TELLSTICK_UP
-		| TELLSTICK_DOWN
-		| TELLSTICK_STOP;
-
-	struct telldusDeviceInternals {
-		int supportedMethods;
-		int deviceType;
-		int lastSentCommand;
-		int level;
-		int id;
-		char *name;
-		char *model;
-		char *protocol;
+	const methodName METHOD_NAMES[] = {
+		{ TELLSTICK_TURNON, STRING_TURNON },
+		{ TELLSTICK_TURNOFF, STRING_TURNOFF },
+		{ TELLSTICK_BELL, STRING_BELL },
+		{ TELLSTICK_TOGGLE, STRING_TOGGLE },
+		{ TELLSTICK_DIM, STRING_DIM },
+		{ TELLSTICK_UP, STRING_UP },
+		{ TELLSTICK_DOWN, STRING_DOWN },
+		{ TELLSTICK_STOP, STRING_STOP },
+		{ TELLSTICK_LEARN, STRING_LEARN }
 	};
 
 	Local<Object> GetSupportedMethods(int id, int supportedMethods){
-		Isolate* isolate = Isolate::GetCurrent(); // returns NULL
-		if (!isolate) {
-			isolate = Isolate::New();
-			isolate->Enter();
-		}
+		Isolate* isolate = Isolate::GetCurrent();
 		Local<Array> methodsObj = Array::New(isolate);
 
 		int i = 0;
-		v8::String::NewFromUtf8(isolate, "42");
-		if (supportedMethods & TELLSTICK_TURNON)  methodsObj->Set(i++, v8::String::NewFromUtf8(isolate, ("TURNON")));
-		if (supportedMethods & TELLSTICK_TURNOFF) methodsObj->Set(i++, v8::String::NewFromUtf8(isolate, ("TURNOFF")));
-		if (supportedMethods & TELLSTICK_BELL) methodsObj->Set(i++, v8::String::NewFromUtf8(isolate, ("BELL")));
-		if (supportedMethods & TELLSTICK_TOGGLE) methodsObj->Set(i++, v8::String::NewFromUtf8(isolate, ("TOGGLE")));
-		if (supportedMethods & TELLSTICK_DIM)  methodsObj->Set(i++, v8::String::NewFromUtf8(isolate, ("DIM")));
-		if (supportedMethods & TELLSTICK_UP) methodsObj->Set(i++, v8::String::NewFromUtf8(isolate, ("UP")));
-		if (supportedMethods & TELLSTICK_DOWN) methodsObj->Set(i++, v8::String::NewFromUtf8(isolate, ("DOWN")));
-		if (supportedMethods & TELLSTICK_STOP) methodsObj->Set(i++, v8::String::NewFromUtf8(isolate, ("STOP")));
-		if (supportedMethods & TELLSTICK_LEARN) methodsObj->Set(i++, v8::String::NewFromUtf8(isolate, ("LEARN")));
+		for (size_t m = 0; m < sizeof(METHOD_NAMES) / sizeof(METHOD_NAMES[0]); m++) {
+			if (supportedMethods & METHOD_NAMES[m].method) {
+				methodsObj->Set(i++, Interned(isolate, METHOD_NAMES[m].name));
+			}
+		}
 
 		return methodsObj;
 
 	}
 
 	Local<String> GetDeviceType(int id, int type){
-		Isolate* isolate = Isolate::GetCurrent(); // returns NULL
-		if (!isolate) {
-			isolate = Isolate::New();
-			isolate->Enter();
-		}
+		Isolate* isolate = Isolate::GetCurrent();
 
-		if (type & TELLSTICK_TYPE_DEVICE) return v8::String::NewFromUtf8(isolate, ("DEVICE"));
-		if (type & TELLSTICK_TYPE_GROUP) return v8::String::NewFromUtf8(isolate, ("GROUP"));
-		if (type & TELLSTICK_TYPE_SCENE) return v8::String::NewFromUtf8(isolate, ("SCENE"));
+		if (type & TELLSTICK_TYPE_DEVICE) return Interned(isolate, STRING_DEVICE);
+		if (type & TELLSTICK_TYPE_GROUP) return Interned(isolate, STRING_GROUP);
+		if (type & TELLSTICK_TYPE_SCENE) return Interned(isolate, STRING_SCENE);
 
-		return v8::String::NewFromUtf8(isolate, ("UNKNOWN"));
+		return Interned(isolate, STRING_UNKNOWN);
 	}
 
 	Local<Object> GetDeviceStatus(int id, int lastSentCommand, int level){
-		Isolate* isolate = Isolate::GetCurrent(); // returns NULL
-		if (!isolate) {
-			isolate = Isolate::New();
-			isolate->Enter();
-		}
-		Local<Object> status = Object::New(isolate);
+		Isolate* isolate = Isolate::GetCurrent();
+		Local<Object> status;
 		switch (lastSentCommand) {
 		case TELLSTICK_TURNON:
-			status->Set(v8::String::NewFromUtf8(isolate, "name", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, ("ON")));
+			status = NewShaped(isolate, SHAPE_STATUS);
+			status->Set(Interned(isolate, STRING_NAME), Interned(isolate, STRING_ON));
 			break;
 		case TELLSTICK_TURNOFF:
-			status->Set(v8::String::NewFromUtf8(isolate, "name", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, ("OFF")));
+			status = NewShaped(isolate, SHAPE_STATUS);
+			status->Set(Interned(isolate, STRING_NAME), Interned(isolate, STRING_OFF));
 			break;
 		case TELLSTICK_DIM:
-			status->Set(v8::String::NewFromUtf8(isolate, "name", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, ("DIM")));
-			status->Set(v8::String::NewFromUtf8(isolate, "level", v8::String::kInternalizedString), v8::Number::New(isolate, level));
+			status = NewShaped(isolate, SHAPE_DIM_STATUS);
+			status->Set(Interned(isolate, STRING_NAME), Interned(isolate, STRING_DIM));
+			status->Set(Interned(isolate, STRING_LEVEL), v8::Number::New(isolate, level));
 			break;
 		default:
-			status->Set(v8::String::NewFromUtf8(isolate, "name", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, "UNNKOWN"));
+			status = NewShaped(isolate, SHAPE_STATUS);
+			status->Set(Interned(isolate, STRING_NAME), Interned(isolate, STRING_STATUS_UNKNOWN));
 		}
 
 		return status;
 
 	}
 
-	Local<Object> GetDevice(telldusDeviceInternals deviceInternals) {
-		Isolate* isolate = Isolate::GetCurrent(); // returns NULL
-		if (!isolate) {
-			isolate = Isolate::New();
-			isolate->Enter();
-		}
-		Local<Object> obj = Object::New(isolate);
-		obj->Set(v8::String::NewFromUtf8(isolate, "name", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, deviceInternals.name));
-		obj->Set(v8::String::NewFromUtf8(isolate, "id", v8::String::kInternalizedString), v8::Number::New(isolate, deviceInternals.id));
-		obj->Set(v8::String::NewFromUtf8(isolate, "methods", v8::String::kInternalizedString), GetSupportedMethods(deviceInternals.id, deviceInternals.supportedMethods));
-		obj->Set(v8::String::NewFromUtf8(isolate, "model", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, deviceInternals.model));
-		obj->Set(v8::String::NewFromUtf8(isolate, "protocol", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, deviceInternals.protocol));
-		obj->Set(v8::String::NewFromUtf8(isolate, "type", v8::String::kInternalizedString), GetDeviceType(deviceInternals.id, deviceInternals.deviceType));
-		obj->Set(v8::String::NewFromUtf8(isolate, "status", v8::String::kInternalizedString), GetDeviceStatus(deviceInternals.id, deviceInternals.lastSentCommand, deviceInternals.level));
-
-		// Cleanup
-		tdReleaseString(deviceInternals.name);
-		tdReleaseString(deviceInternals.model);
-		tdReleaseString(deviceInternals.protocol);
+	Local<Object> GetDevice(const telldusDeviceInternals &deviceInternals) {
+		Isolate* isolate = Isolate::GetCurrent();
+		Local<Object> obj = NewShaped(isolate, SHAPE_DEVICE);
+		obj->Set(Interned(isolate, STRING_NAME), v8::String::NewFromUtf8(isolate, deviceInternals.name.c_str()));
+		obj->Set(Interned(isolate, STRING_ID), v8::Number::New(isolate, deviceInternals.id));
+		obj->Set(Interned(isolate, STRING_METHODS), GetSupportedMethods(deviceInternals.id, deviceInternals.supportedMethods));
+		obj->Set(Interned(isolate, STRING_MODEL), v8::String::NewFromUtf8(isolate, deviceInternals.model.c_str()));
+		obj->Set(Interned(isolate, STRING_PROTOCOL), v8::String::NewFromUtf8(isolate, deviceInternals.protocol.c_str()));
+		obj->Set(Interned(isolate, STRING_TYPE), GetDeviceType(deviceInternals.id, deviceInternals.deviceType));
+		obj->Set(Interned(isolate, STRING_STATUS), GetDeviceStatus(deviceInternals.id, deviceInternals.lastSentCommand, deviceInternals.level));
 
 		return obj;
 
 	}
 
-	void getDevicesFromInternals(const v8::FunctionCallbackInfo<v8::Value>& args) {
-
-		/*list<telldusDeviceInternals> t = ((list<telldusDeviceInternals>) args[0]);
+	Local<Array> getDevicesFromInternals(const vector<telldusDeviceInternals> &deviceList) {
+		Isolate* isolate = Isolate::GetCurrent();
 
-		// Destination array
-		Local<Array> devices = Array::New(t.size());
-		int i=0;
-		for (list<telldusDeviceInternals>::const_iterator iterator = t.begin(), end = t.end(); iterator != end; ++iterator) {
-		devices->Set(i, GetDevice(*iterator));
-		i++;
+		// Destination array, built in one pass over the snapshot
+		Local<Array> devices = Array::New(isolate, deviceList.size());
+		for (size_t i = 0; i < deviceList.size(); i++) {
+			devices->Set(i, GetDevice(deviceList[i]));
 		}
-		info.GetReturnValue().Set(devices);*/
+
+		return devices;
 
 	}
 
-	telldusDeviceInternals getDeviceRaw(int idx) {
+	// Columns of the compact snapshot, one Int32Array each
+	enum CompactColumn {
+		COLUMN_ID,
+		COLUMN_METHODS,
+		COLUMN_TYPE,
+		COLUMN_LAST_COMMAND,
+		COLUMN_NAME,
+		COLUMN_MODEL,
+		COLUMN_PROTOCOL,
+		COLUMN_COUNT
+	};
 
-		telldusDeviceInternals deviceInternals;
+	const char *COMPACT_COLUMNS[COLUMN_COUNT] = { "ids", "methods", "types", "lastCommands", "names", "models", "protocols" };
 
-		deviceInternals.id = tdGetDeviceId(idx);
-		deviceInternals.name = tdGetName(deviceInternals.id);
-		deviceInternals.model = tdGetModel(deviceInternals.id);
-		deviceInternals.protocol = tdGetProtocol(deviceInternals.id);
+	// Index of str in the string table, added on first use
+	int32_t CompactString(Isolate* isolate, Local<Array> strings, map<string, int32_t> &index, const string &str) {
+		map<string, int32_t>::iterator it = index.find(str);
+		if (it != index.end()) {
+			return it->second;
+		}
+		int32_t position = (int32_t)index.size();
+		index[str] = position;
+		strings->Set(position, v8::String::NewFromUtf8(isolate, str.c_str()));
+		return position;
+	}
 
-		deviceInternals.supportedMethods = tdMethods(deviceInternals.id, SUPPORTED_METHODS);
-		deviceInternals.deviceType = tdGetDeviceType(deviceInternals.id);
-		deviceInternals.lastSentCommand = tdLastSentCommand(deviceInternals.id, SUPPORTED_METHODS);
+	// The same snapshot as getDevicesFromInternals as a handful of typed
+	// arrays, all views of one buffer. names, models and protocols index
+	// into strings, which holds every distinct value once.
+	Local<Object> getCompactDevicesFromInternals(const vector<telldusDeviceInternals> &deviceList) {
+		Isolate* isolate = Isolate::GetCurrent();
+		size_t count = deviceList.size();
+
+		Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, count * (COLUMN_COUNT * sizeof(int32_t) + sizeof(uint8_t)));
+		int32_t *columns = static_cast<int32_t *>(buffer->GetContents().Data());
+		uint8_t *levels = reinterpret_cast<uint8_t *>(columns + count * COLUMN_COUNT);
+
+		Local<Array> strings = Array::New(isolate);
+		map<string, int32_t> index;
+
+		for (size_t i = 0; i < count; i++) {
+			const telldusDeviceInternals &device = deviceList[i];
+			columns[COLUMN_ID * count + i] = device.id;
+			columns[COLUMN_METHODS * count + i] = device.supportedMethods;
+			columns[COLUMN_TYPE * count + i] = device.deviceType;
+			columns[COLUMN_LAST_COMMAND * count + i] = device.lastSentCommand;
+			columns[COLUMN_NAME * count + i] = CompactString(isolate, strings, index, device.name);
+			columns[COLUMN_MODEL * count + i] = CompactString(isolate, strings, index, device.model);
+			columns[COLUMN_PROTOCOL * count + i] = CompactString(isolate, strings, index, device.protocol);
+			levels[i] = (uint8_t)device.level;
+		}
 
-		if (deviceInternals.lastSentCommand == TELLSTICK_DIM) {
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "count", v8::String::kInternalizedString), Integer::New(isolate, count));
+		for (int c = 0; c < COLUMN_COUNT; c++) {
+			obj->Set(v8::String::NewFromUtf8(isolate, COMPACT_COLUMNS[c], v8::String::kInternalizedString), Int32Array::New(buffer, c * count * sizeof(int32_t), count));
+		}
+		obj->Set(v8::String::NewFromUtf8(isolate, "levels", v8::String::kInternalizedString), Uint8Array::New(buffer, COLUMN_COUNT * count * sizeof(int32_t), count));
+		obj->Set(v8::String::NewFromUtf8(isolate, "strings", v8::String::kInternalizedString), strings);
+		return obj;
+	}
 
-			char * levelStr = tdLastSentValue(deviceInternals.id);
+	// JavaScript listener, kept in the listener table of its stream
+	struct EventContext {
+		v8::Persistent<v8::Function, v8::CopyablePersistentTraits<v8::Function> > callback;
+		bool batch; // Called once per drained batch with an array of events
+		bool parse; // Raw events are handed over as objects rather than strings
+		EventFilter *filter; // Null if the listener wants everything
+	};
 
-			// Convert to number and add to object
-			deviceInternals.level = atoi(levelStr);
+	// Property names for the well known raw event keys, created once in init
+	Eternal<String> rawEventKeyNames[RAW_KEY_COUNT];
 
-			// Clean up the mess
-			tdReleaseString(levelStr);
+	// Batch listeners hit during one dispatch, with the array being built for each
+	struct pendingBatch {
+		int listenerId;
+		Local<Array> events;
+		uint32_t length;
+	};
 
+	// Our own telldus-core registration per stream, -1 while there is none.
+	// Device and sensor events also feed the addon's own bookkeeping
+	// (device versions, sensor store, journal), those streams are always on.
+	int streamCallbackIds[EVENT_STREAM_COUNT] = { -1, -1, -1 };
+	bool streamWanted[EVENT_STREAM_COUNT] = { true, true, false }; // Raw once a listener or the journal wants it
+	int deviceChangeCallbackId = -1;
+	bool streamsAttached = false; // Between AttachEventStreams and DetachEventStreams
+	uv_mutex_t streamCallbackMutex;
+
+	// Adds a listener to the event, a baton that is full is queued and the
+	// rest of the listeners go into the next one
+	template <typename T>
+	void AddEventListenerId(T &baton, int listenerId) {
+		EventListenerSet &set = baton.listeners;
+		if (set.count == EVENT_LISTENER_CHUNK) {
+			eventHubPush(baton);
+			set.count = 0;
+			set.part++;
 		}
+		set.ids[set.count++] = listenerId;
+	}
 
-		return deviceInternals;
+	void CallListener(Isolate* isolate, EventContext *ctx, int argc, Local<Value> argv[]) {
+		// This makes it possible to catch
+		// the exception from JavaScript land using the
+		// process.on('uncaughtException') event.
+		TryCatch try_catch;
 
-	}
+		v8::Local<v8::Function> func = v8::Local<v8::Function>::New(isolate, ctx->callback);
+		func->Call(isolate->GetCurrentContext()->Global(), argc, argv);
 
-	list<telldusDeviceInternals> getDevicesRaw() {
+		if (try_catch.HasCaught()) {
+			node::FatalException(try_catch);
+		}
+	}
 
-		int intNumberOfDevices = tdGetNumberOfDevices();
-		list<telldusDeviceInternals> deviceList;
+	void AppendToBatch(Isolate* isolate, vector<pendingBatch> &batches, int listenerId, Local<Object> event) {
+		for (size_t i = 0; i < batches.size(); i++) {
+			if (batches[i].listenerId == listenerId) {
+				batches[i].events->Set(batches[i].length++, event);
+				return;
+			}
+		}
+		pendingBatch batch;
+		batch.listenerId = listenerId;
+		batch.events = Array::New(isolate);
+		batch.events->Set(0, event);
+		batch.length = 1;
+		batches.push_back(batch);
+	}
 
-		for (int i = 0; i < intNumberOfDevices; i++) {
-			deviceList.push_back(getDeviceRaw(i));
+	void FlushBatches(Isolate* isolate, EventStream stream, vector<pendingBatch> &batches) {
+		for (size_t i = 0; i < batches.size(); i++) {
+			// Looked up again, an earlier listener may have removed this one
+			EventContext *ctx = listenerFind(stream, batches[i].listenerId);
+			if (ctx) {
+				Local<Value> args[] = { batches[i].events };
+				CallListener(isolate, ctx, 1, args);
+			}
 		}
+	}
 
-		return deviceList;
+	void DispatchDeviceEvents(DeviceEventBaton *events, size_t count) {
+		Isolate* isolate = Isolate::GetCurrent();
+		HandleScope scope(isolate);
+		vector<pendingBatch> batches;
+
+		for (size_t i = 0; i < count; i++) {
+			DeviceEventBaton *baton = &events[i];
+
+			Local<Value> args[] = {
+				Number::New(isolate, baton->deviceId),
+				GetDeviceStatus(baton->deviceId, baton->lastSentCommand, baton->levelNum),
+				Number::New(isolate, baton->ts)
+			};
+
+			// Built once, shared by every batch listener of this event
+			Local<Object> event;
+
+			for (int j = 0; j < baton->listeners.count; j++) {
+				int listenerId = baton->listeners.ids[j];
+				EventContext *ctx = listenerFind(EVENT_STREAM_DEVICE, listenerId);
+				if (!ctx) {
+					continue; // Removed since the event was queued
+				}
+				if (ctx->batch) {
+					if (event.IsEmpty()) {
+						event = NewShaped(isolate, SHAPE_DEVICE_EVENT);
+						event->Set(Interned(isolate, STRING_ID), args[0]);
+						event->Set(Interned(isolate, STRING_STATUS), args[1]);
+						event->Set(Interned(isolate, STRING_TIMESTAMP), args[2]);
+					}
+					AppendToBatch(isolate, batches, listenerId, event);
+				} else {
+					CallListener(isolate, ctx, 3, args);
+				}
+			}
+		}
 
+		FlushBatches(isolate, EVENT_STREAM_DEVICE, batches);
 	}
 
-	void DeviceEventCallbackWorking(uv_work_t *req) {
+	void DeviceEventCallback(int deviceId, int method, const char * data, int callbackId, void* callbackVoid) {
+		// Our own bookkeeping sees every event, repeats included
+		deviceVersionTouch(deviceId);
+		journalDeviceEvent(deviceId, method, data);
 
-		DeviceEventBaton *baton = static_cast<DeviceEventBaton *>(req->data);
+		DeviceEventBaton baton;
+		baton.deviceId = deviceId;
+		baton.ts = (int)time(0);
 
-		// Get Status
-		baton->lastSentCommand = tdLastSentCommand(baton->deviceId, SUPPORTED_METHODS);
-		baton->levelNum = 0;
-		char *level = 0;
+		// The event carries the command and its value, no need to ask
+		// telldusd for the last sent command (which may already be newer)
+		baton.lastSentCommand = method;
+		baton.levelNum = 0;
 
-		if (baton->lastSentCommand == TELLSTICK_DIM) {
+		if (method == TELLSTICK_DIM && data) {
+			baton.levelNum = atoi(data);
+		}
 
-			// Get level, returned from telldus-core as char
-			level = tdLastSentValue(baton->deviceId);
+		uint64_t hash = dedupHash(DEDUP_HASH_SEED, &deviceId, sizeof(deviceId));
+		hash = dedupHash(hash, &method, sizeof(method));
+		hash = dedupHash(hash, data ? data : "", data ? strlen(data) : 0);
+		if (dedupRepeat(EVENT_STREAM_DEVICE, hash)) {
+			eventHubSuppressed(EVENT_STREAM_DEVICE);
+			return;
+		}
 
-			// Convert to number and add to object
-			baton->levelNum = atoi(level);
+		// One baton for all listeners, carrying the ids of those that want it
+		baton.listeners.count = 0;
+		baton.listeners.part = 0;
+		uint64_t rejected = 0;
+		const vector<ListenerEntry> &listeners = listenersLock(EVENT_STREAM_DEVICE);
+		for (size_t i = 0; i < listeners.size(); i++) {
+			const ListenerEntry &listener = listeners[i];
+			if (listener.filter && !eventFilterDevice(*listener.filter, deviceId, method, baton.levelNum)) {
+				rejected++;
+				continue;
+			}
+			AddEventListenerId(baton, listener.id);
+		}
+		listenersUnlock(EVENT_STREAM_DEVICE);
 
-			// Clean up the mess
-			tdReleaseString(level);
+		if (rejected) {
+			eventHubFiltered(EVENT_STREAM_DEVICE, rejected);
+		}
+		if (baton.listeners.count > 0) {
+			eventHubPush(baton);
+		}
+	}
 
+	// Read a list of numbers from an Array or Int32Array
+	bool GetIntList(Local<Value> value, vector<int> &list) {
+		if (value->IsInt32Array()) {
+			Local<Int32Array> array = Local<Int32Array>::Cast(value);
+			const int32_t *data = reinterpret_cast<const int32_t *>(static_cast<char *>(array->Buffer()->GetContents().Data()) + array->ByteOffset());
+			list.assign(data, data + array->Length());
+			return true;
 		}
+		if (value->IsArray()) {
+			Local<Array> array = Local<Array>::Cast(value);
+			list.resize(array->Length());
+			for (uint32_t i = 0; i < array->Length(); i++) {
+				list[i] = array->Get(i)->Int32Value();
+			}
+			return true;
+		}
+		return false;
+	}
 
+	Local<Int32Array> NewInt32Array(Isolate* isolate, const vector<int> &list) {
+		Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, list.size() * sizeof(int32_t));
+		if (!list.empty()) {
+			memcpy(buffer->GetContents().Data(), &list[0], list.size() * sizeof(int32_t));
+		}
+		return Int32Array::New(buffer, 0, list.size());
+	}
 
+	// A single string or an array of them
+	void GetStringList(Local<Value> value, vector<std::string> &list) {
+		if (value->IsString()) {
+			list.push_back(*v8::String::Utf8Value(value));
+		} else if (value->IsArray()) {
+			Local<Array> array = Local<Array>::Cast(value);
+			for (uint32_t i = 0; i < array->Length(); i++) {
+				list.push_back(*v8::String::Utf8Value(array->Get(i)));
+			}
+		}
 	}
 
-	void DeviceEventCallbackAfter(uv_work_t *req, int status) {
+	// Listener filter from the filter option, null if there is nothing to filter on
+	EventFilter* NewEventFilter(Isolate* isolate, Local<Object> spec) {
+		EventFilter *filter = new EventFilter();
 
-		Isolate* isolate = Isolate::GetCurrent();
+		Local<Value> ids = spec->Get(v8::String::NewFromUtf8(isolate, "deviceIds", v8::String::kInternalizedString));
+		if (!ids->IsUndefined()) {
+			GetIntList(ids, filter->deviceIds);
+		}
+		Local<Value> methods = spec->Get(v8::String::NewFromUtf8(isolate, "methods", v8::String::kInternalizedString));
+		if (!methods->IsUndefined()) {
+			GetIntList(methods, filter->methods);
+		}
 
-		DeviceEventBaton *baton = static_cast<DeviceEventBaton *>(req->data);
-		EventContext *ctx = static_cast<EventContext *>(baton->eventContext);
-		v8::Local<v8::Function> func = v8::Local<v8::Function>::New(isolate, ((v8::Persistent<v8::Function, v8::CopyablePersistentTraits<v8::Function> >)ctx->callback));
+		Local<Value> sensors = spec->Get(v8::String::NewFromUtf8(isolate, "sensors", v8::String::kInternalizedString));
+		if (sensors->IsArray()) {
+			Local<Array> list = Local<Array>::Cast(sensors);
+			for (uint32_t i = 0; i < list->Length(); i++) {
+				if (!list->Get(i)->IsObject()) {
+					continue;
+				}
+				Local<Object> sensor = list->Get(i)->ToObject();
+				Local<Value> protocol = sensor->Get(v8::String::NewFromUtf8(isolate, "protocol", v8::String::kInternalizedString));
+				Local<Value> model = sensor->Get(v8::String::NewFromUtf8(isolate, "model", v8::String::kInternalizedString));
+				Local<Value> id = sensor->Get(v8::String::NewFromUtf8(isolate, "id", v8::String::kInternalizedString));
+				Local<Value> dataType = sensor->Get(v8::String::NewFromUtf8(isolate, "dataType", v8::String::kInternalizedString));
+
+				SensorMatch match;
+				match.protocol = protocol->IsString() ? *v8::String::Utf8Value(protocol) : "";
+				match.model = model->IsString() ? *v8::String::Utf8Value(model) : "";
+				match.sensorId = id->IsNumber() ? id->Int32Value() : -1;
+				match.dataType = dataType->IsNumber() ? dataType->Int32Value() : 0;
+				filter->sensors.push_back(match);
+			}
+		}
 
-		Local<Value> args[] = {
-			Number::New(isolate, baton->deviceId),
-			GetDeviceStatus(baton->deviceId, baton->lastSentCommand, baton->levelNum),
-		};
+		GetStringList(spec->Get(v8::String::NewFromUtf8(isolate, "class", v8::String::kInternalizedString)), filter->rawClasses);
+		GetStringList(spec->Get(v8::String::NewFromUtf8(isolate, "protocol", v8::String::kInternalizedString)), filter->rawProtocols);
+		GetStringList(spec->Get(v8::String::NewFromUtf8(isolate, "model", v8::String::kInternalizedString)), filter->rawModels);
 
-		func->Call(isolate->GetCurrentContext()->Global(), 2, args);
+		Local<Value> deadband = spec->Get(v8::String::NewFromUtf8(isolate, "deadband", v8::String::kInternalizedString));
+		filter->deadband = deadband->IsNumber() ? deadband->NumberValue() : 0;
 
-		delete baton;
-		delete req;
+		if (filter->deviceIds.empty() && filter->methods.empty() && filter->sensors.empty() && filter->rawClasses.empty()
+			&& filter->rawProtocols.empty() && filter->rawModels.empty() && filter->deadband <= 0) {
+			// Matches everything, spare the callback thread the checks
+			delete filter;
+			return 0;
+		}
 
+		eventFilterPrepare(*filter);
+		return filter;
 	}
 
-	void DeviceEventCallback(int deviceId, int method, const char * data, int callbackId, void* callbackVoid) {
+	EventContext* NewEventContext(const v8::FunctionCallbackInfo<v8::Value>& args, bool batch) {
+		Isolate* isolate = Isolate::GetCurrent();
 
-		EventContext *ctx = static_cast<EventContext *>(callbackVoid);
-		DeviceEventBaton *baton = new DeviceEventBaton();
+		if (!args[0]->IsFunction()) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected 1 argument: (function callback)"));
+			isolate->ThrowException(exception);
+			return 0;
+		}
 
-		baton->eventContext = ctx;
-		baton->deviceId = deviceId;
-		//baton->data = data;
+		EventContext *ctx = new EventContext();
+		ctx->callback.Reset(isolate, v8::Local<v8::Function>::Cast(args[0]));
+		ctx->batch = batch;
+		ctx->parse = false;
+		ctx->filter = 0;
+
+		// Optional second argument, listener options
+		if (args[1]->IsObject()) {
+			Local<Object> options = args[1]->ToObject();
+			ctx->parse = options->Get(v8::String::NewFromUtf8(isolate, "parse", v8::String::kInternalizedString))->BooleanValue();
+			Local<Value> filter = options->Get(v8::String::NewFromUtf8(isolate, "filter", v8::String::kInternalizedString));
+			if (filter->IsObject()) {
+				ctx->filter = NewEventFilter(isolate, filter->ToObject());
+			}
+		}
 
-		uv_work_t* req = new uv_work_t;
-		req->data = baton;
+		return ctx;
+	}
 
-		uv_queue_work(uv_default_loop(), req, (uv_work_cb)DeviceEventCallbackWorking, (uv_after_work_cb)DeviceEventCallbackAfter);
+	void ReleaseEventContext(EventContext *ctx) {
+		ctx->callback.Reset();
+		eventFilterFree(ctx->filter);
+		delete ctx;
 	}
 
-	void addDeviceEventListener(const v8::FunctionCallbackInfo<v8::Value>& args){
+	void DispatchSensorEvents(SensorEventBaton *events, size_t count) {
 		Isolate* isolate = Isolate::GetCurrent();
+		HandleScope scope(isolate);
+		vector<pendingBatch> batches;
+
+		for (size_t i = 0; i < count; i++) {
+			SensorEventBaton *baton = &events[i];
+
+			Local<Value> args[] = {
+				Number::New(isolate, baton->sensorId),
+				v8::String::NewFromUtf8(isolate, baton->model),
+				v8::String::NewFromUtf8(isolate, baton->protocol),
+				Number::New(isolate, baton->dataType),
+				v8::String::NewFromUtf8(isolate, baton->value),
+				Number::New(isolate, baton->ts)
+			};
+
+			Local<Object> event;
+
+			for (int j = 0; j < baton->listeners.count; j++) {
+				int listenerId = baton->listeners.ids[j];
+				EventContext *ctx = listenerFind(EVENT_STREAM_SENSOR, listenerId);
+				if (!ctx) {
+					continue;
+				}
+				if (ctx->batch) {
+					if (event.IsEmpty()) {
+						event = NewShaped(isolate, SHAPE_SENSOR_EVENT);
+						event->Set(Interned(isolate, STRING_ID), args[0]);
+						event->Set(Interned(isolate, STRING_MODEL), args[1]);
+						event->Set(Interned(isolate, STRING_PROTOCOL), args[2]);
+						event->Set(Interned(isolate, STRING_TYPE), args[3]);
+						event->Set(Interned(isolate, STRING_VALUE), args[4]);
+						event->Set(Interned(isolate, STRING_TIMESTAMP), args[5]);
+					}
+					AppendToBatch(isolate, batches, listenerId, event);
+				} else {
+					CallListener(isolate, ctx, 6, args);
+				}
+			}
+		}
 
-		v8::Local<v8::Function> cb = v8::Local<v8::Function>::Cast(args[0]);
-		v8::Persistent<v8::Function, v8::CopyablePersistentTraits<v8::Function> > value(isolate, cb);
+		FlushBatches(isolate, EVENT_STREAM_SENSOR, batches);
+	}
 
-		EventContext *ctx = new EventContext();
-		ctx->callback = value;
+	void SensorEventCallback(const char *protocol, const char *model, int sensorId, int dataType, const char *value, int ts, int callbackId, void *callbackVoid) {
+		sensorStoreUpdate(protocol, model, sensorId, dataType, value, ts);
+		journalSensorEvent(protocol, model, sensorId, dataType, value, ts);
+
+		// ts is when telldusd got the packet, it can differ between repeats
+		uint64_t hash = dedupHash(DEDUP_HASH_SEED, protocol ? protocol : "", protocol ? strlen(protocol) + 1 : 0);
+		hash = dedupHash(hash, model ? model : "", model ? strlen(model) + 1 : 0);
+		hash = dedupHash(hash, &sensorId, sizeof(sensorId));
+		hash = dedupHash(hash, &dataType, sizeof(dataType));
+		hash = dedupHash(hash, value ? value : "", value ? strlen(value) : 0);
+		if (dedupRepeat(EVENT_STREAM_SENSOR, hash)) {
+			eventHubSuppressed(EVENT_STREAM_SENSOR);
+			return;
+		}
 
-		if (!args[0]->IsFunction()) {
-			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected 1 argument: (function callback)"));
-			isolate->ThrowException(exception);
+		SensorEventBaton baton;
+		baton.listeners.count = 0;
+		baton.listeners.part = 0;
+		uint64_t rejected = 0;
+		const vector<ListenerEntry> &listeners = listenersLock(EVENT_STREAM_SENSOR);
+		for (size_t i = 0; i < listeners.size(); i++) {
+			const ListenerEntry &listener = listeners[i];
+			if (listener.filter && !eventFilterSensor(*listener.filter, protocol ? protocol : "", model ? model : "", sensorId, dataType, value ? value : "")) {
+				rejected++;
+				continue;
+			}
+			AddEventListenerId(baton, listener.id);
+		}
+		listenersUnlock(EVENT_STREAM_SENSOR);
+
+		if (rejected) {
+			eventHubFiltered(EVENT_STREAM_SENSOR, rejected);
+		}
+		if (baton.listeners.count == 0) {
+			return;
 		}
 
-		Local<Number> num = Number::New(isolate, tdRegisterDeviceEvent((TDDeviceEvent)&DeviceEventCallback, ctx));
-		args.GetReturnValue().Set(num);
+		baton.sensorId = sensorId;
+		baton.ts = ts;
+		baton.dataType = dataType;
+		copyEventString(baton.protocol, sizeof(baton.protocol), protocol);
+		copyEventString(baton.model, sizeof(baton.model), model);
+		copyEventString(baton.value, sizeof(baton.value), value);
+
+		eventHubPush(baton);
 	}
 
-	void SensorEventCallbackWorking(uv_work_t *req) { }
+	Local<Object> GetRawEvent(Isolate* isolate, const RawDeviceEventBaton *baton) {
+		Local<Object> obj = Object::New(isolate);
+
+		for (int i = 0; i < baton->fieldCount; i++) {
+			const RawEventField &field = baton->fields[i];
+
+			Local<String> key;
+			if (field.key == RAW_KEY_OTHER) {
+				key = v8::String::NewFromUtf8(isolate, baton->data + field.keyOffset, v8::String::kInternalizedString, field.keyLength);
+			} else {
+				key = rawEventKeyNames[field.key].Get(isolate);
+			}
+
+			if (field.isNumber) {
+				obj->Set(key, Number::New(isolate, field.number));
+			} else {
+				obj->Set(key, v8::String::NewFromUtf8(isolate, baton->data + field.valueOffset, v8::String::kNormalString, field.valueLength));
+			}
+		}
+
+		return obj;
+	}
 
-	void SensorEventCallbackAfter(uv_work_t *req, int status) {
+	void DispatchRawDeviceEvents(RawDeviceEventBaton *events, size_t count) {
 		Isolate* isolate = Isolate::GetCurrent();
+		HandleScope scope(isolate);
+		vector<pendingBatch> batches;
+
+		for (size_t i = 0; i < count; i++) {
+			RawDeviceEventBaton *baton = &events[i];
+
+			Local<Value> controllerId = Number::New(isolate, baton->controllerId);
+
+			// The string and the parsed form are each built at most once,
+			// index 0 is the string, 1 the parsed object
+			Local<Value> data[2];
+			Local<Object> event[2];
+
+			for (int j = 0; j < baton->listeners.count; j++) {
+				int listenerId = baton->listeners.ids[j];
+				EventContext *ctx = listenerFind(EVENT_STREAM_RAW, listenerId);
+				if (!ctx) {
+					continue;
+				}
+				int form = ctx->parse ? 1 : 0;
+				if (data[form].IsEmpty()) {
+					data[form] = ctx->parse ? Local<Value>(GetRawEvent(isolate, baton)) : Local<Value>(v8::String::NewFromUtf8(isolate, baton->data));
+				}
+				if (ctx->batch) {
+					if (event[form].IsEmpty()) {
+						event[form] = NewShaped(isolate, SHAPE_RAW_EVENT);
+						event[form]->Set(Interned(isolate, STRING_CONTROLLER_ID), controllerId);
+						event[form]->Set(Interned(isolate, STRING_DATA), data[form]);
+					}
+					AppendToBatch(isolate, batches, listenerId, event[form]);
+				} else {
+					Local<Value> args[] = { controllerId, data[form] };
+					CallListener(isolate, ctx, 2, args);
+				}
+			}
+		}
 
-		SensorEventBaton *baton = static_cast<SensorEventBaton *>(req->data);
-		EventContext *ctx = static_cast<EventContext *>(baton->eventContext);
-		v8::Local<v8::Function> func = v8::Local<v8::Function>::New(isolate, (ctx->callback));
+		FlushBatches(isolate, EVENT_STREAM_RAW, batches);
+	}
 
-		Local<Value> args[] = {
-			Number::New(isolate, baton->sensorId),
-			v8::String::NewFromUtf8(isolate, baton->model),
-			v8::String::NewFromUtf8(isolate, baton->protocol),
-			Number::New(isolate, baton->dataType),
-			v8::String::NewFromUtf8(isolate, baton->value),
-			Number::New(isolate, baton->ts)
-		};
+	void RawDataCallback(const char* data, int controllerId, int callbackId, void *callbackVoid) {
+		journalRawEvent(data, controllerId);
 
-		func->Call(isolate->GetCurrentContext()->Global(), 6, args);
+		uint64_t hash = dedupHash(DEDUP_HASH_SEED, &controllerId, sizeof(controllerId));
+		hash = dedupHash(hash, data ? data : "", data ? strlen(data) : 0);
+		if (dedupRepeat(EVENT_STREAM_RAW, hash)) {
+			eventHubSuppressed(EVENT_STREAM_RAW);
+			return;
+		}
 
-		free(baton->model);
-		free(baton->protocol);
-		free(baton->value);
-		delete baton;
-		delete req;
+		RawDeviceEventBaton baton;
+		baton.controllerId = controllerId;
+		copyEventString(baton.data, sizeof(baton.data), data);
+
+		// Parsed once here on the callback thread, for the filters of all
+		// listeners and for the loop, which only builds the object
+		baton.fieldCount = parseRawEvent(baton.data, baton.fields, RAW_EVENT_MAX_FIELDS);
+
+		baton.listeners.count = 0;
+		baton.listeners.part = 0;
+		uint64_t rejected = 0;
+		const vector<ListenerEntry> &listeners = listenersLock(EVENT_STREAM_RAW);
+		for (size_t i = 0; i < listeners.size(); i++) {
+			const ListenerEntry &listener = listeners[i];
+			if (listener.filter && !eventFilterRaw(*listener.filter, baton.data, baton.fields, baton.fieldCount)) {
+				rejected++;
+				continue;
+			}
+			AddEventListenerId(baton, listener.id);
+		}
+		listenersUnlock(EVENT_STREAM_RAW);
 
+		if (rejected) {
+			eventHubFiltered(EVENT_STREAM_RAW, rejected);
+		}
+		if (baton.listeners.count > 0) {
+			eventHubPush(baton);
+		}
 	}
 
-	void SensorEventCallback(const char *protocol, const char *model, int sensorId, int dataType, const char *value, int ts, int callbackId, void *callbackVoid) {
-		EventContext *ctx = static_cast<EventContext *>(callbackVoid);
-		SensorEventBaton *baton = new SensorEventBaton();
-		baton->eventContext = ctx;
-		baton->sensorId = sensorId;
-		baton->protocol = strdup(protocol);
-		baton->model = strdup(model);
-		baton->ts = ts;
-		baton->dataType = dataType;
-		baton->value = strdup(value);
+	// Device changes only feed our own bookkeeping, there are no listeners for them
+	void DeviceChangeEventCallback(int deviceId, int changeEvent, int changeType, int callbackId, void *callbackVoid) {
+		metadataCacheDeviceChanged(deviceId, changeEvent);
+		deviceVersionChanged(deviceId, changeEvent);
+	}
 
-		uv_work_t* req = new uv_work_t;
-		req->data = baton;
+	// Must be called with streamCallbackMutex held, after tdInit
+	void RegisterEventStream(EventStream stream) {
+		if (streamCallbackIds[stream] == -1) {
+			switch (stream) {
+			case EVENT_STREAM_DEVICE:
+				streamCallbackIds[stream] = tdRegisterDeviceEvent((TDDeviceEvent)&DeviceEventCallback, 0);
+				break;
+			case EVENT_STREAM_SENSOR:
+				streamCallbackIds[stream] = tdRegisterSensorEvent((TDSensorEvent)&SensorEventCallback, 0);
+				break;
+			default:
+				streamCallbackIds[stream] = tdRegisterRawDeviceEvent((TDRawDeviceEvent)&RawDataCallback, 0);
+				break;
+			}
+		}
+	}
 
-		uv_queue_work(uv_default_loop(), req, (uv_work_cb)SensorEventCallbackWorking, (uv_after_work_cb)SensorEventCallbackAfter);
+	// Registers our callback for the stream with telldus-core, once, or
+	// leaves it to AttachEventStreams if the library isn't initialized yet.
+	// The registration stays after the last listener is gone, so listeners
+	// come and go without talking to telldusd.
+	void AttachEventStream(EventStream stream) {
+		uv_mutex_lock(&streamCallbackMutex);
+		streamWanted[stream] = true;
+		if (streamsAttached) {
+			RegisterEventStream(stream);
+		}
+		uv_mutex_unlock(&streamCallbackMutex);
 	}
 
-	void addSensorEventListener(const v8::FunctionCallbackInfo<v8::Value>& args){
-		Isolate* isolate = Isolate::GetCurrent();
+	// Before tdClose, wanted streams are attached again after tdInit
+	void DetachEventStreams() {
+		uv_mutex_lock(&streamCallbackMutex);
+		streamsAttached = false;
+		for (int i = 0; i < EVENT_STREAM_COUNT; i++) {
+			if (streamCallbackIds[i] != -1) {
+				tdUnregisterCallback(streamCallbackIds[i]);
+				streamCallbackIds[i] = -1;
+			}
+		}
+		if (deviceChangeCallbackId != -1) {
+			tdUnregisterCallback(deviceChangeCallbackId);
+			deviceChangeCallbackId = -1;
+		}
+		uv_mutex_unlock(&streamCallbackMutex);
+	}
 
-		v8::Local<v8::Function> cb = v8::Local<v8::Function>::Cast(args[0]);
-		v8::Persistent<v8::Function> persistentFunction;
-		persistentFunction.Reset(isolate, cb);
+	// After tdInit, the only place the addon registers with telldus-core
+	void AttachEventStreams() {
+		uv_mutex_lock(&streamCallbackMutex);
+		streamsAttached = true;
+		for (int i = 0; i < EVENT_STREAM_COUNT; i++) {
+			if (streamWanted[i]) {
+				RegisterEventStream((EventStream)i);
+			}
+		}
+		if (deviceChangeCallbackId == -1) {
+			deviceChangeCallbackId = tdRegisterDeviceChangeEvent((TDDeviceChangeEvent)&DeviceChangeEventCallback, 0);
+		}
+		uv_mutex_unlock(&streamCallbackMutex);
+	}
 
-		EventContext *ctx = new EventContext();
-		ctx->callback = persistentFunction;
+	void RegisterEventListener(const v8::FunctionCallbackInfo<v8::Value>& args, EventStream stream, bool batch) {
+		Isolate* isolate = Isolate::GetCurrent();
 
-		if (!args[0]->IsFunction()) {
-			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected 1 argument: (function callback)"));
-			isolate->ThrowException(exception);
+		EventContext *ctx = NewEventContext(args, batch);
+		if (!ctx) {
+			return;
 		}
 
-		Local<Number> num = Number::New(isolate, tdRegisterSensorEvent((TDSensorEvent)&SensorEventCallback, ctx));
-		args.GetReturnValue().Set(num);
+		int id = listenerAdd(stream, ctx, ctx->filter, ctx->parse);
+		AttachEventStream(stream);
+		args.GetReturnValue().Set(Number::New(isolate, id));
 	}
 
-	void RawDataEventCallbackWorking(uv_work_t *req) { }
+	// Loop thread only, no IPC involved
+	int RemoveListener(int listenerId) {
+		ListenerEntry removed;
+		if (!listenerRemove(listenerId, removed)) {
+			return TELLSTICK_ERROR_NOT_FOUND;
+		}
 
-	void RawDataEventCallbackAfter(uv_work_t *req, int status) {
-		Isolate* isolate = Isolate::GetCurrent();
+		// Out of the table, nothing else refers to it any more
+		ReleaseEventContext(removed.context);
+		return TELLSTICK_SUCCESS;
+	}
 
-		RawDeviceEventBaton *baton = static_cast<RawDeviceEventBaton *>(req->data);
-		EventContext *ctx = static_cast<EventContext *>(baton->eventContext);
-		v8::Local<v8::Function> func = v8::Local<v8::Function>::New(isolate, ((v8::Persistent<v8::Function, v8::CopyablePersistentTraits<v8::Function> >)ctx->callback));
+	void RemoveEventListener(const v8::FunctionCallbackInfo<v8::Value>& args) {
+		Isolate* isolate = Isolate::GetCurrent();
+		args.GetReturnValue().Set(Number::New(isolate, RemoveListener(args[0]->Int32Value())));
+	}
 
-		Local<Value> args[] = {
-			Number::New(isolate, baton->controllerId),
-			v8::String::NewFromUtf8(isolate, baton->data)
-		};
+	void addDeviceEventListener(const v8::FunctionCallbackInfo<v8::Value>& args){
+		RegisterEventListener(args, EVENT_STREAM_DEVICE, false);
+	}
 
-		func->Call(isolate->GetCurrentContext()->Global(), 2, args);
+	void addDeviceEventBatchListener(const v8::FunctionCallbackInfo<v8::Value>& args){
+		RegisterEventListener(args, EVENT_STREAM_DEVICE, true);
+	}
 
-		free(baton->data);
-		delete baton;
-		delete req;
+	void addSensorEventListener(const v8::FunctionCallbackInfo<v8::Value>& args){
+		RegisterEventListener(args, EVENT_STREAM_SENSOR, false);
 	}
 
-	void RawDataCallback(const char* data, int controllerId, int callbackId, void *callbackVoid) {
-		EventContext *ctx = static_cast<EventContext *>(callbackVoid);
-		RawDeviceEventBaton *baton = new RawDeviceEventBaton();
+	void addSensorEventBatchListener(const v8::FunctionCallbackInfo<v8::Value>& args){
+		RegisterEventListener(args, EVENT_STREAM_SENSOR, true);
+	}
 
-		baton->eventContext = ctx;
-		baton->data = strdup(data);
-		baton->controllerId = controllerId;
+	void addRawDeviceEventListener(const v8::FunctionCallbackInfo<v8::Value>& args){
+		RegisterEventListener(args, EVENT_STREAM_RAW, false);
+	}
 
-		uv_work_t* req = new uv_work_t;
-		req->data = baton;
+	void addRawDeviceEventBatchListener(const v8::FunctionCallbackInfo<v8::Value>& args){
+		RegisterEventListener(args, EVENT_STREAM_RAW, true);
+	}
 
-		uv_queue_work(uv_default_loop(), req, (uv_work_cb)RawDataEventCallbackWorking, (uv_after_work_cb)RawDataEventCallbackAfter);
+	Local<Object> GetEventStreamStats(Isolate* isolate, EventStream stream) {
+		EventStreamStats stats;
+		eventHubStats(stream, stats);
 
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "delivered", v8::String::kInternalizedString), Number::New(isolate, (double)stats.delivered));
+		obj->Set(v8::String::NewFromUtf8(isolate, "coalesced", v8::String::kInternalizedString), Number::New(isolate, (double)stats.coalesced));
+		obj->Set(v8::String::NewFromUtf8(isolate, "dropped", v8::String::kInternalizedString), Number::New(isolate, (double)stats.dropped));
+		obj->Set(v8::String::NewFromUtf8(isolate, "filtered", v8::String::kInternalizedString), Number::New(isolate, (double)stats.filtered));
+		obj->Set(v8::String::NewFromUtf8(isolate, "suppressed", v8::String::kInternalizedString), Number::New(isolate, (double)stats.suppressed));
+		obj->Set(v8::String::NewFromUtf8(isolate, "dedupWindow", v8::String::kInternalizedString), Integer::New(isolate, dedupWindow(stream)));
+		obj->Set(v8::String::NewFromUtf8(isolate, "batches", v8::String::kInternalizedString), Number::New(isolate, (double)stats.batches));
+		obj->Set(v8::String::NewFromUtf8(isolate, "pending", v8::String::kInternalizedString), Number::New(isolate, (double)stats.pending));
+		obj->Set(v8::String::NewFromUtf8(isolate, "highWater", v8::String::kInternalizedString), Number::New(isolate, (double)stats.highWater));
+		obj->Set(v8::String::NewFromUtf8(isolate, "limit", v8::String::kInternalizedString), Number::New(isolate, (double)stats.limit));
+		obj->Set(v8::String::NewFromUtf8(isolate, "capacity", v8::String::kInternalizedString), Number::New(isolate, (double)stats.capacity));
+		obj->Set(v8::String::NewFromUtf8(isolate, "policy", v8::String::kInternalizedString), Integer::New(isolate, stats.policy));
+		obj->Set(v8::String::NewFromUtf8(isolate, "listeners", v8::String::kInternalizedString), Number::New(isolate, (double)listenerCount(stream)));
+		return obj;
 	}
 
-	void addRawDeviceEventListener(const v8::FunctionCallbackInfo<v8::Value>& args){
+	void ConfigureDedup(const v8::FunctionCallbackInfo<v8::Value>& args){
 		Isolate* isolate = Isolate::GetCurrent();
 
-		v8::Local<v8::Function> cb = v8::Local<v8::Function>::Cast(args[0]);
-		v8::Persistent<v8::Function, v8::CopyablePersistentTraits<v8::Function> > value(isolate, cb);
+		if (!args[0]->IsNumber() || args[0]->Int32Value() < 0 || args[0]->Int32Value() >= EVENT_STREAM_COUNT
+			|| !args[1]->IsNumber() || args[1]->Int32Value() < 0) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected arguments: (number stream, number window)"));
+			isolate->ThrowException(exception);
+			return;
+		}
 
-		EventContext *ctx = new EventContext();
-		ctx->callback = value;
+		dedupConfigure((EventStream)args[0]->Int32Value(), args[1]->Uint32Value());
+	}
 
-		if (!args[0]->IsFunction()) {
-			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected 1 argument: (function callback)"));
+	void ConfigureEventQueue(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		if (!args[0]->IsNumber() || args[0]->Int32Value() < 0 || args[0]->Int32Value() >= EVENT_STREAM_COUNT
+			|| !args[1]->IsNumber() || args[1]->Int32Value() < 1
+			|| !args[2]->IsNumber() || args[2]->Int32Value() < OVERFLOW_DROP_NEWEST || args[2]->Int32Value() > OVERFLOW_LATEST) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected arguments: (number stream, number limit, number policy)"));
 			isolate->ThrowException(exception);
+			return;
 		}
 
-		Local<Number> num = Number::New(isolate, tdRegisterRawDeviceEvent((TDRawDeviceEvent)&RawDataCallback, ctx));
-		args.GetReturnValue().Set(num);
+		eventHubConfigure((EventStream)args[0]->Int32Value(), args[1]->Uint32Value(), (OverflowPolicy)args[2]->Int32Value());
 	}
 
+	void getEventStats(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
 
-	struct js_work {
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "device", v8::String::kInternalizedString), GetEventStreamStats(isolate, EVENT_STREAM_DEVICE));
+		obj->Set(v8::String::NewFromUtf8(isolate, "sensor", v8::String::kInternalizedString), GetEventStreamStats(isolate, EVENT_STREAM_SENSOR));
+		obj->Set(v8::String::NewFromUtf8(isolate, "raw", v8::String::kInternalizedString), GetEventStreamStats(isolate, EVENT_STREAM_RAW));
+		args.GetReturnValue().Set(obj);
+	}
 
-		uv_work_t req;
-		Persistent<Function> callback;
-		//char* data;
-		bool rb; // Return value, boolean
-		int rn; // Return value, number
-		char* rs; // Return value, string
+	Local<Object> GetSensorReading(Isolate* isolate, const SensorReading &reading) {
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "protocol", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, reading.protocol));
+		obj->Set(v8::String::NewFromUtf8(isolate, "model", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, reading.model));
+		obj->Set(v8::String::NewFromUtf8(isolate, "id", v8::String::kInternalizedString), Integer::New(isolate, reading.sensorId));
+		obj->Set(v8::String::NewFromUtf8(isolate, "type", v8::String::kInternalizedString), Integer::New(isolate, reading.dataType));
+		obj->Set(v8::String::NewFromUtf8(isolate, "value", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, reading.value));
+		obj->Set(v8::String::NewFromUtf8(isolate, "timestamp", v8::String::kInternalizedString), Integer::New(isolate, reading.ts));
+		return obj;
+	}
 
-		int f; // Worktype
-		int devID; // Device ID
-		int v; // Arbitrary number value
-		char* s; // Arbitrary string value
-		char* s2; // Arbitrary string value
-		bool string_used;
+	void getSensors(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
 
-		list<telldusDeviceInternals> l;
+		vector<SensorReading> readings;
+		sensorStoreSnapshot(readings);
 
-	};
+		Local<Array> list = Array::New(isolate, readings.size());
+		for (size_t i = 0; i < readings.size(); i++) {
+			list->Set(i, GetSensorReading(isolate, readings[i]));
+		}
+		args.GetReturnValue().Set(list);
+	}
 
-	void RunWork(uv_work_t* req) {
-		js_work* work = static_cast<js_work*>(req->data);
-		switch (work->f) {
-		case 0:
-			work->rn = tdTurnOn(work->devID);
-			break;
-		case 1:
-			work->rn = tdTurnOff(work->devID);
-			break;
-		case 2:
-			work->rn = tdDim(work->devID, (unsigned char)work->v);
-			break;
-		case 3:
-			work->rn = tdLearn(work->devID);
-			break;
-		case 4:
-			work->rn = tdAddDevice();
-			break;
-		case 5: // SetName
-			work->rb = tdSetName(work->devID, work->s);
-			break;
-		case 6: // GetName
-			work->rs = tdGetName(work->devID);
-			work->string_used = true;
-			break;
-		case 7: // SetProtocol
-			work->rb = tdSetProtocol(work->devID, work->s);
-			break;
-		case 8: // GetProtocol
-			work->rs = tdGetProtocol(work->devID);
-			work->string_used = true;
-			break;
-		case 9: // SetModel
-			work->rb = tdSetModel(work->devID, work->s);
-			break;
-		case 10: // GetModel
-			work->rs = tdGetModel(work->devID);
-			work->string_used = true;
-			break;
-		case 11: // GetDeviceType
-			work->rn = tdGetDeviceType(work->devID);
-			break;
-		case 12:
-			work->rb = tdRemoveDevice(work->devID);
-			break;
-		case 13:
-			work->rn = tdUnregisterCallback(work->devID);
-			break;
-		case 14: // GetModel
-			work->rs = tdGetErrorString(work->devID);
-			work->string_used = true;
-			break;
-		case 15: // tdInit();
-			tdInit();
-			work->rb = true; // tdInit() has no return value, so we augment true for a return value
-			break;
-		case 16: // tdClose();
-			tdClose();
-			work->rb = true; // tdClose() has no return value, so we augment true for a return value
-			break;
-		case 17: // tdGetNumberOfDevices();
-			work->rn = tdGetNumberOfDevices();
-			break;
-		case 18: // tdStop
-			work->rn = tdStop(work->devID);
-			break;
-		case 19: // tdBell
-			work->rn = tdBell(work->devID);
-			break;
-		case 20: // tdGetDeviceId(deviceIndex)
-			work->rn = tdGetDeviceId(work->devID);
-			break;
-		case 21: // tdGetDeviceParameter(deviceId, name, val)
-			work->rs = tdGetDeviceParameter(work->devID, work->s, work->s2);
-			work->string_used = true;
-			break;
-		case 22: // tdSetDeviceParameter(deviceId, name, val)
-			work->rb = tdSetDeviceParameter(work->devID, work->s, work->s2);
-			break;
-		case 23: // tdExecute
-			work->rn = tdExecute(work->devID);
-			break;
-		case 24: // tdUp
-			work->rn = tdUp(work->devID);
-			break;
-		case 25: // tdDown
-			work->rn = tdDown(work->devID);
-			break;
-		case 26: // getDevices
-			work->l = getDevicesRaw();
-			break;
+	void getSensorValue(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		if (!args[0]->IsString() || !args[1]->IsString() || !args[2]->IsNumber() || !args[3]->IsNumber()) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected arguments: (string protocol, string model, number sensorId, number dataType)"));
+			isolate->ThrowException(exception);
+			return;
 		}
 
+		v8::String::Utf8Value protocol(args[0]);
+		v8::String::Utf8Value model(args[1]);
+		SensorReading reading;
+		if (sensorStoreLookup(*protocol, *model, args[2]->Int32Value(), args[3]->Int32Value(), reading)) {
+			args.GetReturnValue().Set(GetSensorReading(isolate, reading));
+		} else {
+			args.GetReturnValue().SetNull();
+		}
 	}
 
-	void RunCallback(uv_work_t* req, int status) {
-		Isolate* isolate = Isolate::GetCurrent(); // returns NULL
-		if (!isolate) {
-			isolate = Isolate::New();
-			isolate->Enter();
+	// Sensor key arguments shared by the history bindings: (protocol, model, sensorId, dataType, ...)
+	bool GetSensorKeyArgs(const v8::FunctionCallbackInfo<v8::Value>& args, const char *usage) {
+		if (!args[0]->IsString() || !args[1]->IsString() || !args[2]->IsNumber() || !args[3]->IsNumber()) {
+			Isolate* isolate = Isolate::GetCurrent();
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, usage));
+			isolate->ThrowException(exception);
+			return false;
 		}
-		js_work* work = static_cast<js_work*>(req->data);
-		work->string_used = false;
-
-		Handle<Value> argv[3];
+		return true;
+	}
 
+	const size_t MAX_HISTORY_BUCKETS = 1 << 20;
 
-		// This makes it possible to catch
-		// the exception from JavaScript land using the
-		// process.on('uncaughtException') event.
-		TryCatch try_catch;
+	// Samples are written straight into the memory backing the returned typed arrays
+	void getSensorHistory(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+		const char *usage = "Expected arguments: (string protocol, string model, number sensorId, number dataType, number from, number to, [number bucketSize])";
 
-		// Reenter the js-world
+		if (!GetSensorKeyArgs(args, usage)) {
+			return;
+		}
+		if (!args[4]->IsNumber() || !args[5]->IsNumber()) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, usage));
+			isolate->ThrowException(exception);
+			return;
+		}
+
+		v8::String::Utf8Value protocol(args[0]);
+		v8::String::Utf8Value model(args[1]);
+		int sensorId = args[2]->Int32Value();
+		int dataType = args[3]->Int32Value();
+		int from = args[4]->Int32Value();
+		int to = args[5]->Int32Value();
+		int bucketSize = args[6]->IsNumber() ? args[6]->Int32Value() : 0;
+		if (to < from) {
+			to = from;
+		}
+
+		SensorReading reading;
+		if (!sensorStoreLookup(*protocol, *model, sensorId, dataType, reading)) {
+			args.GetReturnValue().SetNull();
+			return;
+		}
+
+		Local<Object> obj = Object::New(isolate);
+
+		if (bucketSize <= 0) {
+			// Raw samples, count first so the arrays are sized right
+			size_t count = sensorHistoryRange(*protocol, *model, sensorId, dataType, from, to, 0, 0, 0);
+			Local<ArrayBuffer> timestamps = ArrayBuffer::New(isolate, count * sizeof(int32_t));
+			Local<ArrayBuffer> values = ArrayBuffer::New(isolate, count * sizeof(double));
+			size_t found = sensorHistoryRange(*protocol, *model, sensorId, dataType, from, to,
+				static_cast<int32_t *>(timestamps->GetContents().Data()), static_cast<double *>(values->GetContents().Data()), count);
+			if (found > count) {
+				found = count; // More arrived in between, they'll be there next time
+			}
+			obj->Set(v8::String::NewFromUtf8(isolate, "timestamps", v8::String::kInternalizedString), Int32Array::New(timestamps, 0, found));
+			obj->Set(v8::String::NewFromUtf8(isolate, "values", v8::String::kInternalizedString), Float64Array::New(values, 0, found));
+			args.GetReturnValue().Set(obj);
+			return;
+		}
+
+		size_t buckets = (size_t)(((int64_t)to - from + bucketSize - 1) / bucketSize);
+		if (buckets > MAX_HISTORY_BUCKETS) {
+			isolate->ThrowException(Exception::RangeError(v8::String::NewFromUtf8(isolate, "Too many buckets, use a larger bucket size")));
+			return;
+		}
+
+		// One buffer per element type, the arrays are views into them
+		Local<ArrayBuffer> ints = ArrayBuffer::New(isolate, buckets * 2 * sizeof(int32_t));
+		Local<ArrayBuffer> doubles = ArrayBuffer::New(isolate, buckets * 3 * sizeof(double));
+		int32_t *starts = static_cast<int32_t *>(ints->GetContents().Data());
+		int32_t *counts = starts + buckets;
+		double *min = static_cast<double *>(doubles->GetContents().Data());
+		double *max = min + buckets;
+		double *avg = max + buckets;
+
+		sensorHistoryAggregate(*protocol, *model, sensorId, dataType, from, bucketSize, buckets, counts, min, max, avg);
+		for (size_t i = 0; i < buckets; i++) {
+			starts[i] = from + (int32_t)i * bucketSize;
+		}
+
+		obj->Set(v8::String::NewFromUtf8(isolate, "timestamps", v8::String::kInternalizedString), Int32Array::New(ints, 0, buckets));
+		obj->Set(v8::String::NewFromUtf8(isolate, "count", v8::String::kInternalizedString), Int32Array::New(ints, buckets * sizeof(int32_t), buckets));
+		obj->Set(v8::String::NewFromUtf8(isolate, "min", v8::String::kInternalizedString), Float64Array::New(doubles, 0, buckets));
+		obj->Set(v8::String::NewFromUtf8(isolate, "max", v8::String::kInternalizedString), Float64Array::New(doubles, buckets * sizeof(double), buckets));
+		obj->Set(v8::String::NewFromUtf8(isolate, "avg", v8::String::kInternalizedString), Float64Array::New(doubles, buckets * 2 * sizeof(double), buckets));
+		args.GetReturnValue().Set(obj);
+	}
+
+	void ConfigureSensorHistory(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		if (!args[0]->IsNumber() || args[0]->NumberValue() < 0) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected arguments: (number samples)"));
+			isolate->ThrowException(exception);
+			return;
+		}
+
+		sensorHistorySetDefault((size_t)args[0]->NumberValue());
+	}
+
+	void SetSensorHistoryLimit(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+		const char *usage = "Expected arguments: (string protocol, string model, number sensorId, number dataType, number samples)";
+
+		if (!GetSensorKeyArgs(args, usage)) {
+			return;
+		}
+		if (!args[4]->IsNumber() || args[4]->NumberValue() < 0) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, usage));
+			isolate->ThrowException(exception);
+			return;
+		}
+
+		v8::String::Utf8Value protocol(args[0]);
+		v8::String::Utf8Value model(args[1]);
+		sensorHistorySetLimit(*protocol, *model, args[2]->Int32Value(), args[3]->Int32Value(), (size_t)args[4]->NumberValue());
+	}
+
+	void getSensorHistoryStats(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		SensorHistoryStats stats;
+		sensorHistoryStats(stats);
+
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "defaultSamples", v8::String::kInternalizedString), Number::New(isolate, (double)stats.defaultSamples));
+		obj->Set(v8::String::NewFromUtf8(isolate, "sensors", v8::String::kInternalizedString), Number::New(isolate, (double)stats.sensors));
+		obj->Set(v8::String::NewFromUtf8(isolate, "samples", v8::String::kInternalizedString), Number::New(isolate, (double)stats.samples));
+		obj->Set(v8::String::NewFromUtf8(isolate, "bytes", v8::String::kInternalizedString), Number::New(isolate, (double)stats.bytes));
+		args.GetReturnValue().Set(obj);
+	}
+
+	void OpenJournal(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		if (!args[0]->IsString() || !args[1]->IsNumber() || !args[2]->IsNumber() || !args[3]->IsNumber()) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected arguments: (string path, number segmentSize, number maxSegments, number types)"));
+			isolate->ThrowException(exception);
+			return;
+		}
+
+		v8::String::Utf8Value path(args[0]);
+		int types = args[3]->Int32Value();
+		std::string error = journalOpen(*path, (size_t)args[1]->NumberValue(), args[2]->Int32Value(), types);
+		if (!error.empty()) {
+			isolate->ThrowException(Exception::Error(v8::String::NewFromUtf8(isolate, error.c_str())));
+			return;
+		}
+		if (types & JOURNAL_RAW) {
+			AttachEventStream(EVENT_STREAM_RAW);
+		}
+	}
+
+	void CloseJournal(const v8::FunctionCallbackInfo<v8::Value>& args){
+		journalClose();
+	}
+
+	void getJournalStats(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		JournalStats stats;
+		journalStats(stats);
+
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "open", v8::String::kInternalizedString), Boolean::New(isolate, stats.open));
+		obj->Set(v8::String::NewFromUtf8(isolate, "path", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, journalPath().c_str()));
+		obj->Set(v8::String::NewFromUtf8(isolate, "records", v8::String::kInternalizedString), Number::New(isolate, (double)stats.records));
+		obj->Set(v8::String::NewFromUtf8(isolate, "bytes", v8::String::kInternalizedString), Number::New(isolate, (double)stats.bytes));
+		obj->Set(v8::String::NewFromUtf8(isolate, "dropped", v8::String::kInternalizedString), Number::New(isolate, (double)stats.dropped));
+		obj->Set(v8::String::NewFromUtf8(isolate, "segments", v8::String::kInternalizedString), Number::New(isolate, (double)stats.segments));
+		obj->Set(v8::String::NewFromUtf8(isolate, "sequence", v8::String::kInternalizedString), Number::New(isolate, (double)stats.sequence));
+		args.GetReturnValue().Set(obj);
+	}
+
+	void OpenJournalReader(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		if (!args[0]->IsString() || !args[1]->IsNumber() || !args[2]->IsNumber() || !args[3]->IsNumber()) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected arguments: (string path, number from, number to, number types)"));
+			isolate->ThrowException(exception);
+			return;
+		}
+
+		v8::String::Utf8Value path(args[0]);
+		std::string error;
+		int readerId = journalOpenReader(*path, (int64_t)args[1]->NumberValue(), (int64_t)args[2]->NumberValue(), args[3]->Int32Value(), error);
+		if (!readerId) {
+			isolate->ThrowException(Exception::Error(v8::String::NewFromUtf8(isolate, error.c_str())));
+			return;
+		}
+		args.GetReturnValue().Set(Integer::New(isolate, readerId));
+	}
+
+	struct JournalBatch {
+		Isolate* isolate;
+		Local<Array> records;
+		uint32_t count;
+	};
+
+	void AppendJournalRecord(const JournalRecord &record, void *context) {
+		JournalBatch *batch = static_cast<JournalBatch *>(context);
+		Isolate* isolate = batch->isolate;
+
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "time", v8::String::kInternalizedString), Number::New(isolate, (double)record.time));
+		switch (record.type) {
+		case JOURNAL_DEVICE:
+			obj->Set(v8::String::NewFromUtf8(isolate, "type", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, "device", v8::String::kInternalizedString));
+			obj->Set(v8::String::NewFromUtf8(isolate, "id", v8::String::kInternalizedString), Integer::New(isolate, record.id));
+			obj->Set(v8::String::NewFromUtf8(isolate, "method", v8::String::kInternalizedString), Integer::New(isolate, record.method));
+			obj->Set(v8::String::NewFromUtf8(isolate, "data", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, record.strings[0], v8::String::kNormalString, (int)record.lengths[0]));
+			break;
+		case JOURNAL_SENSOR:
+			obj->Set(v8::String::NewFromUtf8(isolate, "type", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, "sensor", v8::String::kInternalizedString));
+			obj->Set(v8::String::NewFromUtf8(isolate, "id", v8::String::kInternalizedString), Integer::New(isolate, record.id));
+			obj->Set(v8::String::NewFromUtf8(isolate, "protocol", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, record.strings[0], v8::String::kNormalString, (int)record.lengths[0]));
+			obj->Set(v8::String::NewFromUtf8(isolate, "model", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, record.strings[1], v8::String::kNormalString, (int)record.lengths[1]));
+			obj->Set(v8::String::NewFromUtf8(isolate, "dataType", v8::String::kInternalizedString), Integer::New(isolate, record.method));
+			obj->Set(v8::String::NewFromUtf8(isolate, "value", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, record.strings[2], v8::String::kNormalString, (int)record.lengths[2]));
+			obj->Set(v8::String::NewFromUtf8(isolate, "timestamp", v8::String::kInternalizedString), Integer::New(isolate, record.ts));
+			break;
+		default:
+			obj->Set(v8::String::NewFromUtf8(isolate, "type", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, "raw", v8::String::kInternalizedString));
+			obj->Set(v8::String::NewFromUtf8(isolate, "controllerId", v8::String::kInternalizedString), Integer::New(isolate, record.id));
+			obj->Set(v8::String::NewFromUtf8(isolate, "data", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, record.strings[0], v8::String::kNormalString, (int)record.lengths[0]));
+			break;
+		}
+		batch->records->Set(batch->count++, obj);
+	}
+
+	// Returns the next batch of records, or null once the reader is done
+	void ReadJournal(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		JournalBatch batch;
+		batch.isolate = isolate;
+		batch.records = Array::New(isolate);
+		batch.count = 0;
+		size_t max = args[1]->IsNumber() && args[1]->Int32Value() > 0 ? args[1]->Int32Value() : 1024;
+
+		bool more = journalRead(args[0]->Int32Value(), max, AppendJournalRecord, &batch);
+		if (batch.count == 0 && !more) {
+			args.GetReturnValue().SetNull();
+			return;
+		}
+		args.GetReturnValue().Set(batch.records);
+	}
+
+	void CloseJournalReader(const v8::FunctionCallbackInfo<v8::Value>& args){
+		journalCloseReader(args[0]->Int32Value());
+	}
+
+
+	struct js_work {
+
+		uv_work_t req;
+		Persistent<Function> callback;
+		//char* data;
+		bool rb; // Return value, boolean
+		int rn; // Return value, number
+		char* rs; // Return value, string
+
+		int f; // Worktype
+		int devID; // Device ID
+		int v; // Arbitrary number value
+		char* s; // Arbitrary string value
+		char* s2; // Arbitrary string value
+		int priority; // Airtime priority for commands
+		bool sync; // Called from a sync native, see SendCommand
+		uint64_t deadline; // Sync calls: when the caller stops waiting, 0 for never
+		bool string_used;
+		bool timedOut; // The callback was already told, see RunTimeout
+
+		vector<telldusDeviceInternals> devices;
+		uint64_t version; // Argument and result of getDevicesSince
+		bool full; // getDevicesSince returned every device
+		vector<int> removed;
+		string cached; // Backing storage for rs when served from the metadata cache
+
+	};
+
+	ObjectPool<js_work> workPool("work");
+
+	// Serve metadata reads straight from the cache, returns true on a hit
+	bool CachedMetadata(js_work* work) {
+		bool hit = false;
 		switch (work->f) {
+		case 6: // GetName
+			hit = metadataLookup(work->devID, METADATA_NAME, work->cached);
+			break;
+		case 8: // GetProtocol
+			hit = metadataLookup(work->devID, METADATA_PROTOCOL, work->cached);
+			break;
+		case 10: // GetModel
+			hit = metadataLookup(work->devID, METADATA_MODEL, work->cached);
+			break;
+		case 11: // GetDeviceType
+			return metadataLookupType(work->devID, work->rn);
+		case 21: // GetDeviceParameter
+			hit = metadataLookupParameter(work->devID, work->s, work->s2, work->cached);
+			break;
+		}
+		if (hit) {
+			work->rs = const_cast<char*>(work->cached.c_str());
+			work->string_used = false;
+		}
+		return hit;
+	}
+
+	// Keep the metadata cache in line with what was just read or written
+	void UpdateMetadata(js_work* work, unsigned int generation) {
+		switch (work->f) {
+		case 5: // SetName
+		case 7: // SetProtocol
+		case 9: // SetModel
+		case 12: // RemoveDevice
+		case 22: // SetDeviceParameter
+			metadataInvalidate(work->devID);
+			break;
+		case 6: // GetName
+			metadataStore(work->devID, METADATA_NAME, work->rs, generation);
+			break;
+		case 8: // GetProtocol
+			metadataStore(work->devID, METADATA_PROTOCOL, work->rs, generation);
+			break;
+		case 10: // GetModel
+			metadataStore(work->devID, METADATA_MODEL, work->rs, generation);
+			break;
+		case 11: // GetDeviceType
+			metadataStoreType(work->devID, work->rn, generation);
+			break;
+		case 21: // GetDeviceParameter
+			metadataStoreParameter(work->devID, work->s, work->s2, work->rs, generation);
+			break;
+		}
+	}
+
+	int SendDeviceCommand(int worktype, int deviceId, int value) {
+		switch (worktype) {
+		case 0:
+			return tdTurnOn(deviceId);
+		case 1:
+			return tdTurnOff(deviceId);
+		case 2:
+			return tdDim(deviceId, (unsigned char)value);
+		case 3:
+			return tdLearn(deviceId);
+		case 18:
+			return tdStop(deviceId);
+		case 19:
+			return tdBell(deviceId);
+		case 23:
+			return tdExecute(deviceId);
+		case 24:
+			return tdUp(deviceId);
+		case 25:
+			return tdDown(deviceId);
+		}
+		return TELLSTICK_ERROR_METHOD_NOT_SUPPORTED;
+	}
+
+	// Run one of the device commands, once the controller has airtime for it.
+	// Sync calls go straight to telldusd, as they always have, unless the
+	// controller is rate limited. Then they wait for the slot until their
+	// deadline and fail with TELLSTICK_ERROR_TIMEOUT if it passes.
+	int SendCommand(int worktype, int deviceId, int value, int priority, bool sync, uint64_t deadline) {
+		if (sync && !airtimeLimited(deviceId)) {
+			return SendDeviceCommand(worktype, deviceId, value);
+		}
+		AirtimeSlot slot(deviceId, priority, deadline);
+		if (!slot.acquired()) {
+			return ERROR_TIMEOUT;
+		}
+		return SendDeviceCommand(worktype, deviceId, value);
+	}
+
+	int RunCommand(int worktype, int deviceId, int value, int priority, bool sync, uint64_t deadline) {
+		int result = SendCommand(worktype, deviceId, value, priority, sync, deadline);
+		if (result == TELLSTICK_SUCCESS) {
+			// Don't wait for telldusd to report it back
+			deviceVersionTouch(deviceId);
+		}
+		return result;
+	}
+
+	// Scenes have a thread of their own, waiting for airtime is fine there
+	int RunSceneStep(int worktype, int deviceId, int value, int priority) {
+		if (!breakerAllow()) {
+			return ERROR_CIRCUIT_OPEN;
+		}
+		int result = RunCommand(worktype, deviceId, value, priority, false, 0);
+		breakerSuccess();
+		return result;
+	}
+
+	// Run functions of the operation table (src/operations.h), called on a
+	// lane thread for async calls and on the loop thread for sync ones
+	void RunDeviceCommand(js_work* work) {
+		work->rn = RunCommand(work->f, work->devID, work->v, work->priority, work->sync, work->deadline);
+	}
+
+	void RunAddDevice(js_work* work) {
+		work->rn = tdAddDevice();
+	}
+
+	void RunSetName(js_work* work) {
+		work->rb = tdSetName(work->devID, work->s);
+	}
+
+	void RunGetName(js_work* work) {
+		work->rs = tdGetName(work->devID);
+		work->string_used = true;
+	}
+
+	void RunSetProtocol(js_work* work) {
+		work->rb = tdSetProtocol(work->devID, work->s);
+	}
+
+	void RunGetProtocol(js_work* work) {
+		work->rs = tdGetProtocol(work->devID);
+		work->string_used = true;
+	}
+
+	void RunSetModel(js_work* work) {
+		work->rb = tdSetModel(work->devID, work->s);
+	}
+
+	void RunGetModel(js_work* work) {
+		work->rs = tdGetModel(work->devID);
+		work->string_used = true;
+	}
+
+	void RunGetDeviceType(js_work* work) {
+		work->rn = tdGetDeviceType(work->devID);
+	}
+
+	void RunRemoveDevice(js_work* work) {
+		work->rb = tdRemoveDevice(work->devID);
+	}
+
+	void RunGetErrorString(js_work* work) {
+		work->rs = tdGetErrorString(work->devID);
+		work->string_used = true;
+	}
+
+	// init may run on a lane thread (lazy initialization) while a sync call
+	// on the loop thread asks for it too, the second one waits and returns
+	uv_mutex_t initMutex;
+	bool initialized = false;
+
+	void RunInit(js_work* work) {
+		uv_mutex_lock(&initMutex);
+		if (!initialized) {
+			tdInit();
+			// Listening first, so nothing that changes meanwhile is missed
+			AttachEventStreams();
+			metadataCacheAttach();
+			deviceVersionsAttach();
+			sensorStoreSeed();
+			initialized = true;
+		}
+		uv_mutex_unlock(&initMutex);
+		work->rb = true; // tdInit() has no return value, so we augment true for a return value
+	}
+
+	void RunClose(js_work* work) {
+		uv_mutex_lock(&initMutex);
+		journalClose();
+		DetachEventStreams();
+		metadataCacheDetach();
+		tdClose();
+		initialized = false;
+		uv_mutex_unlock(&initMutex);
+		work->rb = true; // tdClose() has no return value, so we augment true for a return value
+	}
+
+	void RunGetNumberOfDevices(js_work* work) {
+		work->rn = tdGetNumberOfDevices();
+	}
+
+	void RunGetDeviceId(js_work* work) {
+		work->rn = tdGetDeviceId(work->devID);
+	}
+
+	void RunGetDeviceParameter(js_work* work) {
+		work->rs = tdGetDeviceParameter(work->devID, work->s, work->s2);
+		work->string_used = true;
+	}
+
+	void RunSetDeviceParameter(js_work* work) {
+		work->rb = tdSetDeviceParameter(work->devID, work->s, work->s2);
+	}
+
+	void RunGetDevices(js_work* work) {
+		getDevicesRaw(work->devices);
+	}
+
+	void RunGetDevicesSince(js_work* work) {
+		vector<int> changed;
+		work->removed.clear();
+		work->version = deviceVersionsSince(work->version, changed, work->removed, work->full);
+		if (work->full) {
+			getDevicesRaw(work->devices);
+			return;
+		}
+		work->devices.resize(changed.size());
+		for (size_t i = 0; i < changed.size(); i++) {
+			getDeviceById(changed[i], work->devices[i]);
+		}
+	}
+
+	struct operation {
+		const char *name;
+		OperationArgs args;
+		OperationResult result;
+		ExecutorLane lane;
+		void (*run)(js_work* work);
+		OperationGuard guard;
+	};
+
+	// Indexed by worktype, filled in from TELLDUS_OPERATIONS in init. Holes have no run function.
+	operation operations[OPERATION_COUNT];
+
+	void InitOperations() {
+#define X(name, worktype, arguments, result, lane, run, guard) \
+		{ operation op = { #name, arguments, result, lane, run, guard }; operations[worktype] = op; }
+		TELLDUS_OPERATIONS(X)
+#undef X
+	}
+
+	bool IsOperation(int worktype) {
+		return worktype >= 0 && worktype < OPERATION_COUNT && operations[worktype].run;
+	}
+
+	// Configuration changes we made ourselves, commands are noted in RunCommand
+	void UpdateDeviceVersion(js_work* work) {
+		switch (work->f) {
+		case 4: // AddDevice
+			if (work->rn > 0) {
+				deviceVersionTouch(work->rn);
+			}
+			break;
+		case 5: // SetName
+		case 7: // SetProtocol
+		case 9: // SetModel
+		case 22: // SetDeviceParameter
+			if (work->rb) {
+				deviceVersionTouch(work->devID);
+			}
+			break;
+		case 12: // RemoveDevice
+			if (work->rb) {
+				deviceVersionRemove(work->devID);
+			}
+			break;
+		}
+	}
+
+	// Commands go out over the air and are kept apart from config/metadata queries
+	ExecutorLane LaneFor(int worktype) {
+		return IsOperation(worktype) ? operations[worktype].lane : LANE_QUERY;
+	}
+
+	// Runs an operation on the calling thread, unless the answer is already cached
+	void RunOperation(js_work* work) {
+		if (CachedMetadata(work)) {
+			return;
+		}
+		unsigned int generation = metadataGeneration();
+		operations[work->f].run(work);
+		UpdateMetadata(work, generation);
+		UpdateDeviceVersion(work);
+	}
+
+	// Anything that isn't a version we handed out asks for everything
+	uint64_t VersionArgument(Handle<Value> value) {
+		double version = value->NumberValue();
+		return version > 0 ? (uint64_t)version : 0;
+	}
+
+	Local<Object> GetDeviceChanges(Isolate* isolate, js_work* work) {
+		Local<Array> removed = Array::New(isolate, work->removed.size());
+		for (size_t i = 0; i < work->removed.size(); i++) {
+			removed->Set(i, Integer::New(isolate, work->removed[i]));
+		}
+
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "version", v8::String::kInternalizedString), Number::New(isolate, (double)work->version));
+		obj->Set(v8::String::NewFromUtf8(isolate, "full", v8::String::kInternalizedString), Boolean::New(isolate, work->full));
+		obj->Set(v8::String::NewFromUtf8(isolate, "devices", v8::String::kInternalizedString), getDevicesFromInternals(work->devices));
+		obj->Set(v8::String::NewFromUtf8(isolate, "removed", v8::String::kInternalizedString), removed);
+		return obj;
+	}
+
+	// Result of a finished operation as handed to JavaScript
+	Handle<Value> OperationResultValue(Isolate* isolate, js_work* work) {
+		switch (operations[work->f].result) {
+		case RESULT_BOOL:
+			return Boolean::New(isolate, work->rb);
+		case RESULT_STRING:
+			return v8::String::NewFromUtf8(isolate, work->rs);
+		case RESULT_DEVICES:
+			return getDevicesFromInternals(work->devices);
+		case RESULT_COMPACT_DEVICES:
+			return getCompactDevicesFromInternals(work->devices);
+		case RESULT_DEVICE_CHANGES:
+			return GetDeviceChanges(isolate, work);
+		default:
+			return Integer::New(isolate, work->rn);
+		}
+	}
+
+	// Once the result has been converted
+	void FinishOperation(js_work* work) {
+		// Check if we have an allocated string from telldus
+		if (work->string_used) {
+			tdReleaseString(work->rs);
+			work->string_used = false;
+		}
+	}
+
+	void RunWork(uv_work_t* req) {
+		RunOperation(static_cast<js_work*>(req->data));
+	}
+
+	// Default deadlines in milliseconds, 0 for none
+	double syncTimeout = 0;
+	double asyncTimeout = 0;
+
+	// Deadline for a call made now, in uv_hrtime() nanoseconds
+	uint64_t DeadlineIn(double timeout) {
+		return timeout > 0 ? uv_hrtime() + (uint64_t)(timeout * 1e6) : 0;
+	}
+
+	double TimeoutArgument(Handle<Value> value, double fallback) {
+		return value->IsNumber() ? value->NumberValue() : fallback;
+	}
+
+	bool Guarded(int worktype) {
+		return !IsOperation(worktype) || operations[worktype].guard == GUARDED;
+	}
+
+	void CallWorkCallback(Isolate* isolate, js_work* work, Handle<Value> result) {
+		Handle<Value> argv[] = { result, Integer::New(isolate, work->f) }; // Result and worktype
+
+		// This makes it possible to catch
+		// the exception from JavaScript land using the
+		// process.on('uncaughtException') event.
+		TryCatch try_catch;
+
+		if (!work->callback.IsEmpty()) {
+			Local<Function> callback = Local<Function>::New(isolate, work->callback);
+			callback->Call(isolate->GetCurrentContext()->Global(), 2, argv);
+		}
+
+		// Handle any exceptions thrown inside the callback
+		if (try_catch.HasCaught()) {
+			node::FatalException(try_catch);
+		}
+	}
+
+	// Still running at its deadline, answer now and drop the result once it comes
+	void RunTimeout(uv_work_t* req) {
+		Isolate* isolate = Isolate::GetCurrent();
+		HandleScope scope(isolate);
+		js_work* work = static_cast<js_work*>(req->data);
+
+		work->timedOut = true;
+		if (Guarded(work->f)) {
+			breakerTimeout();
+		}
+		CallWorkCallback(isolate, work, Integer::New(isolate, ERROR_TIMEOUT));
+		work->callback.Reset();
+	}
+
+	void RunCallback(uv_work_t* req, int status) {
+		Isolate* isolate = Isolate::GetCurrent(); // returns NULL
+		if (!isolate) {
+			isolate = Isolate::New();
+			isolate->Enter();
+		}
+		HandleScope scope(isolate);
+		js_work* work = static_cast<js_work*>(req->data);
+
+		if (Guarded(work->f)) {
+			if (status == UV_ETIMEDOUT) {
+				breakerTimeout();
+			} else if (status == 0 && !work->timedOut) {
+				breakerSuccess();
+			}
+		}
+
+		// Reenter the js-world
+		if (status != 0) {
+			// Never ran, report why instead of a result
+			CallWorkCallback(isolate, work, Integer::New(isolate, ErrorForStatus(status)));
+		} else if (!work->timedOut) {
+			CallWorkCallback(isolate, work, OperationResultValue(isolate, work));
+		}
+
+		FinishOperation(work);
+
+		// properly cleanup, or death by millions of tiny leaks
+		work->callback.Reset();
+
+		arenaRelease(work->s); // char* Created in AsyncCaller
+		arenaRelease(work->s2); // char* Created in AsyncCaller
+
+		workPool.destroy(work);
+
+	}
+
+	// Hand an async call to its lane, unless the circuit breaker turns it away
+	void QueueOperation(js_work* work, double timeout) {
+		work->timedOut = false;
+		work->req.data = work;
+		if (Guarded(work->f) && !breakerAllow()) {
+			executorFail(&work->req, (uv_after_work_cb)RunCallback, STATUS_CIRCUIT_OPEN);
+			return;
+		}
+		executorQueueWork(LaneFor(work->f), &work->req, RunWork, (uv_after_work_cb)RunCallback, work->priority, DeadlineIn(timeout), RunTimeout);
+	}
+
+	// A sync call with a deadline runs on its lane while the loop thread
+	// waits for it. If it doesn't make it in time the loop thread moves
+	// on, and the call cleans up after itself once it finishes: its after
+	// work callback runs on the loop thread, so never before the wait is over.
+	struct sync_wait {
+		uv_mutex_t mutex;
+		uv_cond_t cond;
+		bool finished;
+	};
+
+	void SyncWaitInit(sync_wait* wait) {
+		wait->finished = false;
+		uv_mutex_init(&wait->mutex);
+		uv_cond_init(&wait->cond);
+	}
+
+	// Lane thread, the job is done
+	void SyncWaitSignal(sync_wait* wait) {
+		uv_mutex_lock(&wait->mutex);
+		wait->finished = true;
+		uv_cond_signal(&wait->cond);
+		uv_mutex_unlock(&wait->mutex);
+	}
+
+	// Loop thread, false if the deadline passed first
+	bool SyncWaitUntil(sync_wait* wait, uint64_t deadline) {
+		uv_mutex_lock(&wait->mutex);
+		while (!wait->finished) {
+			uint64_t now = uv_hrtime();
+			if (now >= deadline || uv_cond_timedwait(&wait->cond, &wait->mutex, deadline - now) != 0) {
+				break;
+			}
+		}
+		bool finished = wait->finished;
+		uv_mutex_unlock(&wait->mutex);
+		return finished;
+	}
+
+	void SyncWaitDestroy(sync_wait* wait) {
+		uv_cond_destroy(&wait->cond);
+		uv_mutex_destroy(&wait->mutex);
+	}
+
+	struct sync_call {
+		js_work work;
+		sync_wait wait;
+	};
+
+	ObjectPool<sync_call> syncPool("sync");
+
+	void RunSyncWork(uv_work_t* req) {
+		sync_call* call = static_cast<sync_call*>(req->data);
+		RunOperation(&call->work);
+		SyncWaitSignal(&call->wait);
+	}
+
+	void AfterSyncWork(uv_work_t* req, int status) {
+		sync_call* call = static_cast<sync_call*>(req->data);
+		FinishOperation(&call->work);
+		arenaRelease(call->work.s);
+		arenaRelease(call->work.s2);
+		SyncWaitDestroy(&call->wait);
+		syncPool.destroy(call);
+	}
+
+	char* CopyOptionalString(const char* s) {
+		return s ? arenaCopy(s, strlen(s)) : 0;
+	}
+
+	// Runs a sync call and sets its result, or an error code if the circuit
+	// is open or the call did not finish within timeout milliseconds
+	void CompleteSync(const v8::FunctionCallbackInfo<v8::Value>& args, js_work* work, double timeout) {
+		Isolate* isolate = Isolate::GetCurrent();
+
+		if (!Guarded(work->f)) {
+			RunOperation(work);
+			args.GetReturnValue().Set(OperationResultValue(isolate, work));
+			FinishOperation(work);
+			return;
+		}
+		if (!breakerAllow()) {
+			args.GetReturnValue().Set(Integer::New(isolate, ERROR_CIRCUIT_OPEN));
+			return;
+		}
+		if (timeout <= 0) {
+			RunOperation(work);
+			breakerSuccess();
+			args.GetReturnValue().Set(OperationResultValue(isolate, work));
+			FinishOperation(work);
+			return;
+		}
+
+		sync_call* call = syncPool.create();
+		call->work.f = work->f;
+		call->work.devID = work->devID;
+		call->work.v = work->v;
+		call->work.version = work->version;
+		call->work.priority = work->priority;
+		call->work.sync = work->sync;
+		call->work.deadline = DeadlineIn(timeout);
+		call->work.s = CopyOptionalString(work->s); // The strings may outlive this call
+		call->work.s2 = CopyOptionalString(work->s2);
+		call->work.string_used = false;
+		call->work.req.data = call;
+		SyncWaitInit(&call->wait);
+
+		uint64_t deadline = call->work.deadline;
+		if (executorQueueWork(LaneFor(work->f), &call->work.req, RunSyncWork, AfterSyncWork, work->priority, deadline) != 0) {
+			args.GetReturnValue().Set(Integer::New(isolate, ERROR_QUEUE_FULL));
+			return;
+		}
+
+		if (!SyncWaitUntil(&call->wait, deadline)) {
+			breakerTimeout();
+			args.GetReturnValue().Set(Integer::New(isolate, ERROR_TIMEOUT));
+			return;
+		}
+		breakerSuccess();
+		args.GetReturnValue().Set(OperationResultValue(isolate, &call->work));
+		FinishOperation(&call->work);
+	}
+
+	void AsyncCaller(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent(); // returns NULL
+		if (!isolate) {
+			isolate = Isolate::New();
+			isolate->Enter();
+		}
+		// Make sure we don't get any funky data
+		if (!args[0]->IsNumber() || !args[1]->IsNumber() || !args[2]->IsNumber() || !args[3]->IsString() || !args[4]->IsString()) {
+			//return ThrowException(Exception::TypeError(v8::String::NewFromUtf8(isolate,"Wrong arguments")));
+		}
+
+		if (!IsOperation(args[0]->Int32Value())) {
+			isolate->ThrowException(Exception::TypeError(v8::String::NewFromUtf8(isolate, "Unknown operation")));
+			return;
+		}
+
+		// Make a deep copy of the string argument as we don't want
+		// it memory managed by v8 in the worker thread
+		String::Utf8Value str(args[3]);
+		char * str_copy = arenaCopy(*str, str.length()); // Released at end of RunCallback
+
+		String::Utf8Value str2(args[4]);
+		char * str_copy2 = arenaCopy(*str2, str2.length()); // Released at end of RunCallback
+
+		js_work* work = workPool.create();
+		work->f = args[0]->NumberValue(); // Worktype
+		work->devID = args[1]->NumberValue(); // Device ID
+		work->version = VersionArgument(args[1]); // Or version, for getDevicesSince
+		work->v = args[2]->NumberValue(); // Arbitrary number value
+		work->s = str_copy; // Arbitrary string value
+		work->s2 = str_copy2; // Arbitrary string value
+		work->string_used = false; // Used to keep track of used telldus strings
+		work->priority = args[6]->IsNumber() ? args[6]->Int32Value() : PRIORITY_INTERACTIVE;
+		work->sync = false;
+		work->deadline = 0;
+
+		if (args[5]->IsFunction()) {
+			work->callback.Reset(isolate, Local<Function>::Cast(args[5]));
+		}
+
+		QueueOperation(work, TimeoutArgument(args[7], asyncTimeout));
+
+		Local<String> retstr = v8::String::NewFromUtf8(isolate, "Running asynchronous process initializer");
+
+		args.GetReturnValue().Set(retstr);
+	}
+
+	struct bulk_work {
+
+		uv_work_t req;
+		Persistent<Function> callback;
+
+		int f; // Worktype, one of the commands
+		vector<int> ids; // Device IDs, run in this order
+		vector<int> values; // Per device value (dim level), empty if unused
+		vector<int> results; // Per device return value
+		int priority; // Airtime priority, automation unless told otherwise
+		bool sync; // Called from SyncBulkCaller, see SendCommand
+		uint64_t deadline; // Sync calls: when the caller stops waiting, 0 for never
+		sync_wait wait; // SyncBulkCaller with a deadline
+
+	};
+
+	ObjectPool<bulk_work> bulkPool("bulk");
+
+	// Fill a bulk_work from (worktype, ids, values, priority), throws and returns false on bad input
+	bool InitBulkWork(const v8::FunctionCallbackInfo<v8::Value>& args, bulk_work *work) {
+		Isolate* isolate = Isolate::GetCurrent();
+
+		work->f = args[0]->Int32Value();
+		if (LaneFor(work->f) != LANE_COMMAND || !GetIntList(args[1], work->ids)) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected arguments: (number worktype, Array|Int32Array ids, [Array|Int32Array values])"));
+			isolate->ThrowException(exception);
+			return false;
+		}
+		if (!args[2]->IsUndefined() && !args[2]->IsNull()) {
+			if (!GetIntList(args[2], work->values) || work->values.size() != work->ids.size()) {
+				v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected one value per device id"));
+				isolate->ThrowException(exception);
+				return false;
+			}
+		}
+		work->priority = args[3]->IsNumber() ? args[3]->Int32Value() : PRIORITY_AUTOMATION;
+		work->sync = false;
+		work->deadline = 0;
+		return true;
+	}
+
+	// Commands are sent one after the other in the order given, a failing
+	// device does not stop the rest.
+	void RunBulkWork(uv_work_t* req) {
+		bulk_work* work = static_cast<bulk_work*>(req->data);
+
+		work->results.resize(work->ids.size());
+		for (size_t i = 0; i < work->ids.size(); i++) {
+			int value = work->values.empty() ? 0 : work->values[i];
+			work->results[i] = RunCommand(work->f, work->ids[i], value, work->priority, work->sync, work->deadline);
+		}
+	}
+
+	void RunBulkCallback(uv_work_t* req, int status) {
+		Isolate* isolate = Isolate::GetCurrent();
+		HandleScope scope(isolate);
+		bulk_work* work = static_cast<bulk_work*>(req->data);
+
+		if (status == 0) {
+			breakerSuccess();
+		}
+
+		Handle<Value> argv[2];
+		if (status != 0) {
+			argv[0] = Integer::New(isolate, ErrorForStatus(status));
+		} else {
+			argv[0] = NewInt32Array(isolate, work->results);
+		}
+		argv[1] = Integer::New(isolate, work->f); // Return worktype
+
+		TryCatch try_catch;
+		if (!work->callback.IsEmpty()) {
+			Local<Function> callback = Local<Function>::New(isolate, work->callback);
+			callback->Call(isolate->GetCurrentContext()->Global(), 2, argv);
+		}
+		if (try_catch.HasCaught()) {
+			node::FatalException(try_catch);
+		}
+
+		work->callback.Reset();
+		bulkPool.destroy(work);
+	}
+
+	void AsyncBulkCaller(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		bulk_work* work = bulkPool.create();
+		if (!InitBulkWork(args, work)) {
+			bulkPool.destroy(work);
+			return;
+		}
+
+		work->req.data = work;
+		if (args[4]->IsFunction()) {
+			work->callback.Reset(isolate, Local<Function>::Cast(args[4]));
+		}
+
+		if (!breakerAllow()) {
+			executorFail(&work->req, (uv_after_work_cb)RunBulkCallback, STATUS_CIRCUIT_OPEN);
+			return;
+		}
+		// The whole batch is one job on the command lane
+		executorQueueWork(LANE_COMMAND, &work->req, RunBulkWork, (uv_after_work_cb)RunBulkCallback, work->priority);
+	}
+
+	void RunSyncBulkWork(uv_work_t* req) {
+		RunBulkWork(req);
+		SyncWaitSignal(&static_cast<bulk_work*>(req->data)->wait);
+	}
+
+	void AfterSyncBulkWork(uv_work_t* req, int status) {
+		bulk_work* work = static_cast<bulk_work*>(req->data);
+		SyncWaitDestroy(&work->wait);
+		bulkPool.destroy(work);
+	}
+
+	// (worktype, ids, values, priority, timeout), the timeout in
+	// milliseconds defaults to the sync deadline. Every device gets the
+	// error if the circuit is open or the batch doesn't finish in time.
+	void SyncBulkCaller(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+		double timeout = TimeoutArgument(args[4], syncTimeout);
+
+		bulk_work* work = bulkPool.create();
+		if (!InitBulkWork(args, work)) {
+			bulkPool.destroy(work);
+			return;
+		}
+		work->req.data = work;
+		work->sync = true;
+
+		vector<int> results;
+		if (!breakerAllow()) {
+			results.assign(work->ids.size(), ERROR_CIRCUIT_OPEN);
+			bulkPool.destroy(work);
+		} else if (timeout <= 0) {
+			RunBulkWork(&work->req);
+			breakerSuccess();
+			results.swap(work->results);
+			bulkPool.destroy(work);
+		} else {
+			work->deadline = DeadlineIn(timeout);
+			SyncWaitInit(&work->wait);
+			// Freed by AfterSyncBulkWork whatever happens here
+			if (executorQueueWork(LANE_COMMAND, &work->req, RunSyncBulkWork, AfterSyncBulkWork, work->priority, work->deadline) != 0) {
+				results.assign(work->ids.size(), ERROR_QUEUE_FULL);
+			} else if (!SyncWaitUntil(&work->wait, work->deadline)) {
+				breakerTimeout();
+				results.assign(work->ids.size(), ERROR_TIMEOUT);
+			} else {
+				breakerSuccess();
+				results = work->results;
+			}
+		}
+
+		args.GetReturnValue().Set(NewInt32Array(isolate, results));
+	}
+
+	struct create_work {
+
+		uv_work_t req;
+		Persistent<Function> callback;
+
+		vector<DeviceSpec> specs;
+		vector<int> results; // New device id or error code, per spec
+		sync_wait wait; // CreateDevicesSync with a deadline
+
+	};
+
+	ObjectPool<create_work> createPool("create");
+
+	// Optional string property, returns false if it is there but not a string
+	bool GetSpecString(Local<Object> obj, const char *key, bool &has, string &value) {
+		Isolate* isolate = Isolate::GetCurrent();
+		Local<Value> field = obj->Get(v8::String::NewFromUtf8(isolate, key, v8::String::kInternalizedString));
+		has = !field->IsUndefined() && !field->IsNull();
+		if (!has) {
+			return true;
+		}
+		if (!field->IsString()) {
+			return false;
+		}
+		String::Utf8Value str(field);
+		value.assign(*str, str.length());
+		return true;
+	}
+
+	// {name, protocol, model, parameters: {name: value, ...}}, all optional
+	bool GetDeviceSpec(Local<Value> value, DeviceSpec &spec) {
+		Isolate* isolate = Isolate::GetCurrent();
+		if (!value->IsObject()) {
+			return false;
+		}
+		Local<Object> obj = value->ToObject();
+		if (!GetSpecString(obj, "name", spec.hasName, spec.name)
+			|| !GetSpecString(obj, "protocol", spec.hasProtocol, spec.protocol)
+			|| !GetSpecString(obj, "model", spec.hasModel, spec.model)) {
+			return false;
+		}
+
+		spec.parameters.clear();
+		Local<Value> parameters = obj->Get(v8::String::NewFromUtf8(isolate, "parameters", v8::String::kInternalizedString));
+		if (parameters->IsUndefined() || parameters->IsNull()) {
+			return true;
+		}
+		if (!parameters->IsObject()) {
+			return false;
+		}
+		Local<Object> params = parameters->ToObject();
+		Local<Array> names = params->GetOwnPropertyNames();
+		for (uint32_t i = 0; i < names->Length(); i++) {
+			Local<Value> name = names->Get(i);
+			Local<Value> parameter = params->Get(name);
+			if (!parameter->IsString()) {
+				return false;
+			}
+			String::Utf8Value nameStr(name);
+			String::Utf8Value valueStr(parameter);
+			spec.parameters.push_back(make_pair(string(*nameStr, nameStr.length()), string(*valueStr, valueStr.length())));
+		}
+		return true;
+	}
+
+	// Fill a create_work from ([spec, ...]), throws and returns false on bad input
+	bool InitCreateWork(const v8::FunctionCallbackInfo<v8::Value>& args, create_work *work) {
+		Isolate* isolate = Isolate::GetCurrent();
+
+		bool valid = args[0]->IsArray();
+		if (valid) {
+			Local<Array> specs = Local<Array>::Cast(args[0]);
+			work->specs.resize(specs->Length());
+			for (uint32_t i = 0; valid && i < specs->Length(); i++) {
+				valid = GetDeviceSpec(specs->Get(i), work->specs[i]);
+			}
+		}
+		if (!valid) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected an array of {name, protocol, model, parameters} with string values"));
+			isolate->ThrowException(exception);
+			return false;
+		}
+		return true;
+	}
+
+	// Devices are created one after the other, a failing one is rolled
+	// back on its own and does not stop the rest.
+	void RunCreateWork(uv_work_t* req) {
+		create_work* work = static_cast<create_work*>(req->data);
+
+		work->results.resize(work->specs.size());
+		for (size_t i = 0; i < work->specs.size(); i++) {
+			work->results[i] = provisionDevice(work->specs[i]);
+		}
+	}
+
+	void RunCreateCallback(uv_work_t* req, int status) {
+		Isolate* isolate = Isolate::GetCurrent();
+		HandleScope scope(isolate);
+		create_work* work = static_cast<create_work*>(req->data);
 
-			// Return Number
-		case 0:
-		case 1:
-		case 2:
-		case 3:
-		case 4:
-		case 11:
-		case 13:
-		case 17:
-		case 18:
-		case 19:
-		case 20:
-		case 23:
-		case 24:
-		case 25:
-			argv[0] = Integer::New(isolate, work->rn); // Return number value
-			argv[1] = Integer::New(isolate, work->f); // Return worktype
+		Handle<Value> argv[1];
+		if (status == 0) {
+			breakerSuccess();
+		}
+		if (status != 0) {
+			argv[0] = Integer::New(isolate, ErrorForStatus(status));
+		} else {
+			argv[0] = NewInt32Array(isolate, work->results);
+		}
+
+		TryCatch try_catch;
+		if (!work->callback.IsEmpty()) {
+			Local<Function> callback = Local<Function>::New(isolate, work->callback);
+			callback->Call(isolate->GetCurrentContext()->Global(), 1, argv);
+		}
+		if (try_catch.HasCaught()) {
+			node::FatalException(try_catch);
+		}
 
-			//work->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+		work->callback.Reset();
+		createPool.destroy(work);
+	}
 
-			break;
+	void CreateDevices(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		create_work* work = createPool.create();
+		if (!InitCreateWork(args, work)) {
+			createPool.destroy(work);
+			return;
+		}
 
-			// Return boolean
-		case 5:
-		case 7:
-		case 9:
-		case 12:
-		case 15:
-		case 16:
-		case 22:
-			argv[0] = Boolean::New(isolate, work->rb); // Return number value
-			argv[1] = Integer::New(isolate, work->f); // Return worktype
+		work->req.data = work;
+		if (args[1]->IsFunction()) {
+			work->callback.Reset(isolate, Local<Function>::Cast(args[1]));
+		}
 
-			//work->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+		if (!breakerAllow()) {
+			executorFail(&work->req, (uv_after_work_cb)RunCreateCallback, STATUS_CIRCUIT_OPEN);
+			return;
+		}
+		// The whole import is one job
+		executorQueueWork(LANE_QUERY, &work->req, RunCreateWork, (uv_after_work_cb)RunCreateCallback, PRIORITY_INTERACTIVE);
+	}
 
-			break;
+	void RunSyncCreateWork(uv_work_t* req) {
+		RunCreateWork(req);
+		SyncWaitSignal(&static_cast<create_work*>(req->data)->wait);
+	}
 
-			// Return String
-		case 6:
-		case 8:
-		case 10:
-		case 14:
-		case 21:
-			argv[0] = v8::String::NewFromUtf8(isolate, work->rs); // Return string value
-			argv[1] = Integer::New(isolate, work->f); // Return callback function
+	void AfterSyncCreateWork(uv_work_t* req, int status) {
+		create_work* work = static_cast<create_work*>(req->data);
+		SyncWaitDestroy(&work->wait);
+		createPool.destroy(work);
+	}
 
-			//work->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+	// ([spec, ...], timeout), like SyncBulkCaller every spec gets the
+	// error if the circuit is open or the import doesn't finish in time
+	void CreateDevicesSync(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+		double timeout = TimeoutArgument(args[1], syncTimeout);
 
-			break;
+		create_work* work = createPool.create();
+		if (!InitCreateWork(args, work)) {
+			createPool.destroy(work);
+			return;
+		}
+		work->req.data = work;
+
+		vector<int> results;
+		if (!breakerAllow()) {
+			results.assign(work->specs.size(), ERROR_CIRCUIT_OPEN);
+			createPool.destroy(work);
+		} else if (timeout <= 0) {
+			RunCreateWork(&work->req);
+			breakerSuccess();
+			results.swap(work->results);
+			createPool.destroy(work);
+		} else {
+			uint64_t deadline = DeadlineIn(timeout);
+			SyncWaitInit(&work->wait);
+			// Freed by AfterSyncCreateWork whatever happens here
+			if (executorQueueWork(LANE_QUERY, &work->req, RunSyncCreateWork, AfterSyncCreateWork, PRIORITY_INTERACTIVE, deadline) != 0) {
+				results.assign(work->specs.size(), ERROR_QUEUE_FULL);
+			} else if (!SyncWaitUntil(&work->wait, deadline)) {
+				breakerTimeout();
+				results.assign(work->specs.size(), ERROR_TIMEOUT);
+			} else {
+				breakerSuccess();
+				results = work->results;
+			}
+		}
+
+		args.GetReturnValue().Set(NewInt32Array(isolate, results));
+	}
+
+	// Called by the command queue on the loop thread, waiter is the JS callback
+	void ResolveCommandWaiter(void *waiter, int result) {
+		if (!waiter) {
+			return;
+		}
+		Isolate* isolate = Isolate::GetCurrent();
+		HandleScope scope(isolate);
+		Persistent<Function> *callback = static_cast<Persistent<Function> *>(waiter);
+
+		Local<Value> argv[] = { Integer::New(isolate, result) };
+
+		TryCatch try_catch;
+		Local<Function> func = Local<Function>::New(isolate, *callback);
+		func->Call(isolate->GetCurrentContext()->Global(), 1, argv);
+		if (try_catch.HasCaught()) {
+			node::FatalException(try_catch);
+		}
 
-			// Return list<telldusDeviceInternals>
-		case 26:
-			//argv[0] = getDevicesFromInternals(work->l); // Return Object
-			argv[1] = Integer::New(isolate, work->f); // Return callback function
+		callback->Reset();
+		delete callback;
+	}
 
-			//work->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+	void QueueCommand(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
 
+		int method;
+		switch (args[0]->Int32Value()) {
+		case 0:
+			method = TELLSTICK_TURNON;
+			break;
+		case 1:
+			method = TELLSTICK_TURNOFF;
 			break;
+		case 2:
+			method = TELLSTICK_DIM;
+			break;
+		default:
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Only turnOn (0), turnOff (1) and dim (2) can be queued"));
+			isolate->ThrowException(exception);
+			return;
+		}
 
+		Persistent<Function> *callback = 0;
+		if (args[3]->IsFunction()) {
+			callback = new Persistent<Function>(isolate, Local<Function>::Cast(args[3]));
 		}
 
-		// Handle any exceptions thrown inside the callback
+		commandQueueSubmit(args[1]->Int32Value(), method, args[2]->Int32Value(), callback);
+	}
+
+	void getCommandQueueStats(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		CommandQueueStats stats;
+		commandQueueStats(stats);
+
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "submitted", v8::String::kInternalizedString), Number::New(isolate, (double)stats.submitted));
+		obj->Set(v8::String::NewFromUtf8(isolate, "sent", v8::String::kInternalizedString), Number::New(isolate, (double)stats.sent));
+		obj->Set(v8::String::NewFromUtf8(isolate, "coalesced", v8::String::kInternalizedString), Number::New(isolate, (double)stats.coalesced));
+		obj->Set(v8::String::NewFromUtf8(isolate, "dropped", v8::String::kInternalizedString), Number::New(isolate, (double)stats.dropped));
+		obj->Set(v8::String::NewFromUtf8(isolate, "pendingDevices", v8::String::kInternalizedString), Integer::New(isolate, stats.pendingDevices));
+		args.GetReturnValue().Set(obj);
+	}
+
+	void ResolveSceneWaiter(void *waiter, int sceneId, const vector<int> &results, bool cancelled) {
+		Isolate* isolate = Isolate::GetCurrent();
+		HandleScope scope(isolate);
+		Persistent<Function> *callback = static_cast<Persistent<Function> *>(waiter);
+
+		Handle<Value> argv[3];
+		argv[0] = Integer::New(isolate, TELLSTICK_SUCCESS);
+		argv[1] = NewInt32Array(isolate, results);
+		argv[2] = Boolean::New(isolate, cancelled);
+
+		TryCatch try_catch;
+		Local<Function> func = Local<Function>::New(isolate, *callback);
+		func->Call(isolate->GetCurrentContext()->Global(), 3, argv);
 		if (try_catch.HasCaught()) {
 			node::FatalException(try_catch);
 		}
 
-		// Check if we have an allocated string from telldus
-		if (work->string_used) {
-			tdReleaseString(work->rs);
+		callback->Reset();
+		delete callback;
+	}
+
+	void RunScene(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		vector<int> methods, ids, values, delays;
+		if (!GetIntList(args[0], methods) || !GetIntList(args[1], ids) || !GetIntList(args[2], values) || !GetIntList(args[3], delays)
+			|| ids.size() != methods.size() || values.size() != methods.size() || delays.size() != methods.size()
+			|| !args[5]->IsFunction()) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected arguments: (methods, ids, values, delays, number priority, function callback), lists of equal length"));
+			isolate->ThrowException(exception);
+			return;
 		}
 
-		// properly cleanup, or death by millions of tiny leaks
-		//work->callback.Dispose();
-		//work->callback.Clear();
+		vector<SceneStep> steps(methods.size());
+		for (size_t i = 0; i < steps.size(); i++) {
+			if (LaneFor(methods[i]) != LANE_COMMAND || delays[i] < 0) {
+				v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Scene steps must be commands with a delay of 0 or more"));
+				isolate->ThrowException(exception);
+				return;
+			}
+			steps[i].method = methods[i];
+			steps[i].deviceId = ids[i];
+			steps[i].value = values[i];
+			steps[i].delay = (uint32_t)delays[i];
+		}
+
+		int priority = args[4]->IsNumber() ? args[4]->Int32Value() : PRIORITY_AUTOMATION;
+		Persistent<Function> *callback = new Persistent<Function>(isolate, Local<Function>::Cast(args[5]));
+		args.GetReturnValue().Set(Integer::New(isolate, sceneSubmit(steps, priority, callback)));
+	}
+
+	void CancelScene(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+		args.GetReturnValue().Set(Boolean::New(isolate, sceneCancel(args[0]->Int32Value())));
+	}
 
-		free(work->s); // char* Created in AsyncCaller
-		free(work->s2); // char* Created in AsyncCaller
+	void getSceneStats(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
 
-		delete work;
+		SceneStats stats;
+		sceneStats(stats);
 
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "submitted", v8::String::kInternalizedString), Number::New(isolate, (double)stats.submitted));
+		obj->Set(v8::String::NewFromUtf8(isolate, "completed", v8::String::kInternalizedString), Number::New(isolate, (double)stats.completed));
+		obj->Set(v8::String::NewFromUtf8(isolate, "cancelled", v8::String::kInternalizedString), Number::New(isolate, (double)stats.cancelled));
+		obj->Set(v8::String::NewFromUtf8(isolate, "active", v8::String::kInternalizedString), Integer::New(isolate, stats.active));
+		obj->Set(v8::String::NewFromUtf8(isolate, "steps", v8::String::kInternalizedString), Number::New(isolate, (double)stats.steps));
+		obj->Set(v8::String::NewFromUtf8(isolate, "lateAvgMs", v8::String::kInternalizedString), Number::New(isolate, stats.steps ? stats.lateTotal / 1e6 / (double)stats.steps : 0));
+		obj->Set(v8::String::NewFromUtf8(isolate, "lateMaxMs", v8::String::kInternalizedString), Number::New(isolate, stats.lateMax / 1e6));
+		args.GetReturnValue().Set(obj);
 	}
 
-	void AsyncCaller(const v8::FunctionCallbackInfo<v8::Value>& args){
-		Isolate* isolate = Isolate::GetCurrent(); // returns NULL
-		if (!isolate) {
-			isolate = Isolate::New();
-			isolate->Enter();
+	void ConfigureAirtime(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		if (!args[0]->IsNumber() || !args[1]->IsNumber()) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected arguments: (number controllerId, number rate, [number burst])"));
+			isolate->ThrowException(exception);
+			return;
 		}
-		// Make sure we don't get any funky data
-		if (!args[0]->IsNumber() || !args[1]->IsNumber() || !args[2]->IsNumber() || !args[3]->IsString() || !args[4]->IsString()) {
-			//return ThrowException(Exception::TypeError(v8::String::NewFromUtf8(isolate,"Wrong arguments")));
+
+		airtimeConfigure(args[0]->Int32Value(), args[1]->NumberValue(), args[2]->IsNumber() ? args[2]->NumberValue() : 1);
+	}
+
+	void SetDeviceController(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		if (!args[0]->IsNumber() || !args[1]->IsNumber()) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected arguments: (number deviceId, number controllerId)"));
+			isolate->ThrowException(exception);
+			return;
 		}
 
-		// Make a deep copy of the string argument as we don't want
-		// it memory managed by v8 in the worker thread
-		String::Utf8Value str(args[3]);
-		char * str_copy = strdup(*str); // Deleted at end of RunCallback
+		airtimeSetDeviceController(args[0]->Int32Value(), args[1]->Int32Value());
+	}
 
-		String::Utf8Value str2(args[4]);
-		char * str_copy2 = strdup(*str2); // Deleted at end of RunCallback
+	Local<Object> GetAirtimeLaneStats(Isolate* isolate, int priority) {
+		AirtimeLaneStats stats;
+		airtimeLaneStats(priority, stats);
+
+		Local<Array> bounds = Array::New(isolate, AIRTIME_HISTOGRAM_BUCKETS);
+		Local<Array> counts = Array::New(isolate, AIRTIME_HISTOGRAM_BUCKETS);
+		for (int i = 0; i < AIRTIME_HISTOGRAM_BUCKETS; i++) {
+			if (AIRTIME_HISTOGRAM_BOUNDS[i] < 0) {
+				bounds->Set(i, Number::New(isolate, std::numeric_limits<double>::infinity()));
+			} else {
+				bounds->Set(i, Number::New(isolate, AIRTIME_HISTOGRAM_BOUNDS[i]));
+			}
+			counts->Set(i, Number::New(isolate, (double)stats.histogram[i]));
+		}
 
-		js_work* work = new js_work;
-		work->f = args[0]->NumberValue(); // Worktype
-		work->devID = args[1]->NumberValue(); // Device ID
-		work->v = args[2]->NumberValue(); // Arbitrary number value
-		work->s = str_copy; // Arbitrary string value
-		work->s2 = str_copy2; // Arbitrary string value
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "count", v8::String::kInternalizedString), Number::New(isolate, (double)stats.count));
+		obj->Set(v8::String::NewFromUtf8(isolate, "waitAvgMs", v8::String::kInternalizedString), Number::New(isolate, stats.count ? stats.waitTotal / 1e6 / (double)stats.count : 0));
+		obj->Set(v8::String::NewFromUtf8(isolate, "waitMaxMs", v8::String::kInternalizedString), Number::New(isolate, stats.waitMax / 1e6));
+		obj->Set(v8::String::NewFromUtf8(isolate, "histogramBoundsMs", v8::String::kInternalizedString), bounds);
+		obj->Set(v8::String::NewFromUtf8(isolate, "histogram", v8::String::kInternalizedString), counts);
+		return obj;
+	}
 
-		work->req.data = work;
-		//work->callback = Persistent<Function>::New(Handle<Function>::Cast(args[5]));
+	void getAirtimeStats(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
 
-		uv_queue_work(uv_default_loop(), &work->req, RunWork, (uv_after_work_cb)RunCallback);
+		Local<Object> lanes = Object::New(isolate);
+		lanes->Set(v8::String::NewFromUtf8(isolate, "interactive", v8::String::kInternalizedString), GetAirtimeLaneStats(isolate, PRIORITY_INTERACTIVE));
+		lanes->Set(v8::String::NewFromUtf8(isolate, "automation", v8::String::kInternalizedString), GetAirtimeLaneStats(isolate, PRIORITY_AUTOMATION));
+		lanes->Set(v8::String::NewFromUtf8(isolate, "background", v8::String::kInternalizedString), GetAirtimeLaneStats(isolate, PRIORITY_BACKGROUND));
+
+		int count = airtimeControllerCount();
+		Local<Array> controllers = Array::New(isolate, count);
+		for (int i = 0; i < count; i++) {
+			AirtimeControllerStats stats;
+			airtimeControllerStats(i, stats);
+
+			Local<Object> controller = Object::New(isolate);
+			controller->Set(v8::String::NewFromUtf8(isolate, "id", v8::String::kInternalizedString), Integer::New(isolate, stats.controllerId));
+			controller->Set(v8::String::NewFromUtf8(isolate, "rate", v8::String::kInternalizedString), Number::New(isolate, stats.rate));
+			controller->Set(v8::String::NewFromUtf8(isolate, "burst", v8::String::kInternalizedString), Number::New(isolate, stats.burst));
+			controller->Set(v8::String::NewFromUtf8(isolate, "tokens", v8::String::kInternalizedString), Number::New(isolate, stats.tokens));
+			controller->Set(v8::String::NewFromUtf8(isolate, "sent", v8::String::kInternalizedString), Number::New(isolate, (double)stats.sent));
+			controller->Set(v8::String::NewFromUtf8(isolate, "waiting", v8::String::kInternalizedString), Integer::New(isolate, stats.waiting));
+			controllers->Set(i, controller);
+		}
 
-		Local<String> retstr = v8::String::NewFromUtf8(isolate, "Running asynchronous process initializer");
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "lanes", v8::String::kInternalizedString), lanes);
+		obj->Set(v8::String::NewFromUtf8(isolate, "controllers", v8::String::kInternalizedString), controllers);
+		args.GetReturnValue().Set(obj);
+	}
 
-		args.GetReturnValue().Set(retstr);
+	void SetSnapshotThreads(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		if (!args[0]->IsNumber()) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected 1 argument: (number threads)"));
+			isolate->ThrowException(exception);
+			return;
+		}
+
+		// Hands back the previous setting so callers can restore it
+		int previous = getSnapshotThreads();
+		setSnapshotThreads(args[0]->Int32Value());
+		args.GetReturnValue().Set(Integer::New(isolate, previous));
+	}
+
+	void CachedCaller(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		// Only a lookup, nothing is sent to telldusd
+		String::Utf8Value str(args[2]);
+		String::Utf8Value str2(args[3]);
+
+		js_work work;
+		work.f = args[0]->NumberValue(); // Worktype
+		work.devID = args[1]->NumberValue(); // Device ID
+		work.s = *str;
+		work.s2 = *str2;
+
+		if (!CachedMetadata(&work)) {
+			return; // undefined, caller has to ask telldusd
+		}
+		args.GetReturnValue().Set(OperationResultValue(isolate, &work));
+	}
+
+	void ConfigureExecutor(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		if (!args[0]->IsNumber() || args[0]->Int32Value() < 0 || args[0]->Int32Value() >= LANE_COUNT) {
+			v8::Local<v8::Value> exception = Exception::TypeError(v8::String::NewFromUtf8(isolate, "Expected arguments: (number lane, number threads, number queueLimit)"));
+			isolate->ThrowException(exception);
+			return;
+		}
+
+		executorConfigure((ExecutorLane)args[0]->Int32Value(), args[1]->Int32Value(), args[2]->Int32Value());
+	}
+
+	Local<Object> GetExecutorLaneStats(Isolate* isolate, ExecutorLane lane) {
+		ExecutorLaneStats stats;
+		executorStats(lane, stats);
+
+		double started = stats.started ? (double)stats.started : 1;
+		double completed = stats.completed ? (double)stats.completed : 1;
+
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "threads", v8::String::kInternalizedString), Integer::New(isolate, stats.threads));
+		obj->Set(v8::String::NewFromUtf8(isolate, "queueLimit", v8::String::kInternalizedString), Integer::New(isolate, stats.queueLimit));
+		obj->Set(v8::String::NewFromUtf8(isolate, "depth", v8::String::kInternalizedString), Integer::New(isolate, stats.depth));
+		obj->Set(v8::String::NewFromUtf8(isolate, "maxDepth", v8::String::kInternalizedString), Integer::New(isolate, stats.maxDepth));
+		obj->Set(v8::String::NewFromUtf8(isolate, "queued", v8::String::kInternalizedString), Number::New(isolate, (double)stats.queued));
+		obj->Set(v8::String::NewFromUtf8(isolate, "rejected", v8::String::kInternalizedString), Number::New(isolate, (double)stats.rejected));
+		obj->Set(v8::String::NewFromUtf8(isolate, "started", v8::String::kInternalizedString), Number::New(isolate, (double)stats.started));
+		obj->Set(v8::String::NewFromUtf8(isolate, "completed", v8::String::kInternalizedString), Number::New(isolate, (double)stats.completed));
+		obj->Set(v8::String::NewFromUtf8(isolate, "waitAvgMs", v8::String::kInternalizedString), Number::New(isolate, stats.waitTotal / 1e6 / started));
+		obj->Set(v8::String::NewFromUtf8(isolate, "waitMaxMs", v8::String::kInternalizedString), Number::New(isolate, stats.waitMax / 1e6));
+		obj->Set(v8::String::NewFromUtf8(isolate, "runAvgMs", v8::String::kInternalizedString), Number::New(isolate, stats.runTotal / 1e6 / completed));
+		obj->Set(v8::String::NewFromUtf8(isolate, "runMaxMs", v8::String::kInternalizedString), Number::New(isolate, stats.runMax / 1e6));
+		obj->Set(v8::String::NewFromUtf8(isolate, "expired", v8::String::kInternalizedString), Number::New(isolate, (double)stats.expired));
+		obj->Set(v8::String::NewFromUtf8(isolate, "overran", v8::String::kInternalizedString), Number::New(isolate, (double)stats.overran));
+		return obj;
+	}
+
+	void getExecutorStats(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "command", v8::String::kInternalizedString), GetExecutorLaneStats(isolate, LANE_COMMAND));
+		obj->Set(v8::String::NewFromUtf8(isolate, "query", v8::String::kInternalizedString), GetExecutorLaneStats(isolate, LANE_QUERY));
+		args.GetReturnValue().Set(obj);
+	}
+
+	// (syncTimeout, asyncTimeout, threshold, cooldown), negative or missing values are left alone
+	void ConfigureDeadlines(const v8::FunctionCallbackInfo<v8::Value>& args){
+		if (args[0]->IsNumber() && args[0]->NumberValue() >= 0) {
+			syncTimeout = args[0]->NumberValue();
+		}
+		if (args[1]->IsNumber() && args[1]->NumberValue() >= 0) {
+			asyncTimeout = args[1]->NumberValue();
+		}
+		breakerConfigure(args[2]->IsNumber() ? args[2]->Int32Value() : 0, args[3]->IsNumber() ? args[3]->Int32Value() : 0);
+	}
+
+	void getHealth(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		BreakerStats stats;
+		breakerStats(stats);
+
+		const char* state = stats.state == BREAKER_OPEN ? "open" : stats.state == BREAKER_HALF_OPEN ? "halfOpen" : "closed";
+
+		Local<Object> obj = Object::New(isolate);
+		obj->Set(v8::String::NewFromUtf8(isolate, "state", v8::String::kInternalizedString), v8::String::NewFromUtf8(isolate, state, v8::String::kInternalizedString));
+		obj->Set(v8::String::NewFromUtf8(isolate, "threshold", v8::String::kInternalizedString), Integer::New(isolate, stats.threshold));
+		obj->Set(v8::String::NewFromUtf8(isolate, "cooldownMs", v8::String::kInternalizedString), Number::New(isolate, (double)stats.cooldown));
+		obj->Set(v8::String::NewFromUtf8(isolate, "consecutiveTimeouts", v8::String::kInternalizedString), Integer::New(isolate, stats.consecutiveTimeouts));
+		obj->Set(v8::String::NewFromUtf8(isolate, "timeouts", v8::String::kInternalizedString), Number::New(isolate, (double)stats.timeouts));
+		obj->Set(v8::String::NewFromUtf8(isolate, "successes", v8::String::kInternalizedString), Number::New(isolate, (double)stats.successes));
+		obj->Set(v8::String::NewFromUtf8(isolate, "rejected", v8::String::kInternalizedString), Number::New(isolate, (double)stats.rejected));
+		obj->Set(v8::String::NewFromUtf8(isolate, "trips", v8::String::kInternalizedString), Number::New(isolate, (double)stats.trips));
+		obj->Set(v8::String::NewFromUtf8(isolate, "probes", v8::String::kInternalizedString), Number::New(isolate, (double)stats.probes));
+		obj->Set(v8::String::NewFromUtf8(isolate, "openForMs", v8::String::kInternalizedString), Number::New(isolate, (double)stats.openFor));
+		obj->Set(v8::String::NewFromUtf8(isolate, "syncTimeoutMs", v8::String::kInternalizedString), Number::New(isolate, syncTimeout));
+		obj->Set(v8::String::NewFromUtf8(isolate, "asyncTimeoutMs", v8::String::kInternalizedString), Number::New(isolate, asyncTimeout));
+		args.GetReturnValue().Set(obj);
+	}
+
+	void getPoolStats(const v8::FunctionCallbackInfo<v8::Value>& args){
+		Isolate* isolate = Isolate::GetCurrent();
+
+		vector<PoolStats> pools;
+		poolStatsAll(pools);
+
+		Local<Object> obj = Object::New(isolate);
+		for (size_t i = 0; i < pools.size(); i++) {
+			const PoolStats &stats = pools[i];
+			Local<Object> pool = Object::New(isolate);
+			pool->Set(v8::String::NewFromUtf8(isolate, "recordSize", v8::String::kInternalizedString), Number::New(isolate, (double)stats.recordSize));
+			pool->Set(v8::String::NewFromUtf8(isolate, "allocations", v8::String::kInternalizedString), Number::New(isolate, (double)stats.allocations));
+			pool->Set(v8::String::NewFromUtf8(isolate, "slabs", v8::String::kInternalizedString), Number::New(isolate, (double)stats.slabs));
+			pool->Set(v8::String::NewFromUtf8(isolate, "inUse", v8::String::kInternalizedString), Number::New(isolate, (double)stats.inUse));
+			pool->Set(v8::String::NewFromUtf8(isolate, "peak", v8::String::kInternalizedString), Number::New(isolate, (double)stats.peak));
+			pool->Set(v8::String::NewFromUtf8(isolate, "capacity", v8::String::kInternalizedString), Number::New(isolate, (double)stats.capacity));
+			obj->Set(v8::String::NewFromUtf8(isolate, stats.name, v8::String::kInternalizedString), pool);
+		}
+
+		ArenaStats arena;
+		arenaStats(arena);
+		Local<Object> strings = Object::New(isolate);
+		strings->Set(v8::String::NewFromUtf8(isolate, "allocations", v8::String::kInternalizedString), Number::New(isolate, (double)arena.allocations));
+		strings->Set(v8::String::NewFromUtf8(isolate, "oversized", v8::String::kInternalizedString), Number::New(isolate, (double)arena.oversized));
+		strings->Set(v8::String::NewFromUtf8(isolate, "bytes", v8::String::kInternalizedString), Number::New(isolate, (double)arena.bytes));
+		strings->Set(v8::String::NewFromUtf8(isolate, "peakBytes", v8::String::kInternalizedString), Number::New(isolate, (double)arena.peakBytes));
+		strings->Set(v8::String::NewFromUtf8(isolate, "chunks", v8::String::kInternalizedString), Number::New(isolate, (double)arena.chunks));
+		strings->Set(v8::String::NewFromUtf8(isolate, "peakChunks", v8::String::kInternalizedString), Number::New(isolate, (double)arena.peakChunks));
+		obj->Set(v8::String::NewFromUtf8(isolate, "strings", v8::String::kInternalizedString), strings);
+
+		args.GetReturnValue().Set(obj);
 	}
 
 	void SyncCaller(const v8::FunctionCallbackInfo<v8::Value>& args){
@@ -675,173 +2633,141 @@ namespace telldus_v8 {
 			//return ThrowException(Exception::TypeError(v8::String::NewFromUtf8(isolate,"Wrong arguments")));
 		}
 
-		// Make a deep copy of the string argument
+		// Runs right here, the string arguments can be used as they are
 		String::Utf8Value str(args[3]);
-		char * str_copy = strdup(*str); // Deleted at end of this function
-
 		String::Utf8Value str2(args[4]);
-		char * str_copy2 = strdup(*str2); // Deleted at end of this function
 
-		js_work* work = new js_work;
+		// Nothing outlives this call, no need to allocate the work record
+		js_work syncWork;
+		js_work* work = &syncWork;
 		work->f = args[0]->NumberValue(); // Worktype
 		work->devID = args[1]->NumberValue(); // Device ID
+		work->version = VersionArgument(args[1]); // Or version, for getDevicesSince
 		work->v = args[2]->NumberValue(); // Arbitrary number value
-		work->s = str_copy; // Arbitrary string value
-		work->s2 = str_copy2; // Arbitrary string value
+		work->s = *str; // Arbitrary string value
+		work->s2 = *str2; // Arbitrary string value
 
 		work->string_used = false; // Used to keep track of used telldus strings
+		work->priority = PRIORITY_INTERACTIVE;
+		work->sync = true;
+		work->deadline = 0; // Set by CompleteSync if it has one
 
-		// Run requested operation
-		switch (work->f) {
-		case 0:
-			work->rn = tdTurnOn(work->devID);
-			break;
-		case 1:
-			work->rn = tdTurnOff(work->devID);
-			break;
-		case 2:
-			work->rn = tdDim(work->devID, (unsigned char)work->v);
-			break;
-		case 3:
-			work->rn = tdLearn(work->devID);
-			break;
-		case 4:
-			work->rn = tdAddDevice();
-			break;
-		case 5: // SetName
-			work->rb = tdSetName(work->devID, work->s);
-			break;
-		case 6: // GetName
-			work->rs = tdGetName(work->devID);
-			work->string_used = true;
-			break;
-		case 7: // SetProtocol
-			work->rb = tdSetProtocol(work->devID, work->s);
-			break;
-		case 8: // GetProtocol
-			work->rs = tdGetProtocol(work->devID);
-			work->string_used = true;
-			break;
-		case 9: // SetModel
-			work->rb = tdSetModel(work->devID, work->s);
-			break;
-		case 10: // GetModel
-			work->rs = tdGetModel(work->devID);
-			work->string_used = true;
-			break;
-		case 11: // GetDeviceType
-			work->rn = tdGetDeviceType(work->devID);
-			break;
-		case 12:
-			work->rb = tdRemoveDevice(work->devID);
-			break;
-		case 13:
-			work->rn = tdUnregisterCallback(work->devID);
-			break;
-		case 14: // GetModel
-			work->rs = tdGetErrorString(work->devID);
-			work->string_used = true;
-			break;
-		case 15: // tdInit();
-			tdInit();
-			work->rb = true; // tdInit() has no return value, so we augment true for a return value
-			break;
-		case 16: // tdClose();
-			tdClose();
-			work->rb = true; // tdClose() has no return value, so we augment true for a return value
-			break;
-		case 17: // tdGetNumberOfDevices();
-			work->rn = tdGetNumberOfDevices();
-			break;
-		case 18: // tdStop
-			work->rn = tdStop(work->devID);
-			break;
-		case 19: // tdBell
-			work->rn = tdBell(work->devID);
-			break;
-		case 20: // tdGetDeviceId(deviceIndex)
-			work->rn = tdGetDeviceId(work->devID);
-			break;
-		case 21: // tdGetDeviceParameter(deviceId, name, val)
-			work->rs = tdGetDeviceParameter(work->devID, work->s, work->s2);
-			work->string_used = true;
-			break;
-		case 22: // tdSetDeviceParameter(deviceId, name, val)
-			work->rb = tdSetDeviceParameter(work->devID, work->s, work->s2);
-			break;
-		case 23: // tdExecute
-			work->rn = tdExecute(work->devID);
-			break;
-		case 24: // tdUp
-			work->rn = tdUp(work->devID);
-			break;
-		case 25: // tdDown
-			work->rn = tdDown(work->devID);
-			break;
-		case 26: // getDevices
-			work->l = getDevicesRaw();
+		if (work->f == 13) { // Listeners live in our own table, see RemoveEventListener
+			args.GetReturnValue().Set(Integer::New(isolate, RemoveListener(work->devID)));
+			return;
+		}
+		if (!IsOperation(work->f)) {
+			isolate->ThrowException(Exception::TypeError(v8::String::NewFromUtf8(isolate, "Unknown operation")));
+			return;
 		}
 
-		// Run callback
-		Handle<Value> argv;
+		CompleteSync(args, work, TimeoutArgument(args[5], syncTimeout));
+	}
 
-		// Run the actual callback
-		switch (work->f) {
+	// Typed entry points, one sync and one async native per entry of
+	// TELLDUS_OPERATIONS. Each converts only the arguments its operation
+	// takes: (id, number, string, string) depending on OperationArgs,
+	// followed by (callback, priority, timeout) for the async ones and
+	// (timeout) for the sync ones. A timeout that isn't a number means the
+	// one set with configureDeadlines.
+
+	template <OperationArgs Args> struct OperationArgCount { static const int value = 0; };
+	template <> struct OperationArgCount<ARGS_ID> { static const int value = 1; };
+	template <> struct OperationArgCount<ARGS_ID_VALUE> { static const int value = 2; };
+	template <> struct OperationArgCount<ARGS_ID_STRING> { static const int value = 2; };
+	template <> struct OperationArgCount<ARGS_ID_STRING2> { static const int value = 3; };
+	template <> struct OperationArgCount<ARGS_VERSION> { static const int value = 1; };
+
+	// String arguments of a sync call, only converted where the operation takes them
+	template <OperationArgs Args> struct OperationStrings {
+		OperationStrings(const v8::FunctionCallbackInfo<v8::Value>& args) {}
+		void apply(js_work* work) {}
+	};
 
-			// Return Number
-		case 0:
-		case 1:
-		case 2:
-		case 3:
-		case 4:
-		case 11:
-		case 13:
-		case 17:
-		case 18:
-		case 19:
-		case 20:
-		case 23:
-		case 24:
-		case 25:
-			argv = Integer::New(isolate, work->rn); // Return number value
-			break;
+	template <> struct OperationStrings<ARGS_ID_STRING> {
+		OperationStrings(const v8::FunctionCallbackInfo<v8::Value>& args) : str(args[1]) {}
+		void apply(js_work* work) {
+			work->s = *str;
+		}
+		String::Utf8Value str;
+	};
 
-			// Return boolean
-		case 5:
-		case 7:
-		case 9:
-		case 12:
-		case 15:
-		case 16:
-		case 22:
-			argv = Boolean::New(isolate, work->rb); // Return number value
-			break;
+	template <> struct OperationStrings<ARGS_ID_STRING2> {
+		OperationStrings(const v8::FunctionCallbackInfo<v8::Value>& args) : str(args[1]), str2(args[2]) {}
+		void apply(js_work* work) {
+			work->s = *str;
+			work->s2 = *str2;
+		}
+		String::Utf8Value str;
+		String::Utf8Value str2;
+	};
 
-			// Return String
-		case 6:
-		case 8:
-		case 10:
-		case 14:
-		case 21:
-			argv = v8::String::NewFromUtf8(isolate, work->rs); // Return string value
-			break;
+	// Everything but the strings, which are handled by the callers
+	template <int Worktype, OperationArgs Args>
+	void FillOperation(js_work* work, const v8::FunctionCallbackInfo<v8::Value>& args) {
+		work->f = Worktype;
+		work->devID = Args == ARGS_NONE || Args == ARGS_VERSION ? 0 : args[0]->Int32Value();
+		work->v = Args == ARGS_ID_VALUE ? args[1]->Int32Value() : 0;
+		work->version = Args == ARGS_VERSION ? VersionArgument(args[0]) : 0;
+		work->s = 0;
+		work->s2 = 0;
+		work->string_used = false;
+		work->deadline = 0;
+	}
 
-			// Return list<telldusDeviceInternals>
-		case 26:
-			//argv = getDevicesFromInternals(work->l); // Return Object
-			break;
+	// Copied straight into the arena, the worker thread can't touch v8 strings
+	char* CopyStringArgument(Handle<Value> value) {
+		Local<String> str = value->ToString();
+		char* copy = arenaAlloc(str->Utf8Length());
+		str->WriteUtf8(copy);
+		return copy;
+	}
+
+	template <int Worktype, OperationArgs Args>
+	void OperationSync(const v8::FunctionCallbackInfo<v8::Value>& args) {
+		// Runs right here, the string arguments can be used as they are
+		OperationStrings<Args> strings(args);
+
+		js_work work;
+		FillOperation<Worktype, Args>(&work, args);
+		work.priority = PRIORITY_INTERACTIVE;
+		work.sync = true;
+		strings.apply(&work);
+
+		CompleteSync(args, &work, TimeoutArgument(args[OperationArgCount<Args>::value], syncTimeout));
+	}
+
+	template <int Worktype, OperationArgs Args>
+	void OperationAsync(const v8::FunctionCallbackInfo<v8::Value>& args) {
+		Isolate* isolate = Isolate::GetCurrent();
+		const int argc = OperationArgCount<Args>::value;
+
+		js_work* work = workPool.create();
+		FillOperation<Worktype, Args>(work, args);
+		work->priority = args[argc + 1]->IsNumber() ? args[argc + 1]->Int32Value() : PRIORITY_INTERACTIVE;
+		work->sync = false;
+		if (Args == ARGS_ID_STRING || Args == ARGS_ID_STRING2) {
+			work->s = CopyStringArgument(args[1]); // Released at end of RunCallback
+		}
+		if (Args == ARGS_ID_STRING2) {
+			work->s2 = CopyStringArgument(args[2]);
 		}
 
-		// Check if we have an allocated string from telldus
-		if (work->string_used) {
-			tdReleaseString(work->rs);
+		if (args[argc]->IsFunction()) {
+			work->callback.Reset(isolate, Local<Function>::Cast(args[argc]));
 		}
 
-		free(str_copy); // char* Created in the beginning of this function
-		free(str_copy2); // char* Created in beginning of this function
+		QueueOperation(work, TimeoutArgument(args[argc + 2], asyncTimeout));
+	}
 
-		delete work;
-		args.GetReturnValue().Set(argv);
+	void RegisterOperations(Isolate* isolate, Handle<Object> target) {
+#define X(name, worktype, arguments, result, lane, run, guard) \
+		target->Set(v8::String::NewFromUtf8(isolate, #name, v8::String::kInternalizedString), \
+			FunctionTemplate::New(isolate, OperationAsync<worktype, arguments>)->GetFunction()); \
+		target->Set(v8::String::NewFromUtf8(isolate, #name "Sync", v8::String::kInternalizedString), \
+			FunctionTemplate::New(isolate, OperationSync<worktype, arguments>)->GetFunction());
+		TELLDUS_OPERATIONS(X)
+#undef X
 	}
 
 }
@@ -854,6 +2780,28 @@ void init(Handle<Object> target) {
 		isolate->Enter();
 	}
 
+	telldus_v8::metadataCacheInit();
+	telldus_v8::deviceVersionsInit();
+	telldus_v8::dedupInit();
+	telldus_v8::InitOperations();
+	uv_mutex_init(&telldus_v8::initMutex);
+	telldus_v8::listenersInit();
+	uv_mutex_init(&telldus_v8::streamCallbackMutex);
+	telldus_v8::sensorStoreInit();
+	telldus_v8::airtimeInit();
+	telldus_v8::executorInit(uv_default_loop());
+	telldus_v8::breakerInit();
+	telldus_v8::commandQueueInit(telldus_v8::ResolveCommandWaiter);
+	telldus_v8::sceneInit(uv_default_loop(), telldus_v8::RunSceneStep, telldus_v8::ResolveSceneWaiter);
+	telldus_v8::InitInterned(isolate);
+	for (int i = 0; i < telldus_v8::RAW_KEY_COUNT; i++) {
+		telldus_v8::rawEventKeyNames[i].Set(isolate, String::NewFromUtf8(isolate, telldus_v8::RAW_EVENT_KEYS[i], v8::String::kInternalizedString));
+	}
+	telldus_v8::eventHubInit(uv_default_loop(),
+		telldus_v8::DispatchDeviceEvents,
+		telldus_v8::DispatchSensorEvents,
+		telldus_v8::DispatchRawDeviceEvents);
+
 	// Asynchronous function wrapper
 	target->Set(String::NewFromUtf8(isolate, "AsyncCaller", v8::String::kInternalizedString),
 		FunctionTemplate::New(isolate, telldus_v8::AsyncCaller)->GetFunction());
@@ -862,6 +2810,79 @@ void init(Handle<Object> target) {
 	target->Set(String::NewFromUtf8(isolate, "SyncCaller", v8::String::kInternalizedString),
 		FunctionTemplate::New(isolate, telldus_v8::SyncCaller)->GetFunction());
 
+	// turnOn, turnOnSync, getName, getNameSync, ...
+	telldus_v8::RegisterOperations(isolate, target);
+
+	// Metadata cache lookup, for serving async reads without a threadpool hop
+	target->Set(String::NewFromUtf8(isolate, "CachedCaller", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::CachedCaller)->GetFunction());
+
+	// Run one command for a list of devices in a single call
+	target->Set(String::NewFromUtf8(isolate, "AsyncBulkCaller", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::AsyncBulkCaller)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "SyncBulkCaller", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::SyncBulkCaller)->GetFunction());
+
+	// Create and configure devices, rolled back one by one on failure
+	target->Set(String::NewFromUtf8(isolate, "createDevices", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::CreateDevices)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "createDevicesSync", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::CreateDevicesSync)->GetFunction());
+
+	// Coalescing command queue
+	target->Set(String::NewFromUtf8(isolate, "QueueCommand", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::QueueCommand)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "getCommandQueueStats", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getCommandQueueStats)->GetFunction());
+
+	// Scenes
+	target->Set(String::NewFromUtf8(isolate, "RunScene", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::RunScene)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "CancelScene", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::CancelScene)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "getSceneStats", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getSceneStats)->GetFunction());
+
+	// Event journal
+	target->Set(String::NewFromUtf8(isolate, "OpenJournal", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::OpenJournal)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "CloseJournal", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::CloseJournal)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "getJournalStats", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getJournalStats)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "OpenJournalReader", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::OpenJournalReader)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "ReadJournal", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::ReadJournal)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "CloseJournalReader", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::CloseJournalReader)->GetFunction());
+
+	// Airtime scheduling
+	target->Set(String::NewFromUtf8(isolate, "configureAirtime", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::ConfigureAirtime)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "setDeviceController", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::SetDeviceController)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "getAirtimeStats", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getAirtimeStats)->GetFunction());
+
+	// Executor tuning and metrics
+	target->Set(String::NewFromUtf8(isolate, "configureExecutor", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::ConfigureExecutor)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "getExecutorStats", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getExecutorStats)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "getPoolStats", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getPoolStats)->GetFunction());
+
+	// Deadlines and telldusd health
+	target->Set(String::NewFromUtf8(isolate, "configureDeadlines", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::ConfigureDeadlines)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "getHealth", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getHealth)->GetFunction());
+
+	// Device snapshot tuning
+	target->Set(String::NewFromUtf8(isolate, "setSnapshotThreads", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::SetSnapshotThreads)->GetFunction());
+
 	// Functions to add event-listener callbacks
 	target->Set(String::NewFromUtf8(isolate, "addDeviceEventListener", v8::String::kInternalizedString),
 		FunctionTemplate::New(isolate, telldus_v8::addDeviceEventListener)->GetFunction());
@@ -870,5 +2891,35 @@ void init(Handle<Object> target) {
 	target->Set(String::NewFromUtf8(isolate, "addRawDeviceEventListener", v8::String::kInternalizedString),
 		FunctionTemplate::New(isolate, telldus_v8::addRawDeviceEventListener)->GetFunction());
 
+	// Same, but called once per loop iteration with an array of events
+	target->Set(String::NewFromUtf8(isolate, "addDeviceEventBatchListener", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::addDeviceEventBatchListener)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "addSensorEventBatchListener", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::addSensorEventBatchListener)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "addRawDeviceEventBatchListener", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::addRawDeviceEventBatchListener)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "RemoveEventListener", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::RemoveEventListener)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "getEventStats", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getEventStats)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "configureEventQueue", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::ConfigureEventQueue)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "configureDedup", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::ConfigureDedup)->GetFunction());
+
+	// Last known sensor values
+	target->Set(String::NewFromUtf8(isolate, "getSensors", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getSensors)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "getSensorValue", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getSensorValue)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "getSensorHistory", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getSensorHistory)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "configureSensorHistory", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::ConfigureSensorHistory)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "setSensorHistoryLimit", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::SetSensorHistoryLimit)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "getSensorHistoryStats", v8::String::kInternalizedString),
+		FunctionTemplate::New(isolate, telldus_v8::getSensorHistoryStats)->GetFunction());
+
 }
 NODE_MODULE(telldus, init)
@@ -3,82 +3,460 @@ var errors = require('./lib/errors');
 
 var statusEnum = {
   TELLSTICK_SUCCESS: 0,
+  TELLSTICK_ERROR_NOT_FOUND: -1,
   TELLSTICK_ERROR_DEVICE_NOT_FOUND: -3,
-  TELLSTICK_ERROR_UNKNOWN: -99
+  TELLSTICK_ERROR_UNKNOWN: -99,
+  TELLSTICK_ERROR_QUEUE_FULL: -100,
+  TELLSTICK_ERROR_CANCELLED: -101,
+  TELLSTICK_ERROR_TIMEOUT: -102,
+  TELLSTICK_ERROR_CIRCUIT_OPEN: -103
 };
 
+var lanes = {command: 0, query: 1};
+
+// Worktypes of the commands a scene step can run
+var sceneMethods = {
+  turnOn: 0,
+  turnOff: 1,
+  dim: 2,
+  stop: 18,
+  bell: 19,
+  execute: 23,
+  up: 24,
+  down: 25
+};
+
+var sensorValueTypeEnum = {
+  TELLSTICK_TEMPERATURE: 1,
+  TELLSTICK_HUMIDITY: 2,
+  TELLSTICK_RAINRATE: 4,
+  TELLSTICK_RAINTOTAL: 8,
+  TELLSTICK_WINDDIRECTION: 16,
+  TELLSTICK_WINDAVERAGE: 32,
+  TELLSTICK_WINDGUST: 64
+};
+
+// Native event streams, in the order of the addon's EventStream enum
+var eventStreams = {
+  device: 0,
+  sensor: 1,
+  raw: 2
+};
+
+// What happens to events beyond a stream's queue limit
+var overflowPolicies = {
+  dropNewest: 0,
+  dropOldest: 1,
+  latest: 2
+};
+
+var journalTypes = {
+  device: 1,
+  sensor: 2,
+  raw: 4
+};
+
+var priorityEnum = {
+  interactive: 0,
+  automation: 1,
+  background: 2
+};
+
+
+//set TELLDUS_LAZY_INIT to connect on first use or init() instead of at require time
+var lazyInit = !!process.env.TELLDUS_LAZY_INIT;
+var initialized = false;
+var initPromise = null;
+var native = telldus;
+
+
+/***
+ * Initialize the telldus library in the background, once
+ */
+var startInit = function () {
+  if (!initPromise) {
+    initPromise = new Promise(function (resolve, reject) {
+      native.init(function (result) {
+        if (result !== true) {
+          initPromise = null; // Try again on next use
+          return reject(new errors.TelldusError({code: result, message: 'Could not initialize telldus-core'}));
+        }
+        initialized = true;
+        resolve();
+      });
+    });
+  }
+  return initPromise;
+};
+
+
+/***
+ * Initialize the telldus library right here, waits for a background init in progress
+ */
+var ensureInitSync = function () {
+  if (!initialized) {
+    native.initSync();
+    initialized = true;
+  }
+};
 
-//initialize the telldus library
-telldus.SyncCaller(15, 0, 0, '', '');
+
+/***
+ * The native binding, with every call that talks to telldusd
+ * initializing the library first. Async operations wait for the
+ * background init, sync ones initialize on the spot.
+ * @param {Object} binding - the native binding
+ */
+var deferUntilInitialized = function (binding) {
+  var deferred = {};
+  Object.keys(binding).forEach(function (name) {
+    var fn = binding[name];
+    if (name === 'init' || name === 'initSync' || name === 'close' || name === 'closeSync') {
+      deferred[name] = fn;
+    }
+    else if (typeof binding[name + 'Sync'] === 'function') {
+      //async operation, results only ever go to the callback
+      deferred[name] = function () {
+        var args = arguments;
+        var call = function () { fn.apply(binding, args); };
+        if (initialized) {
+          return fn.apply(binding, args);
+        }
+        startInit().then(call, call);
+      };
+    }
+    else if (/Sync(Caller|BulkCaller)?$/.test(name) || name === 'getSensors' || name === 'getSensorValue') {
+      //sensor values are only seeded once initialized
+      deferred[name] = function () {
+        ensureInitSync();
+        return fn.apply(binding, arguments);
+      };
+    }
+    else if (/^(AsyncCaller|AsyncBulkCaller|QueueCommand|RunScene)$/.test(name) || /^add.*Listener$/.test(name)) {
+      //these hand back a value right away, get init going and carry on.
+      //listeners only get events once telldus-core is initialized
+      deferred[name] = function () {
+        if (!initialized) {
+          startInit().catch(function () {});
+        }
+        return fn.apply(binding, arguments);
+      };
+    }
+    else {
+      deferred[name] = fn;
+    }
+  });
+  return deferred;
+};
+
+
+if (lazyInit) {
+  telldus = deferUntilInitialized(native);
+}
+else {
+  //initialize the telldus library
+  native.initSync();
+  initialized = true;
+}
 
 //try to close before garbage collect
 process.on('exit', function () {
-  telldus.SyncCaller(16, 0, 0, '', '');
+  if (initialized) {
+    native.closeSync();
+  }
 });
 
 (function (exports) {
 
   exports.errors = errors;
-  exports.enums = {status:statusEnum};
+  exports.enums = {status:statusEnum, priority:priorityEnum, sensorValueType:sensorValueTypeEnum};
+
+  /***
+   * Readiness of the library, resolves once telldus-core is initialized.
+   * Starts the initialization if TELLDUS_LAZY_INIT deferred it.
+   * @param {Object} [options] - {devices: true, sensors: true} to prefetch
+   *   the device snapshot and sensor list, resolved as {devices, sensors}
+   */
+  exports.init = function (options) {
+    options = options || {};
+    var ready = initialized ? Promise.resolve() : startInit();
+    return ready.then(function () {
+      var prefetched = {};
+      if (options.sensors) {
+        prefetched.sensors = telldus.getSensors();
+      }
+      if (!options.devices) {
+        return prefetched;
+      }
+      return new Promise(function (resolve, reject) {
+        exports.getDevices(function (err, devices) {
+          if (err) {
+            return reject(err);
+          }
+          prefetched.devices = devices;
+          resolve(prefetched);
+        });
+      });
+    });
+  };
 
   // Async-only functions
-  exports.addDeviceEventListener = function (callback) { return telldus.addDeviceEventListener(callback); };
-  exports.addSensorEventListener = function (callback) { return telldus.addSensorEventListener(callback); };
-  exports.addRawDeviceEventListener = function (callback) { return telldus.addRawDeviceEventListener(callback); };
+  exports.addDeviceEventListener = function (callback, options) { return telldus.addDeviceEventListener(callback, options); };
+  exports.addSensorEventListener = function (callback, options) { return telldus.addSensorEventListener(callback, options); };
+  exports.addRawDeviceEventListener = function (callback, options) { return telldus.addRawDeviceEventListener(callback, options); };
+  exports.addDeviceEventBatchListener = function (callback, options) { return telldus.addDeviceEventBatchListener(callback, options); };
+  exports.addSensorEventBatchListener = function (callback, options) { return telldus.addSensorEventBatchListener(callback, options); };
+  exports.addRawDeviceEventBatchListener = function (callback, options) { return telldus.addRawDeviceEventBatchListener(callback, options); };
+  exports.getEventStats = function () {
+    var stats = telldus.getEventStats();
+    Object.keys(stats).forEach(function (stream) {
+      stats[stream].policy = overflowPolicyName(stats[stream].policy);
+    });
+    return stats;
+  };
+  exports.configureEventQueue = function (options) {
+    var stats = telldus.getEventStats();
+    Object.keys(eventStreams).forEach(function (stream) {
+      var settings = options.hasOwnProperty(stream) ? options[stream] : {};
+      var limit = pick(settings.limit, options.limit, stats[stream].limit);
+      var policy = pick(settings.policy, options.policy, overflowPolicyName(stats[stream].policy));
+      if (!overflowPolicies.hasOwnProperty(policy)) {
+        throw new TypeError('Unknown overflow policy: ' + policy);
+      }
+      telldus.configureEventQueue(eventStreams[stream], limit, overflowPolicies[policy]);
+    });
+  };
+  exports.configureDedup = function (options) {
+    Object.keys(eventStreams).forEach(function (stream) {
+      var window = options.hasOwnProperty(stream) ? options[stream] : options.window;
+      if (window !== undefined) {
+        telldus.configureDedup(eventStreams[stream], window);
+      }
+    });
+  };
+
+  // Last known sensor values, answered from memory (see README)
+  exports.getSensors = function () { return telldus.getSensors(); };
+  exports.getSensorValue = function (protocol, model, id, type) { return telldus.getSensorValue(protocol, model, id, type); };
+  exports.getSensorHistory = function (protocol, model, id, type, options) {
+    options = options || {};
+    var to = options.to !== undefined ? options.to : Math.floor(Date.now() / 1000) + 1;
+    var from = options.from !== undefined ? options.from : to - 24 * 60 * 60;
+    return telldus.getSensorHistory(protocol, model, id, type, from, to, options.bucket || 0);
+  };
+  exports.configureSensorHistory = function (options) {
+    if (options.samples !== undefined) {
+      telldus.configureSensorHistory(options.samples);
+    }
+    (options.sensors || []).forEach(function (sensor) {
+      telldus.setSensorHistoryLimit(sensor.protocol, sensor.model, sensor.id, sensor.type, sensor.samples);
+    });
+  };
+  exports.getSensorHistoryStats = function () { return telldus.getSensorHistoryStats(); };
+
+
+  /***
+   * Airtime priority for a single call, interactive unless asked otherwise
+   * @param {Object} options - {priority: name or number}
+   */
+  var callPriority = function (options) {
+    return options.priority === undefined ? priorityEnum.interactive : priorityOf(options);
+  };
+
+
+  /***
+   * Deadline of a sync call in milliseconds, undefined for the configured one
+   * @param {Object} [options] - {timeout: ms}
+   */
+  var timeoutOf = function (options) {
+    return options && options.timeout;
+  };
+
+
+  /***
+   * Single async calls take optional per-call options before the callback,
+   * {priority, timeout}. The timeout in milliseconds overrides the
+   * configureDeadlines one for this call, 0 turns it off.
+   * @param {number} argc - arguments of the call before the options
+   * @param {Function} fn - called with (arguments..., options, callback)
+   */
+  var withOptions = function (argc, fn) {
+    return function () {
+      var args = Array.prototype.slice.call(arguments, 0, argc);
+      var options = arguments[argc];
+      var callback = arguments[argc + 1];
+      if (typeof options === 'function') {
+        callback = options;
+        options = undefined;
+      }
+      return fn.apply(undefined, args.concat([options || {}, callback]));
+    };
+  };
+
 
   // Async versions
-  exports.turnOn = function (id, callback) { return nodeAsyncCaller(0, id, 0, '', '', callback); };
-  exports.turnOff = function (id, callback) { return nodeAsyncCaller(1, id, 0, '', '', callback); };
-  exports.dim = function (id, levl, callback) { return nodeAsyncCaller(2, id, levl, '', '', callback); };
-  exports.learn = function (id, callback) { return nodeAsyncCaller(3, id, 0, '', '', callback); };
-  exports.addDevice = function (callback) { return nodeAsyncCaller(4, 0, 0, '', '', callback); };
-  exports.setName = function (id, name, callback) { return nodeAsyncCaller(5, id, 0, name, '', callback); };
-  exports.getName = function (id, callback) { return nodeAsyncCaller(6, id, 0, '', '', callback); };
-  exports.setProtocol = function (id, name, callback) { return nodeAsyncCaller(7, id, 0, name, '', callback); };
-  exports.getProtocol = function (id, callback) { return nodeAsyncCaller(8, id, 0, '', '', callback); };
-  exports.setModel = function (id, name, callback) { return nodeAsyncCaller(9, id, 0, name, '', callback); };
-  exports.getModel = function (id, callback) { return nodeAsyncCaller(10, id, 0, '', '', callback); };
-  exports.getDeviceType = function (id, callback) { return nodeAsyncCaller(11, id, 0, '', '', callback); };
-  exports.removeDevice = function (id, callback) { return nodeAsyncCaller(12, id, 0, '', '', callback); };
-  exports.removeEventListener = function (id, callback) { return nodeAsyncCaller(13, id, 0, '', '', callback); };
-  exports.getErrorString = function (id, callback) { return nodeAsyncCaller(14, id, 0, '', '', callback); };
-  exports.getNumberOfDevices = function (callback) { return nodeAsyncCaller(17, 0, 0, '', '', callback); };
-  exports.stop = function (id, callback) { return nodeAsyncCaller(18, id, 0, '', '', callback); };
-  exports.bell = function (id, callback) { return nodeAsyncCaller(19, id, 0, '', '', callback); };
-  exports.getDeviceId = function (id, callback) { return nodeDeviceCountCaller(20, id, 0, '', '', callback); };
-  exports.getDeviceParameter = function (id, name, val, callback) { return nodeAsyncCaller(21, id, 0, name, val, callback); };
-  exports.setDeviceParameter = function (id, name, val, callback) { return nodeAsyncCaller(22, id, 0, name, val, callback); };
-  exports.execute = function (id, callback) { return nodeAsyncCaller(23, id, 0, '', '', callback); };
-  exports.up = function (id, callback) { return nodeAsyncCaller(24, id, 0, '', '', callback); };
-  exports.down = function (id, callback) { return nodeAsyncCaller(25, id, 0, '', '', callback); };
-  exports.getDevices = function (callback) { return nodeAsyncCaller(26, 0, 0, '', '', callback); };
+  exports.turnOn = withOptions(1, function (id, options, callback) { return telldus.turnOn(id, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.turnOff = withOptions(1, function (id, options, callback) { return telldus.turnOff(id, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.dim = withOptions(2, function (id, levl, options, callback) { return telldus.dim(id, levl, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.learn = withOptions(1, function (id, options, callback) { return telldus.learn(id, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.addDevice = withOptions(0, function (options, callback) { return telldus.addDevice(nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.setName = withOptions(2, function (id, name, options, callback) { return telldus.setName(id, name, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.getName = withOptions(1, function (id, options, callback) { return nodeCachedCaller(6, id, '', '', function (handler) { return telldus.getName(id, handler, callPriority(options), options.timeout); }, callback); });
+  exports.setProtocol = withOptions(2, function (id, name, options, callback) { return telldus.setProtocol(id, name, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.getProtocol = withOptions(1, function (id, options, callback) { return nodeCachedCaller(8, id, '', '', function (handler) { return telldus.getProtocol(id, handler, callPriority(options), options.timeout); }, callback); });
+  exports.setModel = withOptions(2, function (id, name, options, callback) { return telldus.setModel(id, name, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.getModel = withOptions(1, function (id, options, callback) { return nodeCachedCaller(10, id, '', '', function (handler) { return telldus.getModel(id, handler, callPriority(options), options.timeout); }, callback); });
+  exports.getDeviceType = withOptions(1, function (id, options, callback) { return nodeCachedCaller(11, id, '', '', function (handler) { return telldus.getDeviceType(id, handler, callPriority(options), options.timeout); }, callback); });
+  exports.removeDevice = withOptions(1, function (id, options, callback) { return telldus.removeDevice(id, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.removeEventListener = function (id, callback) { return nodeListenerRemover(id, callback); };
+  exports.getErrorString = withOptions(1, function (id, options, callback) { return telldus.getErrorString(id, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.getNumberOfDevices = withOptions(0, function (options, callback) { return telldus.getNumberOfDevices(nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.stop = withOptions(1, function (id, options, callback) { return telldus.stop(id, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.bell = withOptions(1, function (id, options, callback) { return telldus.bell(id, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.getDeviceId = withOptions(1, function (id, options, callback) { return nodeDeviceCountCaller(id, options, callback); });
+  exports.getDeviceParameter = withOptions(3, function (id, name, val, options, callback) { return nodeCachedCaller(21, id, name, val, function (handler) { return telldus.getDeviceParameter(id, name, val, handler, callPriority(options), options.timeout); }, callback); });
+  exports.setDeviceParameter = withOptions(3, function (id, name, val, options, callback) { return telldus.setDeviceParameter(id, name, val, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.execute = withOptions(1, function (id, options, callback) { return telldus.execute(id, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.up = withOptions(1, function (id, options, callback) { return telldus.up(id, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.down = withOptions(1, function (id, options, callback) { return telldus.down(id, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.getDevices = withOptions(0, function (options, callback) { return telldus.getDevices(nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.getDevicesCompact = withOptions(0, function (options, callback) { return telldus.getDevicesCompact(nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.getDevicesSince = withOptions(1, function (version, options, callback) { return telldus.getDevicesSince(version, nodeResultHandler(callback), callPriority(options), options.timeout); });
+  exports.createDevice = function (spec, callback) { return nodeCreateCaller([spec], true, callback); };
+  exports.createDevices = function (specs, callback) { return nodeCreateCaller(specs, false, callback); };
+
+  // Queued versions, pending commands for a device are merged so only the
+  // latest one is sent (see README)
+  exports.queueTurnOn = function (id, callback) { return nodeQueueCaller(0, id, 0, callback); };
+  exports.queueTurnOff = function (id, callback) { return nodeQueueCaller(1, id, 0, callback); };
+  exports.queueDim = function (id, levl, callback) { return nodeQueueCaller(2, id, levl, callback); };
+  exports.getCommandQueueStats = function () { return telldus.getCommandQueueStats(); };
+
+  // Event journal, events are written natively to memory mapped segment
+  // files and can be read back by time range (see README)
+  exports.openJournal = function (options) {
+    return telldus.OpenJournal(options.path, options.segmentSize || 16 * 1024 * 1024,
+      options.maxSegments || 16, journalTypeMask(options.types));
+  };
+  exports.closeJournal = function () { return telldus.CloseJournal(); };
+  exports.getJournalStats = function () { return telldus.getJournalStats(); };
+  exports.createJournalIterator = function (options) { return journalIterator(options || {}); };
+  exports.replayJournal = function (options, onRecords, callback) {
+    var iterator = journalIterator(options || {});
+    var step = function () {
+      var records;
+      try {
+        records = iterator.next();
+      } catch (err) {
+        return callback && callback(err);
+      }
+      if (records === null) {
+        return callback && callback(null);
+      }
+      onRecords(records);
+      setImmediate(step);
+    };
+    setImmediate(step);
+  };
+
+  // Scenes, sequences of commands with waits in between that are timed
+  // natively (see README)
+  exports.runScene = function (steps, options, callback) { return nodeSceneCaller(steps, options, callback); };
+  exports.cancelScene = function (sceneId) { return telldus.CancelScene(sceneId); };
+  exports.getSceneStats = function () { return telldus.getSceneStats(); };
+
+  // Airtime scheduling, every command that goes out over the radio takes a
+  // slot from the controller it belongs to (see README)
+  exports.configureAirtime = function (controllerId, options) {
+    options = options || {};
+    return telldus.configureAirtime(controllerId, options.rate || 0, options.burst || 1);
+  };
+  exports.setDeviceController = function (id, controllerId) { return telldus.setDeviceController(id, controllerId); };
+  exports.getAirtimeStats = function () { return telldus.getAirtimeStats(); };
+
+  // Bulk versions, one native call for many devices. Commands are sent in
+  // the given order, the callback gets an Int32Array with one return value
+  // per device.
+  exports.turnOnMany = function (ids, options, callback) { return nodeBulkCaller(0, ids, null, options, callback); };
+  exports.turnOffMany = function (ids, options, callback) { return nodeBulkCaller(1, ids, null, options, callback); };
+  exports.dimMany = function (devices, options, callback) { var d = splitLevels(devices); return nodeBulkCaller(2, d.ids, d.levels, options, callback); };
+  exports.executeMany = function (ids, options, callback) { return nodeBulkCaller(23, ids, null, options, callback); };
 
   // Sync versions
-  exports.turnOnSync = function (id) { return telldus.SyncCaller(0, id, 0, '', ''); };
-  exports.turnOffSync = function (id) { return telldus.SyncCaller(1, id, 0, '', ''); };
-  exports.dimSync = function (id, levl) { return telldus.SyncCaller(2, id, levl, '', ''); };
-  exports.learnSync = function (id) { return telldus.SyncCaller(3, id, 0, '', ''); };
-  exports.addDeviceSync = function () { return telldus.SyncCaller(4, 0, 0, '', ''); };
-  exports.setNameSync = function (id, name) { return telldus.SyncCaller(5, id, 0, name, ''); };
-  exports.getNameSync = function (id) { return telldus.SyncCaller(6, id, 0, '', ''); };
-  exports.setProtocolSync = function (id, name) { return telldus.SyncCaller(7, id, 0, name, ''); };
-  exports.getProtocolSync = function (id) { return telldus.SyncCaller(8, id, 0, '', ''); };
-  exports.setModelSync = function (id, name) { return telldus.SyncCaller(9, id, 0, name, ''); };
-  exports.getModelSync = function (id) { return telldus.SyncCaller(10, id, 0, '', ''); };
-  exports.getDeviceTypeSync = function (id) { return telldus.SyncCaller(11, id, 0, '', ''); };
-  exports.removeDeviceSync = function (id) { return telldus.SyncCaller(12, id, 0, '', ''); };
-  exports.removeEventListenerSync = function (id) { return telldus.SyncCaller(13, id, 0, '', ''); };
-  exports.getErrorStringSync = function (id) { return telldus.SyncCaller(14, id, 0, '', ''); };
-  exports.getNumberOfDevicesSync = function () { return telldus.SyncCaller(17, 0, 0, '', ''); };
-  exports.stopSync = function (id) { return telldus.SyncCaller(18, id, 0, '', ''); };
-  exports.bellSync = function (id) { return telldus.SyncCaller(19, id, 0, '', ''); };
-  exports.getDeviceIdSync = function (id) { return telldus.SyncCaller(20, id, 0, '', ''); };
-  exports.getDeviceParameterSync = function (id, name, val) { return telldus.SyncCaller(21, id, 0, name, val); };
-  exports.setDeviceParameterSync = function (id, name, val) { return telldus.SyncCaller(22, id, 0, name, val); };
-  exports.executeSync = function (id) { return telldus.SyncCaller(23, id, 0, '', ''); };
-  exports.upSync = function (id) { return telldus.SyncCaller(24, id, 0, '', ''); };
-  exports.downSync = function (id) { return telldus.SyncCaller(25, id, 0, '', ''); };
-  exports.getDevicesSync = function () { return telldus.SyncCaller(26, 0, 0, '', ''); };
+  exports.turnOnSync = function (id, options) { return telldus.turnOnSync(id, timeoutOf(options)); };
+  exports.turnOffSync = function (id, options) { return telldus.turnOffSync(id, timeoutOf(options)); };
+  exports.dimSync = function (id, levl, options) { return telldus.dimSync(id, levl, timeoutOf(options)); };
+  exports.learnSync = function (id, options) { return telldus.learnSync(id, timeoutOf(options)); };
+  exports.addDeviceSync = function (options) { return telldus.addDeviceSync(timeoutOf(options)); };
+  exports.setNameSync = function (id, name, options) { return telldus.setNameSync(id, name, timeoutOf(options)); };
+  exports.getNameSync = function (id, options) { return telldus.getNameSync(id, timeoutOf(options)); };
+  exports.setProtocolSync = function (id, name, options) { return telldus.setProtocolSync(id, name, timeoutOf(options)); };
+  exports.getProtocolSync = function (id, options) { return telldus.getProtocolSync(id, timeoutOf(options)); };
+  exports.setModelSync = function (id, name, options) { return telldus.setModelSync(id, name, timeoutOf(options)); };
+  exports.getModelSync = function (id, options) { return telldus.getModelSync(id, timeoutOf(options)); };
+  exports.getDeviceTypeSync = function (id, options) { return telldus.getDeviceTypeSync(id, timeoutOf(options)); };
+  exports.removeDeviceSync = function (id, options) { return telldus.removeDeviceSync(id, timeoutOf(options)); };
+  exports.removeEventListenerSync = function (id) { return telldus.RemoveEventListener(id); };
+  exports.getErrorStringSync = function (id, options) { return telldus.getErrorStringSync(id, timeoutOf(options)); };
+  exports.getNumberOfDevicesSync = function (options) { return telldus.getNumberOfDevicesSync(timeoutOf(options)); };
+  exports.stopSync = function (id, options) { return telldus.stopSync(id, timeoutOf(options)); };
+  exports.bellSync = function (id, options) { return telldus.bellSync(id, timeoutOf(options)); };
+  exports.getDeviceIdSync = function (id, options) { return telldus.getDeviceIdSync(id, timeoutOf(options)); };
+  exports.getDeviceParameterSync = function (id, name, val, options) { return telldus.getDeviceParameterSync(id, name, val, timeoutOf(options)); };
+  exports.setDeviceParameterSync = function (id, name, val, options) { return telldus.setDeviceParameterSync(id, name, val, timeoutOf(options)); };
+  exports.executeSync = function (id, options) { return telldus.executeSync(id, timeoutOf(options)); };
+  exports.upSync = function (id, options) { return telldus.upSync(id, timeoutOf(options)); };
+  exports.downSync = function (id, options) { return telldus.downSync(id, timeoutOf(options)); };
+  exports.getDevicesSync = function (options) { return telldus.getDevicesSync(timeoutOf(options)); };
+  exports.getDevicesCompactSync = function (options) { return telldus.getDevicesCompactSync(timeoutOf(options)); };
+  exports.getDevicesSinceSync = function (version, options) { return telldus.getDevicesSinceSync(version, timeoutOf(options)); };
+  exports.createDeviceSync = function (spec, options) { return telldus.createDevicesSync([spec], timeoutOf(options))[0]; };
+  exports.createDevicesSync = function (specs, options) { return telldus.createDevicesSync(specs, timeoutOf(options)); };
+  exports.turnOnManySync = function (ids, options) { return telldus.SyncBulkCaller(0, ids, null, priorityOf(options), timeoutOf(options)); };
+  exports.turnOffManySync = function (ids, options) { return telldus.SyncBulkCaller(1, ids, null, priorityOf(options), timeoutOf(options)); };
+  exports.dimManySync = function (devices, options) { var d = splitLevels(devices); return telldus.SyncBulkCaller(2, d.ids, d.levels, priorityOf(options), timeoutOf(options)); };
+  exports.executeManySync = function (ids, options) { return telldus.SyncBulkCaller(23, ids, null, priorityOf(options), timeoutOf(options)); };
+
+  // Tuning
+  exports.setSnapshotThreads = function (threads) { return telldus.setSnapshotThreads(threads); };
+  exports.getExecutorStats = function () { return telldus.getExecutorStats(); };
+  exports.getPoolStats = function () { return telldus.getPoolStats(); };
+
+  /**
+   * Configure the native executor used by all async calls.
+   * @param {Object} options - {command: {threads, queueLimit}, query: {threads, queueLimit}}
+   */
+  exports.configureExecutor = function (options) {
+    Object.keys(lanes).forEach(function (name) {
+      var lane = options && options[name];
+      if (lane) {
+        telldus.configureExecutor(lanes[name], lane.threads || 0, lane.queueLimit || 0);
+      }
+    });
+  };
+
+  /**
+   * Set the default deadlines for calls into telldusd, and tune the
+   * circuit breaker that fails calls fast once telldusd stops answering.
+   * Timeouts are in milliseconds, 0 turns them off (the default).
+   * @param {Object} options - {sync, async, breaker: {threshold, cooldown}}
+   */
+  exports.configureDeadlines = function (options) {
+    options = options || {};
+    var breaker = options.breaker || {};
+    telldus.configureDeadlines(
+      typeof options.sync === 'number' ? options.sync : -1,
+      typeof options.async === 'number' ? options.async : -1,
+      breaker.threshold || 0,
+      breaker.cooldown || 0
+    );
+  };
+
+  /**
+   * Circuit breaker state and timeout counters.
+   * @returns {Object} {state: 'closed'|'open'|'halfOpen', timeouts, rejected, trips, ...}
+   */
+  exports.getHealth = function () { return telldus.getHealth(); };
 
 
 
@@ -91,15 +469,25 @@ process.on('exit', function () {
    */
 
   /***
-   * Special callback wrapper for getDeviceCount or anything that returns -1 on fail
-   * @param {number} worktype - the number of the method to execute
-   * @param {number} id - device id
-   * @param {number} num - ?
-   * @param {string} str - ?
+   * Description of an error code, our own or from telldus-core
+   * @param {number} code - negative return value
+   */
+  var errorString = function (code) {
+    if (errors.messages.hasOwnProperty(code)) {
+      return errors.messages[code];
+    }
+    return exports.getErrorStringSync(code);
+  };
+
+
+  /***
+   * Special callback wrapper for getDeviceId, which returns -1 on fail
+   * @param {number} id - device index
+   * @param {Object} options - {priority, timeout}, see withOptions
    * @param {requestCallback} callback - Node formated callback.
    */
-  var nodeDeviceCountCaller = function (worktype, id, num, str, str2, callback) {
-    return telldus.AsyncCaller(worktype, id, num, str, str2, function (result) {
+  var nodeDeviceCountCaller = function (id, options, callback) {
+    return telldus.getDeviceId(id, function (result) {
       if (typeof callback !== 'function') {
         callback = function () {};
       }
@@ -110,23 +498,235 @@ process.on('exit', function () {
             statusEnum.TELLSTICK_ERROR_DEVICE_NOT_FOUND)
         }));
       }
+      else if (result < -1) {
+        return callback(new errors.TelldusError({code: result, message: errorString(result)}));
+      }
       else{
         return callback.apply(undefined, [null].concat(Array.prototype.slice.call(arguments, 0)));
       }
+    }, callPriority(options), options.timeout);
+  };
+
+
+  /***
+   * Listeners live in a native table, removing one never waits for telldusd
+   * @param {number} id - listener id returned by one of the add*Listener calls
+   * @param {function} callback - called with an error if there was no such listener
+   */
+  var nodeListenerRemover = function (id, callback) {
+    var result = telldus.RemoveEventListener(id);
+    var handler = nodeResultHandler(callback);
+    process.nextTick(function () {
+      handler(result, 13);
     });
   };
 
 
   /***
-   * Nodify the response of telldus.AsyncCaller
+   * Metadata reads are answered from the native cache when possible,
+   * without going through the threadpool. Falls back to the operation.
    * @param {number} worktype - the number of the method to execute
    * @param {number} id - device id
-   * @param {number} num - ?
-   * @param {string} str - ?
+   * @param {string} str - parameter name, or ''
+   * @param {string} str2 - parameter default value, or ''
+   * @param {function} operation - runs the typed native with the result handler it is given
+   * @param {requestCallback} callback - Node formated callback.
+   */
+  var nodeCachedCaller = function (worktype, id, str, str2, operation, callback) {
+    var cached = telldus.CachedCaller(worktype, id, str, str2);
+    if (cached === undefined) {
+      return operation(nodeResultHandler(callback));
+    }
+    var handler = nodeResultHandler(callback);
+    process.nextTick(function () {
+      handler(cached, worktype);
+    });
+  };
+
+
+  /***
+   * Turn [{id, level}, ...] into the id and level lists the bulk caller wants
+   * @param {Array} devices - list of {id, level} objects
+   */
+  var splitLevels = function (devices) {
+    var ids = new Int32Array(devices.length);
+    var levels = new Int32Array(devices.length);
+    for (var i = 0; i < devices.length; i++) {
+      ids[i] = devices[i].id;
+      levels[i] = devices[i].level;
+    }
+    return {ids: ids, levels: levels};
+  };
+
+
+  /***
+   * Nodify the response of telldus.AsyncBulkCaller
+   * @param {number} worktype - the number of the command to execute
+   * @param {Array|Int32Array} ids - device ids
+   * @param {Array|Int32Array|null} values - per device value, or null
+   * @param {Object} [options] - {priority: 'interactive'|'automation'|'background'}
+   * @param {requestCallback} callback - Node formated callback.
+   */
+  var nodeBulkCaller = function (worktype, ids, values, options, callback) {
+    if (typeof options === 'function') {
+      callback = options;
+      options = undefined;
+    }
+    return telldus.AsyncBulkCaller(worktype, ids, values, priorityOf(options), nodeResultHandler(callback));
+  };
+
+
+  /***
+   * Create and configure devices in one native job, each one is removed
+   * again if any of its steps fail
+   * @param {Array} specs - list of {name, protocol, model, parameters}
+   * @param {boolean} single - hand the callback the id instead of the list of results
+   * @param {requestCallback} callback - Node formated callback.
+   */
+  var nodeCreateCaller = function (specs, single, callback) {
+    var handler = nodeResultHandler(callback);
+    return telldus.createDevices(specs, function (results) {
+      handler(single && typeof results === 'object' ? results[0] : results);
+    });
+  };
+
+
+  /***
+   * Airtime priority for a call, bulk calls default to automation
+   * @param {Object} [options] - {priority: name or number}
+   */
+  var priorityOf = function (options) {
+    var priority = options && options.priority;
+    if (typeof priority === 'string') {
+      if (!priorityEnum.hasOwnProperty(priority)) {
+        throw new TypeError('Unknown priority: ' + priority);
+      }
+      return priorityEnum[priority];
+    }
+    if (typeof priority === 'number') {
+      return priority;
+    }
+    return priorityEnum.automation;
+  };
+
+
+  /***
+   * Name of a native overflow policy number
+   * @param {number} policy - one of the overflowPolicies values
+   */
+  var overflowPolicyName = function (policy) {
+    return Object.keys(overflowPolicies).filter(function (name) {
+      return overflowPolicies[name] === policy;
+    })[0];
+  };
+
+
+  /***
+   * First of the given values that is not undefined
+   */
+  var pick = function () {
+    for (var i = 0; i < arguments.length; i++) {
+      if (arguments[i] !== undefined) {
+        return arguments[i];
+      }
+    }
+  };
+
+
+  /***
+   * Turn a list of journal record type names into the native bit mask
+   * @param {Array} [types] - any of 'device', 'sensor' and 'raw', all if left out
+   */
+  var journalTypeMask = function (types) {
+    var mask = 0;
+    (types || Object.keys(journalTypes)).forEach(function (type) {
+      if (!journalTypes.hasOwnProperty(type)) {
+        throw new TypeError('Unknown journal record type: ' + type);
+      }
+      mask |= journalTypes[type];
+    });
+    return mask;
+  };
+
+
+  /***
+   * Streaming reader over a journal, only one segment is mapped at a time
+   * @param {Object} options - {path, from, to, types, batchSize}, path
+   *   defaults to the open journal, from and to are Dates or milliseconds
+   */
+  var journalIterator = function (options) {
+    var path = options.path || telldus.getJournalStats().path;
+    var from = options.from !== undefined ? +options.from : 0;
+    var to = options.to !== undefined ? +options.to : 9007199254740991; // Number.MAX_SAFE_INTEGER
+    var readerId = telldus.OpenJournalReader(path, from, to, journalTypeMask(options.types));
+    var done = false;
+    return {
+      next: function (max) {
+        if (done) {
+          return null;
+        }
+        var records = telldus.ReadJournal(readerId, max || options.batchSize || 1024);
+        if (records === null) {
+          done = true;
+        }
+        return records;
+      },
+      close: function () {
+        if (!done) {
+          done = true;
+          telldus.CloseJournalReader(readerId);
+        }
+      }
+    };
+  };
+
+
+  /***
+   * Nodify the response of telldus.RunScene, returns the scene id
+   * @param {Array} steps - list of {id, method, level, delay} objects
+   * @param {Object} [options] - {priority: 'interactive'|'automation'|'background'}
+   * @param {requestCallback} callback - Node formated callback.
+   */
+  var nodeSceneCaller = function (steps, options, callback) {
+    if (typeof options === 'function') {
+      callback = options;
+      options = undefined;
+    }
+    var methods = new Int32Array(steps.length);
+    var ids = new Int32Array(steps.length);
+    var levels = new Int32Array(steps.length);
+    var delays = new Int32Array(steps.length);
+    for (var i = 0; i < steps.length; i++) {
+      if (!sceneMethods.hasOwnProperty(steps[i].method)) {
+        throw new TypeError('Unknown scene method: ' + steps[i].method);
+      }
+      methods[i] = sceneMethods[steps[i].method];
+      ids[i] = steps[i].id;
+      levels[i] = steps[i].level || 0;
+      delays[i] = steps[i].delay || 0;
+    }
+    return telldus.RunScene(methods, ids, levels, delays, priorityOf(options), nodeResultHandler(callback));
+  };
+
+
+  /***
+   * Nodify the response of telldus.QueueCommand
+   * @param {number} worktype - 0 (turnOn), 1 (turnOff) or 2 (dim)
+   * @param {number} id - device id
+   * @param {number} num - dim level
    * @param {requestCallback} callback - Node formated callback.
    */
-  var nodeAsyncCaller = function (worktype, id, num, str, str2, callback) {
-    return telldus.AsyncCaller(worktype, id, num, str, str2, function (result) {
+  var nodeQueueCaller = function (worktype, id, num, callback) {
+    return telldus.QueueCommand(worktype, id, num, nodeResultHandler(callback));
+  };
+
+
+  /***
+   * Build the function that turns a raw native result into a node style callback
+   * @param {requestCallback} callback - Node formated callback.
+   */
+  var nodeResultHandler = function (callback) {
+    return function (result) {
       var args = [];
       var rtype = typeof result;
       if (typeof callback !== 'function') {
@@ -137,7 +737,7 @@ process.on('exit', function () {
         //assume it represents an error code if <>0
         if (result < statusEnum.TELLSTICK_SUCCESS) {
           //get the description
-          var description = exports.getErrorStringSync(result);
+          var description = errorString(result);
           return callback(new errors.TelldusError({code: result, message: description}));
         }
         else {
@@ -184,7 +784,7 @@ process.on('exit', function () {
         //can't do much about it. send as is
         return callback.apply(undefined, Array.prototype.slice.call(arguments));
       }
-    });
+    };
   };
 
 
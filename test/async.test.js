@@ -2,6 +2,10 @@
 var should = require('should');
 var telldus = require('..');
 var utils = require('./utils');
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var childProcess = require('child_process');
 
 
 /* 
@@ -76,6 +80,15 @@ describe('async methods', function () {
     });
 
 
+    it('init resolves with prefetched devices and sensors', function (done) {
+      telldus.init({devices: true, sensors: true}).then(function (prefetched) {
+        prefetched.devices.length.should.equal(telldus.getDevicesSync().length);
+        prefetched.sensors.should.be.an.instanceOf(Array);
+        done();
+      }, done);
+    });
+
+
     it('addDevice', function (done) {
       telldus.addDevice(function (err, id) {
         should.not.exist(err);
@@ -86,6 +99,44 @@ describe('async methods', function () {
     });
 
 
+    it('createDevice', function (done) {
+      telldus.createDevice({name: 'Created', protocol: 'arctech', model: 'selflearning-switch', parameters: {house: '1234', unit: '2'}}, function (err, id) {
+        should.not.exist(err);
+        id.should.be.above(0);
+        telldus.getNameSync(id).should.equal('Created');
+        telldus.getDeviceParameterSync(id, 'house', '').should.equal('1234');
+        done();
+      });
+    });
+
+
+    it('createDevices', function (done) {
+      var before = telldus.getNumberOfDevicesSync();
+      telldus.createDevices([
+        {name: 'Imported 1', protocol: 'arctech', model: 'codeswitch'},
+        {name: 'Imported 2', protocol: 'arctech', model: 'codeswitch'}
+      ], function (err, results) {
+        should.not.exist(err);
+        results.should.be.an.instanceOf(Int32Array);
+        results.length.should.equal(2);
+        results[0].should.be.above(0);
+        results[1].should.be.above(results[0]);
+        telldus.getNumberOfDevicesSync().should.equal(before + 2);
+        done();
+      });
+    });
+
+
+    it('createDevice only takes string parameter values', function () {
+      (function () {
+        telldus.createDevice({name: 'Bad', parameters: {house: undefined}}, function () {});
+      }).should.throw(TypeError);
+      (function () {
+        telldus.createDeviceSync({name: 'Bad', parameters: {unit: 2}});
+      }).should.throw(TypeError);
+    });
+
+
     it('getName with error on bad device', function (done) {
       telldus.getName(utils.NON_EXISTING_DEVICE, function (err, name) {
         should.exist(err);
@@ -362,6 +413,88 @@ describe('async methods', function () {
       }
     });
 
+    it('turnOnMany', function (done) {
+      telldus.turnOnMany([dimmerId, utils.NON_EXISTING_DEVICE], function (err, results) {
+        should.not.exist(err);
+        results.should.be.an.instanceOf(Int32Array);
+        results.length.should.equal(2);
+        results[0].should.equal(telldus.enums.status.TELLSTICK_SUCCESS);
+        results[1].should.equal(telldus.enums.status.TELLSTICK_ERROR_DEVICE_NOT_FOUND);
+        done();
+      });
+    });
+
+
+    it('dimMany', function (done) {
+      telldus.dimMany([{id: dimmerId, level: 30}], function (err, results) {
+        should.not.exist(err);
+        results[0].should.equal(telldus.enums.status.TELLSTICK_SUCCESS);
+        done();
+      });
+    });
+
+
+    it('queueDim sends only the latest level', function (done) {
+      var before = telldus.getCommandQueueStats();
+      var pending = 5;
+      for (var level = 10; level <= 50; level += 10) {
+        telldus.queueDim(dimmerId, level, check);
+      }
+      function check(err) {
+        should.not.exist(err);
+        if (--pending === 0) {
+          var stats = telldus.getCommandQueueStats();
+          (stats.submitted - before.submitted).should.equal(5);
+          (stats.sent - before.sent).should.be.below(5);
+          (stats.coalesced - before.coalesced).should.be.above(0);
+          done();
+        }
+      }
+    });
+
+
+    it('queueTurnOn then queueTurnOff sends the off', function (done) {
+      var before = telldus.getCommandQueueStats();
+      var pending = 2;
+      telldus.queueTurnOn(dimmerId, check);
+      telldus.queueTurnOff(dimmerId, check);
+      function check(err) {
+        should.not.exist(err);
+        if (--pending === 0) {
+          // The on is either sent first or replaced, never dropped together with the off
+          var stats = telldus.getCommandQueueStats();
+          ((stats.sent - before.sent) + (stats.coalesced - before.coalesced)).should.equal(2);
+          var device = telldus.getDevicesSync().filter(function (d) { return d.id === dimmerId; })[0];
+          device.status.should.have.property('name', 'OFF');
+          done();
+        }
+      }
+    });
+
+
+    it('counts queued commands failed by a full command lane as dropped', function (done) {
+      telldus.configureExecutor({command: {threads: 1, queueLimit: 1}});
+      var before = telldus.getCommandQueueStats();
+      var calls = 20, pending = calls, failed = 0;
+      for (var i = 0; i < calls; i++) {
+        telldus.queueTurnOff(utils.NON_EXISTING_DEVICE + i, check);
+      }
+      function check(err) {
+        if (err && err.code === telldus.enums.status.TELLSTICK_ERROR_QUEUE_FULL) {
+          failed++;
+        }
+        if (--pending === 0) {
+          telldus.configureExecutor({command: {threads: 2, queueLimit: 256}});
+          var stats = telldus.getCommandQueueStats();
+          failed.should.be.above(0);
+          (stats.dropped - before.dropped).should.equal(failed);
+          (stats.coalesced - before.coalesced).should.equal(0);
+          done();
+        }
+      }
+    });
+
+
     it('learn should learn...', function(done){
       telldus.learn(dimmerId, function(err){
         //TODO:how should this be validated
@@ -373,5 +506,488 @@ describe('async methods', function () {
   });//switches
 
 
+  describe('executor', function () {
+
+
+    after(function () {
+      telldus.configureExecutor({query: {threads: 2, queueLimit: 256}});
+    });
+
+
+    it('getExecutorStats', function (done) {
+      telldus.getNumberOfDevices(function (err) {
+        should.not.exist(err);
+        var stats = telldus.getExecutorStats();
+        stats.should.have.properties('command', 'query');
+        stats.query.completed.should.be.above(0);
+        stats.query.should.have.properties('depth', 'maxDepth', 'waitAvgMs', 'waitMaxMs', 'rejected');
+        done();
+      });
+    });
+
+
+    it('rejects work when the queue is full', function (done) {
+      telldus.configureExecutor({query: {threads: 1, queueLimit: 1}});
+      var calls = 20, pending = calls, rejected = 0;
+      for (var i = 0; i < calls; i++) {
+        telldus.getNumberOfDevices(check);
+      }
+      function check(err) {
+        if (err) {
+          err.should.have.property('code', telldus.enums.status.TELLSTICK_ERROR_QUEUE_FULL);
+          rejected++;
+        }
+        if (--pending === 0) {
+          rejected.should.be.above(0);
+          done();
+        }
+      }
+    });
+
+    it('recycles work records', function (done) {
+      telldus.getNumberOfDevices(function (err) {
+        should.not.exist(err);
+        var before = telldus.getPoolStats();
+        telldus.getNumberOfDevices(function (err) {
+          should.not.exist(err);
+          process.nextTick(function () {
+            var after = telldus.getPoolStats();
+            after.work.allocations.should.be.above(before.work.allocations);
+            after.work.slabs.should.equal(before.work.slabs);
+            after.strings.should.have.property('peakBytes');
+            done();
+          });
+        });
+      });
+    });
+
+
+  });//executor
+
+
+  describe('deadlines', function () {
+
+
+    after(function () {
+      telldus.configureDeadlines({sync: 0, async: 0, breaker: {threshold: 5, cooldown: 5000}});
+      telldus.configureExecutor({query: {threads: 2, queueLimit: 256}});
+    });
+
+
+    it('getHealth', function () {
+      var health = telldus.getHealth();
+      health.should.have.properties('state', 'threshold', 'cooldownMs', 'timeouts', 'rejected', 'trips');
+      health.state.should.equal('closed');
+    });
+
+
+    it('calls finish within a generous deadline', function (done) {
+      telldus.configureDeadlines({sync: 10000, async: 10000, breaker: {threshold: 3, cooldown: 1000}});
+      var health = telldus.getHealth();
+      health.should.have.properties({syncTimeoutMs: 10000, asyncTimeoutMs: 10000, threshold: 3, cooldownMs: 1000});
+      telldus.getNumberOfDevicesSync().should.not.be.below(0);
+      telldus.getNumberOfDevices(function (err) {
+        should.not.exist(err);
+        telldus.getHealth().successes.should.be.above(health.successes);
+        done();
+      });
+    });
+
+
+
+    it('times out on a full lane, opens the circuit and closes it after the cooldown', function (done) {
+      this.timeout(5000);
+      telldus.configureDeadlines({sync: 0, async: 0, breaker: {threshold: 1, cooldown: 300}});
+      telldus.configureExecutor({query: {threads: 1, queueLimit: 256}});
+      var status = telldus.enums.status;
+      var expired = telldus.getExecutorStats().query.expired;
+      var trips = telldus.getHealth().trips;
+      var calls = 20, pending = calls, timedOut = 0;
+
+      // A deadline nothing can make, every call waits behind the others
+      for (var i = 0; i < calls; i++) {
+        telldus.getNumberOfDevices({timeout: 0.001}, check);
+      }
+      function check(err) {
+        should.exist(err);
+        err.should.have.property('code', status.TELLSTICK_ERROR_TIMEOUT);
+        timedOut++;
+        if (--pending === 0) {
+          timedOut.should.equal(calls);
+          telldus.getExecutorStats().query.expired.should.be.above(expired);
+          var health = telldus.getHealth();
+          health.state.should.equal('open');
+          health.trips.should.be.above(trips);
+          rejectWhileOpen();
+        }
+      }
+
+      function rejectWhileOpen() {
+        var rejected = telldus.getHealth().rejected;
+        telldus.getNumberOfDevicesSync().should.equal(status.TELLSTICK_ERROR_CIRCUIT_OPEN);
+        var results = telldus.turnOnManySync([1, 1]);
+        results.length.should.equal(2);
+        results[0].should.equal(status.TELLSTICK_ERROR_CIRCUIT_OPEN);
+        results[1].should.equal(status.TELLSTICK_ERROR_CIRCUIT_OPEN);
+        telldus.getNumberOfDevices(function (err) {
+          should.exist(err);
+          err.should.have.property('code', status.TELLSTICK_ERROR_CIRCUIT_OPEN);
+          telldus.getHealth().rejected.should.be.above(rejected);
+          setTimeout(probe, 400);
+        });
+      }
+
+      function probe() {
+        telldus.getNumberOfDevices(function (err, count) {
+          should.not.exist(err);
+          count.should.not.be.below(0);
+          telldus.getHealth().state.should.equal('closed');
+          done();
+        });
+      }
+    });
+
+
+  });//deadlines
+
+
+  describe('airtime', function () {
+
+
+    after(function () {
+      telldus.configureAirtime(0, {rate: 0});
+    });
+
+
+    it('getAirtimeStats', function (done) {
+      telldus.turnOn(1, function (err) {
+        should.not.exist(err);
+        var stats = telldus.getAirtimeStats();
+        stats.lanes.should.have.properties('interactive', 'automation', 'background');
+        stats.lanes.interactive.count.should.be.above(0);
+        stats.lanes.interactive.histogram.length.should.equal(stats.lanes.interactive.histogramBoundsMs.length);
+        stats.controllers[0].should.have.properties('rate', 'burst', 'tokens', 'sent', 'waiting');
+        done();
+      });
+    });
+
+
+    it('bulk calls take a priority', function (done) {
+      var before = telldus.getAirtimeStats().lanes.background.count;
+      telldus.turnOffMany([1, 1], {priority: 'background'}, function (err, results) {
+        should.not.exist(err);
+        results.length.should.equal(2);
+        telldus.getAirtimeStats().lanes.background.count.should.equal(before + 2);
+        done();
+      });
+    });
+
+
+    it('rate limits a controller', function (done) {
+      telldus.configureAirtime(0, {rate: 20, burst: 1});
+      var start = Date.now();
+      telldus.turnOnMany([1, 1, 1], function (err) {
+        should.not.exist(err);
+        (Date.now() - start).should.be.above(80);
+        done();
+      });
+    });
+
+
+    it('sync commands run while an async command holds the controller', function (done) {
+      telldus.configureAirtime(0, {rate: 0});
+      telldus.turnOn(1, function (err) {
+        should.not.exist(err);
+        done();
+      });
+      telldus.turnOnSync(1).should.equal(0);
+    });
+
+
+    it('sync commands wait for a rate limited controller until their deadline', function (done) {
+      telldus.configureAirtime(0, {rate: 20, burst: 1});
+      telldus.turnOn(1, function (err) {
+        should.not.exist(err);
+        done();
+      });
+      telldus.turnOnSync(1, {timeout: 2000}).should.equal(0);
+    });
+
+  });//airtime
+
+
+  describe('scenes', function () {
+
+
+    it('runScene', function (done) {
+      var start = Date.now();
+      telldus.runScene([
+        {id: 1, method: 'turnOn'},
+        {id: 1, method: 'dim', level: 40, delay: 100},
+        {id: 1, method: 'turnOff', delay: 100}
+      ], function (err, results, cancelled) {
+        should.not.exist(err);
+        results.length.should.equal(3);
+        cancelled.should.equal(false);
+        (Date.now() - start).should.be.above(190);
+        done();
+      });
+    });
+
+
+    it('cancelScene', function (done) {
+      var sceneId = telldus.runScene([
+        {id: 1, method: 'turnOn'},
+        {id: 1, method: 'turnOff', delay: 5000}
+      ], function (err, results, cancelled) {
+        should.not.exist(err);
+        cancelled.should.equal(true);
+        results[1].should.equal(telldus.enums.status.TELLSTICK_ERROR_CANCELLED);
+        telldus.cancelScene(sceneId).should.equal(false);
+        done();
+      });
+      setTimeout(function () {
+        telldus.cancelScene(sceneId).should.equal(true);
+      }, 50);
+    });
+
+  });//scenes
+
+
+  describe('journal', function () {
+
+    var journalPath = path.join(os.tmpdir(), 'telldus-journal-' + process.pid);
+
+
+    after(function () {
+      telldus.closeJournal();
+      fs.readdirSync(journalPath).forEach(function (name) {
+        fs.unlinkSync(path.join(journalPath, name));
+      });
+      fs.rmdirSync(journalPath);
+    });
+
+
+    it('journals device events and replays them', function (done) {
+      var start = Date.now();
+      telldus.openJournal({path: journalPath, segmentSize: 64 * 1024, maxSegments: 2});
+      telldus.getJournalStats().should.have.property('open', true);
+      telldus.turnOn(1, function (err) {
+        should.not.exist(err);
+        setTimeout(function () {
+          var found = 0;
+          telldus.replayJournal({from: start, types: ['device']}, function (records) {
+            records.forEach(function (record) {
+              record.should.have.property('type', 'device');
+              record.time.should.not.be.below(start);
+            });
+            found += records.length;
+          }, function (err) {
+            should.not.exist(err);
+            found.should.be.above(0);
+            done();
+          });
+        }, 500);
+      });
+    });
+
+
+    it('createJournalIterator skips records outside the range', function () {
+      var iterator = telldus.createJournalIterator({to: 1});
+      should(iterator.next()).equal(null);
+    });
+
+  });//journal
+
+
+  describe('event filters', function () {
+
+    it('only wakes listeners whose filter matches', function (done) {
+      var matched = 0, unmatched = 0;
+      var before = telldus.getEventStats().device.filtered;
+      var match = telldus.addDeviceEventListener(function (deviceId) {
+        deviceId.should.equal(1);
+        matched++;
+      }, {filter: {deviceIds: [1]}});
+      var other = telldus.addDeviceEventListener(function () {
+        unmatched++;
+      }, {filter: {deviceIds: [123456]}});
+
+      telldus.turnOn(1, function (err) {
+        should.not.exist(err);
+        setTimeout(function () {
+          telldus.removeEventListenerSync(match);
+          telldus.removeEventListenerSync(other);
+          matched.should.be.above(0);
+          unmatched.should.equal(0);
+          telldus.getEventStats().device.filtered.should.be.above(before);
+          done();
+        }, 500);
+      });
+    });
+
+
+
+    it('shares one event between listeners and removes them natively', function (done) {
+      var first = 0, second = 0;
+      var listeners = telldus.getEventStats().device.listeners;
+      var one = telldus.addDeviceEventListener(function () { first++; }, {filter: {deviceIds: [1]}});
+      var two = telldus.addDeviceEventListener(function () { second++; }, {filter: {deviceIds: [1]}});
+      telldus.getEventStats().device.listeners.should.equal(listeners + 2);
+
+      telldus.turnOn(1, function (err) {
+        should.not.exist(err);
+        setTimeout(function () {
+          first.should.be.above(0);
+          second.should.equal(first);
+          telldus.removeEventListenerSync(two).should.equal(0);
+          telldus.removeEventListenerSync(two).should.equal(telldus.enums.status.TELLSTICK_ERROR_NOT_FOUND);
+          telldus.turnOff(1, function (err) {
+            should.not.exist(err);
+            setTimeout(function () {
+              first.should.be.above(second);
+              telldus.removeEventListener(one, function (err) {
+                should.not.exist(err);
+                telldus.getEventStats().device.listeners.should.equal(listeners);
+                done();
+              });
+            }, 500);
+          });
+        }, 500);
+      });
+    });
+
+
+    it('delivers to more listeners than fit in one baton', function (done) {
+      var count = 100, calls = [], ids = [];
+      for (var i = 0; i < count; i++) {
+        calls.push(0);
+        ids.push(telldus.addDeviceEventListener((function (n) {
+          return function () { calls[n]++; };
+        })(i), {filter: {deviceIds: [1]}}));
+      }
+
+      telldus.turnOn(1, function (err) {
+        should.not.exist(err);
+        setTimeout(function () {
+          ids.forEach(function (id) {
+            telldus.removeEventListenerSync(id).should.equal(0);
+          });
+          calls.forEach(function (n) {
+            n.should.be.above(0);
+          });
+          done();
+        }, 500);
+      });
+    });
+
+
+    it('configureEventQueue', function () {
+      telldus.configureEventQueue({limit: 512, raw: {limit: 64, policy: 'latest'}});
+      var stats = telldus.getEventStats();
+      stats.device.should.have.property('limit', 512);
+      stats.device.should.have.property('policy', 'dropNewest');
+      stats.raw.should.have.property('limit', 64);
+      stats.raw.should.have.property('policy', 'latest');
+      stats.raw.should.have.property('highWater');
+      stats.raw.should.have.property('coalesced');
+      (function () {
+        telldus.configureEventQueue({policy: 'dropSome'});
+      }).should.throw();
+      telldus.configureEventQueue({limit: 1024, policy: 'dropNewest'});
+    });
+
+  });//event filters
+
+
+  describe('lazy init', function () {
+
+    var runLazy = function (script) {
+      var env = Object.assign({}, process.env, {TELLDUS_LAZY_INIT: '1'});
+      return childProcess.spawn(process.execPath, ['-e',
+        'var telldus = require(' + JSON.stringify(path.join(__dirname, '..')) + ');' + script], {env: env});
+    };
+
+
+    it('exits without initializing when nothing is used', function (done) {
+      this.timeout(10000);
+      runLazy('').on('exit', function (code) {
+        code.should.equal(0);
+        done();
+      });
+    });
+
+
+    it('initializes when only a listener is added', function (done) {
+      this.timeout(15000);
+      var output = '';
+      var child = runLazy(
+        'telldus.addDeviceEventListener(function (id) { if (id === 1) { console.log("event"); process.exit(0); } });' +
+        'setTimeout(function () { console.log("listening"); }, 2000);' +
+        'setTimeout(function () { process.exit(1); }, 10000);');
+      child.stdout.on('data', function (data) {
+        output += data;
+        if (/listening/.test(data)) {
+          telldus.turnOn(1, function (err) {
+            should.not.exist(err);
+          });
+        }
+      });
+      child.on('exit', function (code) {
+        output.should.match(/event/);
+        code.should.equal(0);
+        done();
+      });
+    });
+
+  });//lazy init
+
+
+  describe('dedup', function () {
+
+
+    after(function () {
+      telldus.configureDedup({window: 0});
+    });
+
+
+    it('configureDedup', function () {
+      telldus.configureDedup({window: 150, device: 0});
+      var stats = telldus.getEventStats();
+      stats.raw.should.have.property('dedupWindow', 150);
+      stats.sensor.should.have.property('dedupWindow', 150);
+      stats.device.should.have.property('dedupWindow', 0);
+      stats.raw.should.have.property('suppressed');
+      telldus.configureDedup({window: 0});
+    });
+
+
+    it('suppresses repeated device events within the window', function (done) {
+      telldus.configureDedup({device: 5000});
+      var before = telldus.getEventStats().device;
+      var events = 0;
+      var listener = telldus.addDeviceEventListener(function (id) {
+        if (id === 1) {
+          events++;
+        }
+      });
+      // Two identical commands, telldusd reports both the same way
+      telldus.turnOn(1, function (err) {
+        should.not.exist(err);
+        telldus.turnOn(1, function (err) {
+          should.not.exist(err);
+          setTimeout(function () {
+            var after = telldus.getEventStats().device;
+            (after.suppressed - before.suppressed).should.be.above(0);
+            events.should.be.below(2);
+            telldus.removeEventListener(listener, done);
+          }, 500);
+        });
+      });
+    });
+
+  });//dedup
+
+
   
 });
\ No newline at end of file
@@ -67,4 +67,65 @@ describe('with some help from you', function () {
     });//it should listen
 
 
+  it('using rawDeviceEventListener with parse', function (done) {
+      var seconds = 5; //for how many seconds should we wait for an event
+      console.log('\nWaiting', seconds, 'seconds for some raw events.\nPlease trigger something.');
+      var count = 0;
+      this.timeout(seconds * 1000 + 1000); //increase the test timeout
+
+      var listener = telldus.addRawDeviceEventListener(function (controllerId, data) {
+        arguments.length.should.be.equal(2);
+        should.exist(controllerId);
+        data.should.be.type('object');
+        if (!data.hasOwnProperty('class')) {
+          //need to filter some junk
+          return;
+        }
+        count++;
+        data.should.have.property('protocol');
+        if (data.hasOwnProperty('unit')) {
+          data.unit.should.be.type('number');
+        }
+      }, {parse: true});
+
+      listener.should.be.above(0);
+
+      setTimeout(function () {
+        telldus.removeEventListener(listener, function (err) {
+          done(err);
+        });
+        count.should.be.above(0);
+      }, seconds * 1000);
+    });
+
+  it('using rawDeviceEventBatchListener', function (done) {
+      var seconds = 5; //for how many seconds should we wait for an event
+      console.log('\nWaiting', seconds, 'seconds for some raw events.\nPlease trigger something.');
+      var count = 0;
+      this.timeout(seconds * 1000 + 1000); //increase the test timeout
+
+      var listener = telldus.addRawDeviceEventBatchListener(function (events) {
+        arguments.length.should.be.equal(1);
+        events.should.be.an.instanceOf(Array);
+        events.length.should.be.above(0);
+        events.forEach(function (event) {
+          event.should.have.property('controllerId');
+          event.should.have.property('data');
+          event.data.should.be.type('string');
+        });
+        count += events.length;
+      });
+
+      listener.should.be.above(0);
+
+      setTimeout(function () {
+        telldus.removeEventListener(listener, function (err) {
+          done(err);
+        });
+        count.should.be.above(0);
+        telldus.getEventStats().raw.delivered.should.be.above(0);
+      }, seconds * 1000);
+    });
+
+
 });
\ No newline at end of file
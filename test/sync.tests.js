@@ -24,6 +24,41 @@ describe('sync methods', function(){
     });
 
 
+    it('getDevicesCompactSync', function () {
+      var devices = telldus.getDevicesSync();
+      var snapshot = telldus.getDevicesCompactSync();
+      snapshot.count.should.equal(devices.length);
+      snapshot.ids.should.be.an.instanceOf(Int32Array);
+      snapshot.levels.should.be.an.instanceOf(Uint8Array);
+      devices.forEach(function (device, i) {
+        snapshot.ids[i].should.equal(device.id);
+        snapshot.strings[snapshot.names[i]].should.equal(device.name);
+        snapshot.strings[snapshot.protocols[i]].should.equal(device.protocol);
+      });
+    });
+
+
+    it('getDevicesSinceSync', function () {
+      var all = telldus.getDevicesSinceSync(0);
+      all.full.should.be.true;
+      all.devices.length.should.equal(telldus.getDevicesSync().length);
+
+      var none = telldus.getDevicesSinceSync(all.version);
+      none.full.should.be.false;
+      none.version.should.not.be.below(all.version);
+
+      var name = telldus.getNameSync(deviceId);
+      try {
+        telldus.setNameSync(deviceId, 'since test');
+        var changes = telldus.getDevicesSinceSync(all.version);
+        changes.version.should.be.above(all.version);
+        changes.devices.map(function (device) { return device.id; }).should.containEql(deviceId);
+      } finally {
+        telldus.setNameSync(deviceId, name);
+      }
+    });
+
+
     it('getDevicesSync', function () {
       var devices = telldus.getDevicesSync();
       
@@ -54,6 +89,21 @@ describe('sync methods', function(){
     });
 
 
+    it('getDevicesSync gives the same snapshot regardless of thread count', function () {
+      var previous = telldus.setSnapshotThreads(1);
+      var single = telldus.getDevicesSync();
+      telldus.setSnapshotThreads(8);
+      var threaded = telldus.getDevicesSync();
+      telldus.setSnapshotThreads(previous);
+
+      threaded.length.should.equal(single.length);
+      for (var i = 0; i < single.length; i++) {
+        threaded[i].id.should.equal(single[i].id);
+        threaded[i].name.should.equal(single[i].name);
+      }
+    });
+
+
     it('addDeviceSync', function () {
       var id = telldus.addDeviceSync();
       should.exist(id);
@@ -61,6 +111,15 @@ describe('sync methods', function(){
     });
 
 
+    it('createDeviceSync', function () {
+      var id = telldus.createDeviceSync({name: 'Created sync', protocol: 'arctech', model: 'selflearning-dimmer', parameters: {house: '12345', unit: '3'}});
+      id.should.be.above(0);
+      telldus.getNameSync(id).should.equal('Created sync');
+      telldus.getModelSync(id).should.equal('selflearning-dimmer');
+      telldus.getDeviceParameterSync(id, 'unit', '').should.equal('3');
+    });
+
+
     it('getNameSync', function () {
       var result = telldus.getNameSync(1);
       result.should.not.equal('');
@@ -88,6 +147,15 @@ describe('sync methods', function(){
     });
     
 
+    it('getNameSync from cache follows setNameSync', function () {
+      telldus.setNameSync(deviceId, 'Cached once');
+      telldus.getNameSync(deviceId).should.equal('Cached once');
+      telldus.getNameSync(deviceId).should.equal('Cached once');
+      telldus.setNameSync(deviceId, 'Cached twice');
+      telldus.getNameSync(deviceId).should.equal('Cached twice');
+    });
+
+
     it('setNameSync with bad device and return false', function () {
       var setResult = telldus.setNameSync(utils.NON_EXISTING_DEVICE, 'Bad ! ');
       setResult.should.equal(false);
@@ -246,6 +314,23 @@ describe('sync methods', function(){
   });
   
 
+  describe('typed bindings', function () {
+
+    it('answer like the generic caller', function () {
+      var native = require('../build/Release/telldus');
+      native.getErrorStringSync(-3).should.equal(native.SyncCaller(14, -3, 0, '', ''));
+      native.getNumberOfDevicesSync().should.equal(native.SyncCaller(17, 0, 0, '', ''));
+    });
+
+
+    it('reject unknown worktypes', function () {
+      var native = require('../build/Release/telldus');
+      (function () { native.SyncCaller(99, 0, 0, '', ''); }).should.throw(TypeError);
+    });
+
+  });//describe typed bindings
+
+
   describe('support events', function () {
     
     it('deviceEventListener', function (done) {
@@ -279,4 +364,50 @@ describe('sync methods', function(){
     });//deviceEventListener
   });//describe events
 
+
+  describe('sensors', function () {
+
+    it('getSensors', function () {
+      var sensors = telldus.getSensors();
+      sensors.should.be.an.instanceOf(Array);
+      sensors.forEach(function (sensor) {
+        sensor.should.have.properties('protocol', 'model', 'id', 'type', 'value', 'timestamp');
+      });
+    });
+
+
+    it('getSensorValue', function () {
+      should(telldus.getSensorValue('nosuchprotocol', 'nosuchmodel', 1, telldus.enums.sensorValueType.TELLSTICK_TEMPERATURE)).equal(null);
+      telldus.getSensors().forEach(function (sensor) {
+        telldus.getSensorValue(sensor.protocol, sensor.model, sensor.id, sensor.type).should.eql(sensor);
+      });
+    });
+
+
+
+    it('getSensorHistory', function () {
+      telldus.getSensors().forEach(function (sensor) {
+        var raw = telldus.getSensorHistory(sensor.protocol, sensor.model, sensor.id, sensor.type);
+        if (raw === null) {
+          return;
+        }
+        raw.timestamps.should.be.an.instanceOf(Int32Array);
+        raw.values.should.be.an.instanceOf(Float64Array);
+        raw.values.length.should.equal(raw.timestamps.length);
+
+        var hourly = telldus.getSensorHistory(sensor.protocol, sensor.model, sensor.id, sensor.type, {bucket: 3600});
+        hourly.timestamps.length.should.equal(24);
+        hourly.avg.should.be.an.instanceOf(Float64Array);
+      });
+    });
+
+
+    it('configureSensorHistory', function () {
+      telldus.configureSensorHistory({samples: 100});
+      telldus.getSensorHistoryStats().should.have.property('defaultSamples', 100);
+      telldus.configureSensorHistory({samples: 2880});
+    });
+
+  });//describe sensors
+
 });
\ No newline at end of file